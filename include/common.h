@@ -32,6 +32,12 @@ enum ins_opcode_t
 	READ,  // Write data to a byte on memory
 	WRITE, // Read data from a byte on memory
 	SYSCALL,
+	READN,  // Read a range of bytes from memory
+	WRITEN, // Fill a range of bytes on memory
+	MMAP,   // Map an anonymous memory area
+	ALLOCV, // Allocate memory in a chosen area
+	READV,  // Read a byte of a region in a chosen area
+	WRITEV, // Write a byte of a region in a chosen area
 };
 
 /* instructions executed by the CPU */
@@ -48,6 +54,7 @@ struct code_seg_t
 {
 	struct inst_t *text;
 	uint32_t size;
+	int shared; // Owned by the loader's program cache, not by the process
 };
 
 struct trans_table_t
@@ -99,6 +106,14 @@ struct pcb_t
 #endif
 	struct page_table_t *page_table; // Page table
 	uint32_t bp;			 // Break pointer
+	struct sc_ring *sc_ring;	 // Batched syscall ring, allocated on first use
+#ifdef SIM_STATS
+	/* Scheduling events in time slots, for the latency histograms */
+	uint64_t t_arrival;	 // Added to the ready queue by the loader
+	uint64_t t_ready;	 // Last time it entered the ready queue
+	int64_t t_first_run;	 // First dispatch, -1 before
+	uint64_t t_waiting;	 // Time spent in the ready queue so far
+#endif
 };
 
 #endif
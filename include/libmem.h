@@ -15,11 +15,19 @@
 #define SYSMEM_SWP_OP 3
 #define SYSMEM_IO_READ 4
 #define SYSMEM_IO_WRITE 5
+#define SYSMEM_SWPIN_OP 6
 
 extern struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid);
 int inc_vma_limit(struct pcb_t*, int, int);
 int __mm_swap_page(struct pcb_t*, int, int);
+int __mm_swap_in_page(struct pcb_t*, int, int);
 int liballoc(struct pcb_t *, uint32_t, uint32_t);
 int libfree(struct pcb_t *, uint32_t);
 int libread(struct pcb_t*, uint32_t, uint32_t, uint32_t*);
 int libwrite(struct pcb_t*, BYTE, uint32_t, uint32_t);
+int liballoc_vma(struct pcb_t *, uint32_t, uint32_t, uint32_t);
+int libread_vma(struct pcb_t*, int, uint32_t, uint32_t, uint32_t*);
+int libwrite_vma(struct pcb_t*, int, BYTE, uint32_t, uint32_t);
+int libmmap(struct pcb_t *, uint32_t, uint32_t, uint32_t);
+int libread_range(struct pcb_t*, uint32_t, uint32_t, BYTE*, uint32_t);
+int libwrite_range(struct pcb_t*, const BYTE*, uint32_t, uint32_t, uint32_t);
@@ -5,5 +5,10 @@
 
 struct pcb_t * load(const char * path);
 
+void unload(struct pcb_t * proc);
+
+void loader_share_programs(void);
+void loader_free_programs(void);
+
 #endif
 
@@ -0,0 +1,39 @@
+#ifndef LOG_H
+#define LOG_H
+
+/*
+ * Asynchronous logger: every thread formats its messages into a private
+ * lock-free ring, a background flusher writes them to stdout in the
+ * order they were produced. Categories are chosen at run time.
+ */
+
+#define LOG_ERR     (1U << 0) /* errors, always worth seeing */
+#define LOG_STATS   (1U << 1) /* end of run summaries */
+#define LOG_TIMER   (1U << 2) /* "Time slot" lines */
+#define LOG_SCHED   (1U << 3) /* loader and CPU dispatch events */
+#define LOG_SYSCALL (1U << 4) /* syscall output */
+#define LOG_MEM     (1U << 5) /* alloc/free/read/write results */
+#define LOG_PGTBL   (1U << 6) /* page table dumps */
+#define LOG_MEMDUMP (1U << 7) /* physical memory dumps */
+#define LOG_ALL     0xffU
+
+#define LOG_VERBOSITY_MAX 3
+
+#define LOG_REC_SZ   240  /* longest message, longer ones are cut */
+#define LOG_RING_SZ  512  /* records per thread, power of 2 */
+#define LOG_FLUSH_US 200  /* flusher pause when there is nothing to write */
+
+extern unsigned int log_mask;
+
+/* log_enabled - true when messages of @cat are printed, lets callers skip
+ * the work of building a dump nobody reads */
+#define log_enabled(cat) ((log_mask & (cat)) != 0)
+
+void log_set_verbosity(int level);
+int log_set_categories(const char *list);
+void log_start(void);
+void log_stop(void);
+void log_printf(unsigned int cat, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+#endif
@@ -2,6 +2,10 @@
 
 #include "bitops.h"
 #include "common.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "replay.h"
 
 /* CPU Bus definition */
 #define PAGING_CPU_BUS_WIDTH 22 /* 22bit bus - MAX SPACE 4MB */
@@ -12,12 +16,46 @@
 #endif
 #define PAGING_MEMRAMSZ BIT(21)
 #define PAGING_PAGE_ALIGNSZ(sz) (DIV_ROUND_UP(sz,PAGING_PAGESZ)*PAGING_PAGESZ)
+#define PAGING_PAGE_ALIGNDN(addr) ((addr) / PAGING_PAGESZ * PAGING_PAGESZ)
 
 #define PAGING_MEMSWPSZ BIT(29)
 #define PAGING_SWPFPN_OFFSET 5  
 #define PAGING_MAX_PGN  (DIV_ROUND_UP(BIT(PAGING_CPU_BUS_WIDTH),PAGING_PAGESZ))
 
 #define PAGING_SBRK_INIT_SZ PAGING_PAGESZ
+
+/* Virtual address space layout: the heap grows up from 0, the stack grows
+ * down from the top of the CPU bus and anonymous mappings are placed
+ * top-down below the stack limit */
+#define PAGING_VMA_HEAP     0
+#define PAGING_VMA_STACK    1
+#define PAGING_VMA_OF_RG    (-1) /* the area the region was allocated in */
+#define PAGING_STACK_TOP    BIT(PAGING_CPU_BUS_WIDTH)
+#define PAGING_STACK_MAXSZ  (64 * PAGING_PAGESZ)
+#define PAGING_MMAP_BASE    (PAGING_STACK_TOP - PAGING_STACK_MAXSZ)
+
+/* Direct reclaim: when MEMRAM runs dry a page of the faulting process, or
+ * else of another one, is evicted to swap; if none can be, retry with an
+ * exponential backoff */
+#ifndef MM_RECLAIM_RETRIES
+#define MM_RECLAIM_RETRIES 5
+#endif
+#ifndef MM_RECLAIM_BACKOFF_US
+#define MM_RECLAIM_BACKOFF_US 100 /* first pause, doubled at each retry */
+#endif
+
+#ifdef MM_KSWAPD
+/* Background reclaim starts below LOW percent of MEMRAM frames free and
+ * stops at HIGH percent, evicting at most BATCH pages per process visit */
+#define KSWAPD_WMARK_LOW  5
+#define KSWAPD_WMARK_HIGH 10
+#define KSWAPD_BATCH      8
+#endif
+
+#ifdef MM_KSM
+#define KSM_SCAN_INTERVAL_US 1000 /* pause between two full scans */
+#define KSM_HASH_BITS 10
+#endif
 /* PTE BIT */
 #define PAGING_PTE_PRESENT_MASK BIT(31) 
 #define PAGING_PTE_SWAPPED_MASK BIT(30)
@@ -25,10 +63,13 @@
 #define PAGING_PTE_DIRTY_MASK BIT(28)
 #define PAGING_PTE_EMPTY01_MASK BIT(14)
 #define PAGING_PTE_EMPTY02_MASK BIT(13)
+/* Read-only frame merged by same-page merging, writes break it (COW) */
+#define PAGING_PTE_SHARED_MASK PAGING_PTE_EMPTY01_MASK
 
 /* PTE BIT PRESENT */
 #define PAGING_PTE_SET_PRESENT(pte) (pte=pte|PAGING_PTE_PRESENT_MASK)
 #define PAGING_PAGE_PRESENT(pte) (pte&PAGING_PTE_PRESENT_MASK)
+#define PAGING_PAGE_SHARED(pte) (pte&PAGING_PTE_SHARED_MASK)
 
 /* USRNUM */
 #define PAGING_PTE_USRNUM_LOBIT 15
@@ -98,18 +139,36 @@
 #define PAGING_FPN(x)  GETVAL(x,PAGING_PTE_FPN_MASK,PAGING_PTE_FPN_LOBIT)
 
 /* Memory range operator */
-/* TODO implement the INCLUDE and OVERLAP checking mechanism */
-#define INCLUDE(x1,x2,y1,y2) (0)
-#define OVERLAP(x1,x2,y1,y2) (0)
+/* Half-open ranges [x1,x2) and [y1,y2) */
+#define INCLUDE(x1,x2,y1,y2) (((y1) >= (x1) && (y2) <= (x2)) ? 1 : 0)
+#define OVERLAP(x1,x2,y1,y2) (((x1) < (y2) && (y1) < (x2)) ? 1 : 0)
 
 /* VM region prototypes */
 struct vm_rg_struct * init_vm_rg(int rg_start, int rg_endi);
 int enlist_vm_rg_node(struct vm_rg_struct **rglist, struct vm_rg_struct* rgnode);
 int enlist_pgn_node(struct pgn_t **pgnlist, int pgn);
+
+/* Free region allocator prototypes */
+void vm_freerg_init(struct vm_freerg_set *set);
+int vm_freerg_insert(struct vm_freerg_set *set, struct vm_rg_struct *rg);
+int vm_freerg_alloc(struct vm_freerg_set *set, unsigned long size, struct vm_rg_struct *newrg);
+struct vm_rg_struct *vm_freerg_find(struct vm_freerg_set *set, unsigned long addr);
+int vm_freerg_take(struct vm_freerg_set *set, unsigned long start, unsigned long end);
+unsigned long vm_freerg_largest(struct vm_freerg_set *set);
+int vm_freerg_fragmentation(struct vm_freerg_set *set);
+void vm_freerg_clear(struct vm_freerg_set *set);
 int vmap_page_range(struct pcb_t *caller, int addr, int pgnum, 
                     struct framephy_struct *frames, struct vm_rg_struct *ret_rg);
+int vunmap_page_range(struct pcb_t *caller, unsigned long start, unsigned long end);
 int vm_map_ram(struct pcb_t *caller, int astart, int send, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg);
 int alloc_pages_range(struct pcb_t *caller, int incpgnum, struct framephy_struct **frm_lst);
+int reclaim_register(struct pcb_t *proc);
+void reclaim_unregister(struct pcb_t *proc);
+int reclaim_pick(struct pcb_t *caller, int *vicpgn, int *fpn, int *swpfpn);
+void reclaim_commit(struct pcb_t *caller, int vicpgn, int fpn, int swpfpn);
+void reclaim_cancel(struct pcb_t *caller, int vicpgn, int swpfpn);
+int reclaim_frame(struct pcb_t *caller, int *fpn);
+int shrink_procs(int nr, int batch, struct pcb_t *self);
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                 struct memphy_struct *mpdst, int dstfpn) ;
 #ifdef MM64
@@ -119,6 +178,7 @@ int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
 #endif
 
 int pte_set_fpn(pte_t *pte, int fpn);
+pte_t *pte_get_entry(struct mm_struct *mm, int pgn);
 int pte_set_swap(pte_t *pte, int swptyp, int swpoff);
 int init_pte(pte_t *pte,
              int pre,    // present
@@ -128,10 +188,15 @@ int init_pte(pte_t *pte,
              int swptyp, // swap type
              int swpoff); //swap offset
 int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr);
+int __mmap(struct pcb_t *caller, int vmaid, int size, int flags, int *map_addr);
 int __free(struct pcb_t *caller, int vmaid, int rgid);
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data);
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value);
+int __read_range(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *buf, int size);
+int __write_range(struct pcb_t *caller, int vmaid, int rgid, int offset, const BYTE *buf, int size);
 int init_mm(struct mm_struct *mm, struct pcb_t *caller);
+void pte_release(struct pcb_t *caller, pte_t pte);
+int free_pcb_memph(struct pcb_t *caller);
 
 /* VM prototypes */
 int pgalloc(struct pcb_t *proc, uint32_t size, uint32_t reg_index);
@@ -148,31 +213,67 @@ int pgwrite(
 		uint32_t offset);
 /* Local VM prototypes */
 struct vm_rg_struct * get_symrg_byid(struct mm_struct* mm, int rgid);
+struct vm_rg_struct * symrg_insert(struct mm_struct *mm, int rgid);
+int symrg_remove(struct mm_struct *mm, int rgid);
+void symrg_clear(struct mm_struct *mm);
 int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend);
 int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_struct *newrg);
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz);
 int find_victim_page(struct mm_struct* mm, int *pgn);
+pte_t *pg_pick_victim(struct mm_struct *mm, int *vicpgn);
 struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid);
+struct vm_area_struct *get_vma_by_addr(struct mm_struct *mm, unsigned long addr);
+int insert_vm_area(struct mm_struct *mm, struct vm_area_struct *vma);
+struct vm_area_struct *init_vm_area(int vmaid, unsigned long start, unsigned long end,
+                                    unsigned long flags);
+int map_vm_area(struct pcb_t *caller, int vmaid, int size, int flags);
+void remove_vm_area(struct mm_struct *mm, struct vm_area_struct *vma);
+void vma_set_range(struct mm_struct *mm, struct vm_area_struct *vma,
+                   unsigned long start, unsigned long end);
 
 /* MEM/PHY protypes */
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *fpn);
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn);
 int MEMPHY_read(struct memphy_struct * mp, int addr, BYTE *value);
 int MEMPHY_write(struct memphy_struct * mp, int addr, BYTE data);
+int MEMPHY_read_range(struct memphy_struct *mp, int addr, BYTE *buf, int size);
+int MEMPHY_write_range(struct memphy_struct *mp, int addr, const BYTE *buf, int size);
 int MEMPHY_dump(struct memphy_struct * mp);
+void MEMPHY_set_dump_delta(struct memphy_struct *mp, int on);
 int init_memphy(struct memphy_struct *mp, int max_size, int randomflg);
+void free_memphy(struct memphy_struct *mp);
 
 /* print list */
 int print_list_fp(struct framephy_struct *fp);
 int print_list_rg(struct vm_rg_struct *rg);
 int print_list_vma(struct vm_area_struct *rg);
+int print_vm_freerg(struct vm_freerg_set *set);
 
 #ifdef MM64
+uint64_t *pgtable_alloc(void);
+uint64_t *pgtable_walk(struct mm_struct *mm, uint64_t addr);
 int vmap_page_range_64(struct pcb_t *caller, int addr, int pgnum, 
                        struct framephy_struct *frames, struct vm_rg_struct *ret_rg);
 void print_pgtbl64(struct mm_struct *mm, uint64_t start, uint64_t end);
+void pgtable_free(struct pcb_t *caller);
+void pgtable_unmap(struct pcb_t *caller, uint64_t start, uint64_t end);
 #endif
 
+#ifdef MM_KSM
+int ksm_start(struct memphy_struct *mram);
+void ksm_stop(void);
+void ksm_scan_pass(void);
+int ksm_register_mm(struct mm_struct *mm);
+int ksm_break_cow(struct mm_struct *mm, int pgn, int *fpn);
+void ksm_unregister_mm(struct mm_struct *mm);
+int ksm_put_page(int fpn);
+#endif
+
+#ifdef MM_KSWAPD
+struct timer_id_t;
+int kswapd_start(struct memphy_struct *mram, struct timer_id_t *timer_id);
+void kswapd_stop(void);
+#endif
 
 int print_list_pgn(struct pgn_t *ip);
 int print_pgtbl(struct pcb_t *ip, uint32_t start, uint32_t end);
@@ -9,6 +9,12 @@
 //#define MM_FIXED_MEMSZ
 //#define VMDBG 1
 //#define MMDBG 1
+//#define MM_KSM 1
+//#define MM_KSWAPD 1
+//#define SYSCALL_STATS 1
+#define SIM_STATS 1
+#define SIM_TRACE 1
+#define SIM_REPLAY 1
 #define IODUMP 1
 #define PAGETBL_DUMP 1
 
@@ -1,10 +1,16 @@
 #ifndef OSMM_H
 #define OSMM_H
 
+#include <pthread.h>
 
 #define MM_PAGING
 #define PAGING_MAX_MMSWP 4 /* max number of supported swapped space */
-#define PAGING_MAX_SYMTBL_SZ 30
+#define PAGING_SYMTBL_INIT_SZ 16 /* first size of the symbol table, power of two */
+
+/* Free region index: size classes are (log2 size, 1/8th of that range) */
+#define VM_FREERG_FLI 32
+#define VM_FREERG_SLI_BITS 3
+#define VM_FREERG_SLI (1 << VM_FREERG_SLI_BITS)
 
 typedef char BYTE;
 typedef uint32_t addr_t;
@@ -21,8 +27,47 @@ struct pgn_t{
 struct vm_rg_struct {
    unsigned long rg_start;
    unsigned long rg_end;
+   int rg_vmaid; /* area the region was allocated in */
 
    struct vm_rg_struct *rg_next;
+
+   /* Free region index links, only meaningful while the region is free */
+   struct vm_rg_struct *rg_prev;
+   struct vm_rg_struct *rg_left;
+   struct vm_rg_struct *rg_right;
+   uint32_t rg_prio;
+};
+
+/*
+ *  Free regions of a memory area, indexed twice: segregated size-class
+ *  bins (linked through rg_next/rg_prev) for allocation and an
+ *  address-ordered treap (rg_left/rg_right) for coalescing on free.
+ */
+struct vm_freerg_set {
+   struct vm_rg_struct *root;
+   uint32_t fl_bitmap;
+   uint32_t sl_bitmap[VM_FREERG_FLI];
+   struct vm_rg_struct *bins[VM_FREERG_FLI][VM_FREERG_SLI];
+
+   int nr_regions;
+   unsigned long free_bytes;
+   uint32_t seed;
+};
+
+/* VMA index trees of an mm */
+#define VMA_TREE_ADDR 0 /* interval tree keyed by vm_start */
+#define VMA_TREE_ID   1 /* keyed by vm_id */
+#define VMA_NR_TREES  2
+
+/* Area flags */
+#define VM_GROWSDOWN 0x1 /* grows toward lower addresses (stack) */
+#define VM_FIXEDSZ   0x2 /* never grows (anonymous mapping) */
+#define VM_LOCKED    0x4 /* pages are never picked as swap victims */
+
+struct vm_area_struct;
+struct vma_tree_link {
+   struct vm_area_struct *left;
+   struct vm_area_struct *right;
 };
 
 /*
@@ -34,13 +79,20 @@ struct vm_area_struct {
    unsigned long vm_end;
 
    unsigned long sbrk;
+   unsigned long vm_flags;
+   unsigned long vm_grow_min; /* smallest growth step in bytes */
 /*
  * Derived field
  * unsigned long vm_limit = vm_end - vm_start
  */
    struct mm_struct *vm_mm;
-   struct vm_rg_struct *vm_freerg_list;
+   struct vm_freerg_set vm_freerg;
    struct vm_area_struct *vm_next;
+
+   /* Treap links, shared priority, max vm_end of the address subtree */
+   struct vma_tree_link vm_tree[VMA_NR_TREES];
+   uint32_t vm_prio;
+   unsigned long vm_subtree_end;
 };
 
 /* 
@@ -58,12 +110,22 @@ struct mm_struct {
 #endif
 
    struct vm_area_struct *mmap;
+   struct vm_area_struct *mm_tree[VMA_NR_TREES];
+   uint32_t mm_vma_seed;
 
-   /* Currently we support a fixed number of symbol */
-   struct vm_rg_struct symrgtbl[PAGING_MAX_SYMTBL_SZ];
+   /* Symbol table: open-addressed map from region id to region,
+    * allocated on the first alloc and doubled when 3/4 full */
+   int *symrg_keys;
+   struct vm_rg_struct *symrgtbl;
+   int symrg_cap;
+   int symrg_count;
+   int symrg_used; /* live entries plus tombstones */
 
    /* list of free page */
    struct pgn_t *fifo_pgn;
+
+   /* Serializes the memory operations of this process */
+   pthread_mutex_t mm_lock;
 };
 
 /*
@@ -89,6 +151,19 @@ struct memphy_struct {
    /* Management structure */
    struct framephy_struct *free_fp_list;
    struct framephy_struct *used_fp_list;
+   int free_fp_cnt;   /* atomic, readers may skip fp_lock */
+
+   /* Frame allocator lock, the device is shared by all processes */
+   pthread_mutex_t fp_lock;
+
+   /* Dump support: frames that may hold non-zero bytes, frames written
+    * since the last dump, and the contents seen by the last dump */
+   uint64_t *dirty_map;
+   uint64_t *dump_map;
+   int map_words;
+   BYTE *dump_shadow;
+   int dump_delta;      /* print only bytes changed since the last dump */
+   pthread_mutex_t dump_lock;
 };
 
 #endif
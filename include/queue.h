@@ -1,14 +1,23 @@
-
 #ifndef QUEUE_H
 #define QUEUE_H
 
 #include "common.h"
 
-#define MAX_QUEUE_SIZE 10
+#define MAX_QUEUE_SIZE 10 /* initial capacity, the queue grows on demand */
+
+/* A queued process, @seq keeps the arrival order of equal priorities */
+struct queue_ent {
+	struct pcb_t * proc;
+	uint32_t priority;
+	uint64_t seq;
+};
 
+/* Binary heap: the highest priority leaves first, the earliest among equals */
 struct queue_t {
-	struct pcb_t * proc[MAX_QUEUE_SIZE];
+	struct queue_ent * ent;
 	int size;
+	int cap;
+	uint64_t seq;
 };
 
 void enqueue(struct queue_t * q, struct pcb_t * proc);
@@ -17,5 +26,7 @@ struct pcb_t * dequeue(struct queue_t * q);
 
 int empty(struct queue_t * q);
 
-#endif
+/* Release the storage of an emptied queue */
+void queue_free(struct queue_t * q);
 
+#endif
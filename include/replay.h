@@ -0,0 +1,93 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "common.h"
+#include <pthread.h>
+
+/*
+ * Record and replay of lock-ordered events. A recording holds the changes
+ * of the ready queues, of the free frame lists, of the reclaim list and of
+ * the memory of each process in the order the threads took the lock, with
+ * the thread and the time slot.
+ * A replay makes every thread wait until the next recorded event is its
+ * own, so the threads take these locks exactly as recorded, and reports
+ * the first event that does not match.
+ */
+
+enum replay_kind {
+	REPLAY_ADD,       /* the loader adds a process, @arg is its pid */
+	REPLAY_GET,       /* a CPU takes the next process, @arg is its pid or 0 */
+	REPLAY_PUT,       /* a CPU puts its process back, @arg is its pid */
+	REPLAY_FRAME_GET, /* a frame is taken from a free list, @arg is its fpn */
+	REPLAY_FRAME_PUT, /* a frame is given back, @arg is its fpn */
+	REPLAY_RECLAIM,   /* the reclaim list is used, @arg is a pid or 0 */
+	REPLAY_DONE,      /* the loader flag is set or read, @arg is its value */
+	REPLAY_MM,        /* the mm_lock of a process is taken */
+	REPLAY_TRYLOCK,   /* a mm_lock is tried, @arg is 1 if it was taken */
+	REPLAY_KILL,      /* killall drops processes from the queues, @arg is their count */
+};
+
+/* Devices other than the CPUs, which use their id */
+#define REPLAY_DEV_LOADER -1
+#define REPLAY_DEV_OTHER  -2
+
+#define REPLAY_MAGIC   "OSRP"
+#define REPLAY_VERSION 1
+#define REPLAY_WAIT_S  5    /* a turn that does not come means divergence */
+#define REPLAY_FLUSH   4096 /* records kept before they are written */
+
+/* On disk, after a header of the magic and the version */
+struct replay_rec {
+	uint32_t slot;
+	uint32_t arg;
+	int16_t dev;
+	uint8_t kind;
+	uint8_t pad;
+};
+
+#ifdef SIM_REPLAY
+
+#define REPLAY_RECORD 1
+#define REPLAY_PLAY   2
+
+extern int replay_mode;
+
+int replay_record(const char * path);
+int replay_play(const char * path);
+int replay_stop(void);
+void replay_bind(int dev);
+void replay_enter(int kind);
+void replay_locked(int kind);
+void replay_leave(int kind, long arg);
+int replay_trylock(pthread_mutex_t * m);
+
+/* Take @m as event @kind, in replay only on the turn of this thread */
+#define REPLAY_LOCK(kind, m) do { \
+	if (__atomic_load_n(&replay_mode, __ATOMIC_ACQUIRE)) \
+		replay_enter(kind); \
+	pthread_mutex_lock(m); \
+	if (__atomic_load_n(&replay_mode, __ATOMIC_ACQUIRE)) \
+		replay_locked(kind); \
+} while (0)
+
+/* Release @m, @arg is the outcome checked in replay */
+#define REPLAY_UNLOCK(kind, arg, m) do { \
+	if (__atomic_load_n(&replay_mode, __ATOMIC_ACQUIRE)) \
+		replay_leave(kind, arg); \
+	pthread_mutex_unlock(m); \
+} while (0)
+
+/* Try @m, in replay the outcome is the recorded one; true if taken */
+#define REPLAY_TRYLOCK(m) (__atomic_load_n(&replay_mode, __ATOMIC_ACQUIRE) ? \
+	replay_trylock(m) : pthread_mutex_trylock(m) == 0)
+
+#else
+
+#define replay_bind(dev) do { } while (0)
+#define REPLAY_LOCK(kind, m) pthread_mutex_lock(m)
+#define REPLAY_UNLOCK(kind, arg, m) pthread_mutex_unlock(m)
+#define REPLAY_TRYLOCK(m) (pthread_mutex_trylock(m) == 0)
+
+#endif
+
+#endif
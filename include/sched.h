@@ -1,5 +1,5 @@
-#ifndef QUEUE_H
-#define QUEUE_H
+#ifndef SCHED_H
+#define SCHED_H
 
 #include "common.h"
 
@@ -23,6 +23,15 @@ void put_proc(struct pcb_t * proc);
 /* Add a new process to ready queue */
 void add_proc(struct pcb_t * proc);
 
+#ifdef MLQ_SCHED
+/* The MLQ policy behind get_proc and put_proc */
+struct pcb_t * get_mlq_proc(void);
+void put_mlq_proc(struct pcb_t * proc);
+#endif
+
+/* Number of ready processes of each priority */
+void sched_queue_depths(int depth[MAX_PRIO]);
+
 #endif
 
 
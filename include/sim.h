@@ -0,0 +1,82 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "common.h"
+#include "queue.h"
+#include <pthread.h>
+
+/*
+ * State of one simulation. What a run reads and changes lives here rather
+ * than in file scope statics, so one process can run many configs at the
+ * same time. Every thread of a run points cur_sim at its simulation.
+ */
+
+struct timer_id_container_t;
+struct reclaim_slot;
+struct stats_run;
+struct ksm_run;
+struct kswapd_run;
+
+struct sim {
+	char name[128];    /* config in input/, plus the sweep parameters */
+
+	/* Config */
+	int time_slot;
+	int num_cpus;
+	int num_processes;
+	int memramsz;
+	int memswpsz[PAGING_MAX_MMSWP];
+	char ** path;
+	unsigned long * start_time;
+	unsigned long * prio;
+
+	/* Options */
+	int ordered;       /* devices run one after the other, see -D */
+	int dump_delta;
+	int stats_on;
+	int stats_every;
+	int batch;         /* one of many runs, prints only its summary line */
+	const char * trace_path;
+	const char * record_path;
+	const char * replay_path;
+
+	/* Loader */
+	uint32_t avail_pid;
+	int done;          /* every process is loaded */
+	pthread_mutex_t done_lock;
+
+	/* Timer */
+	pthread_t timer;
+	struct timer_id_container_t * dev_list;
+	uint64_t time;
+	int timer_started;
+
+	/* Scheduler */
+	struct queue_t ready_queue;
+	struct queue_t run_queue;
+	pthread_mutex_t queue_lock;
+#ifdef MLQ_SCHED
+	struct queue_t mlq_ready_queue[MAX_PRIO];
+	int slot[MAX_PRIO];
+#endif
+
+	/* Processes whose pages may be reclaimed, see mm.c */
+	struct reclaim_slot * reclaim_list;
+	struct reclaim_slot * reclaim_cursor;
+	pthread_mutex_t reclaim_list_lock;
+
+	/* Background memory daemons, see mm-ksm.c and mm-kswapd.c */
+	struct ksm_run * ksm;
+	struct kswapd_run * kswapd;
+
+	struct stats_run * stats;
+};
+
+/* The simulation the calling thread works for */
+extern __thread struct sim * cur_sim;
+
+struct sim * sim_new(const char * name);
+void sim_free(struct sim * sim);
+void sim_bind(struct sim * sim);
+
+#endif
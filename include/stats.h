@@ -0,0 +1,73 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+
+/*
+ * Simulator counters. Every thread counts into its own cache line aligned
+ * block, CPU threads are tagged with their id. The blocks are merged when
+ * the run ends and written as JSON and CSV.
+ */
+
+#define STATS_NR_OPCODES  (WRITEV + 1)
+#define STATS_NR_SYSCALLS 32 /* last slot collects larger numbers */
+
+/*
+ * Latency histograms are log-linear like HdrHistogram: values below 16
+ * are exact, above that each power of 2 is cut in 8 buckets, so a
+ * percentile is off by at most 12.5%
+ */
+#define LAT_SUB_BITS 3
+#define LAT_LINEAR   (1 << (LAT_SUB_BITS + 1))
+#define LAT_BUCKETS  (LAT_LINEAR + (64 - LAT_SUB_BITS - 1) * (1 << LAT_SUB_BITS))
+
+struct stats_cpu {
+	int cpu; /* -1 for the loader and background threads */
+	uint64_t insn[STATS_NR_OPCODES];
+	uint64_t dispatches;
+	uint64_t context_switches;
+	uint64_t idle_slots;
+	uint64_t page_faults;
+	uint64_t swap_ins;
+	uint64_t swap_outs;
+	uint64_t syscalls[STATS_NR_SYSCALLS];
+	struct stats_cpu * next;
+} __attribute__((aligned(64)));
+
+#ifdef SIM_STATS
+
+struct memphy_struct;
+
+struct stats_cpu * stats_get(void);
+void stats_bind_cpu(int id);
+void stats_start(struct memphy_struct * mram, int interval);
+void stats_tick(uint64_t slot);
+int stats_write(const char * prefix);
+void stats_stop(void);
+void stats_print_latency(void);
+
+/* Scheduling events of a process, at the current time slot */
+void stats_proc_arrive(struct pcb_t * proc);
+void stats_proc_dispatch(struct pcb_t * proc);
+void stats_proc_preempt(struct pcb_t * proc);
+void stats_proc_finish(struct pcb_t * proc);
+
+/* Only the owning thread writes a counter, others read it relaxed */
+#define STATS_ADD(field, n) do { \
+	struct stats_cpu * s_ = stats_get(); \
+	__atomic_store_n(&s_->field, s_->field + (n), __ATOMIC_RELAXED); \
+} while (0)
+
+#else
+
+#define STATS_ADD(field, n) do { } while (0)
+#define stats_bind_cpu(id) do { } while (0)
+#define stats_tick(slot) do { } while (0)
+#define stats_proc_arrive(proc) do { } while (0)
+#define stats_proc_dispatch(proc) do { } while (0)
+#define stats_proc_preempt(proc) do { } while (0)
+#define stats_proc_finish(proc) do { } while (0)
+
+#endif
+
+#endif
@@ -29,12 +29,54 @@ struct sc_regs {
         int32_t flags;
 };
 
+/*
+ * Per process submission/completion ring, several syscalls are queued
+ * with libsyscall_prep() and enter the kernel once in libsyscall_submit().
+ * pg_getpage links the swap-out of its victim and the swap-in of the
+ * faulting page into one submission.
+ */
+#define SC_RING_SZ 16 /* power of 2 */
+#define SC_RING_MASK (SC_RING_SZ - 1)
+#define SC_NR_RING_ENTER 18
+
+#define SC_SQE_LINK 0x1 /* cancel the following entry if this one fails */
+#define SC_CQE_CANCELED -125
+
+struct sc_sqe {
+        uint32_t nr;
+        uint32_t flags;
+        uint32_t user_data;
+        struct sc_regs regs;
+};
+
+struct sc_cqe {
+        uint32_t user_data;
+        int32_t res;
+        struct sc_regs regs; /* registers as left by the syscall */
+};
+
+struct sc_ring {
+        struct sc_sqe sq[SC_RING_SZ];
+        uint32_t sq_head; /* consumed by the kernel */
+        uint32_t sq_tail; /* produced by the library */
+
+        struct sc_cqe cq[SC_RING_SZ];
+        uint32_t cq_head; /* consumed by the library */
+        uint32_t cq_tail; /* produced by the kernel */
+};
 
 /* This is used purely for kernel trace the table of system call */
-//typedef long (*sys_call_ptr_t)(const struct sc_regs *);
+typedef int (*sys_call_ptr_t)(struct pcb_t *, struct sc_regs *);
 extern const char* sys_call_table[];
 extern const int syscall_table_size;
 int syscall(struct pcb_t*, uint32_t, struct sc_regs*);
 int libsyscall(struct pcb_t*, uint32_t, uint32_t, uint32_t, uint32_t);
+int libsyscall_prep(struct pcb_t*, uint32_t, struct sc_regs*, uint32_t, uint32_t);
+int libsyscall_submit(struct pcb_t*);
+int libsyscall_reap(struct pcb_t*, struct sc_cqe*);
 int __sys_ni_syscall(struct pcb_t*, struct sc_regs*);
+#ifdef SYSCALL_STATS
+extern uint64_t sys_ring_ops; /* entries run by sys_ring_enter */
+void syscall_dump_stats(void);
+#endif
 
@@ -7,6 +7,7 @@
 struct timer_id_t {
 	int done;
 	int fsh;
+	int turn;	/* ordered mode (sim->ordered): may run in the current slot */
 	pthread_cond_t event_cond;
 	pthread_mutex_t event_lock;
 	pthread_cond_t timer_cond;
@@ -23,6 +24,9 @@ void detach_event(struct timer_id_t * event);
 
 void next_slot(struct timer_id_t* timer_id);
 
+/* Wait for the first turn of a device, before its work in slot 0 */
+void wait_slot(struct timer_id_t * timer_id);
+
 uint64_t current_time();
 
 #endif
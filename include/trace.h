@@ -0,0 +1,54 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "common.h"
+#include "timer.h"
+
+/*
+ * Timeline of a run in Chrome trace-event JSON (chrome://tracing,
+ * ui.perfetto.dev). Threads append fixed size records to a private
+ * buffer, a full buffer is formatted into the file under a lock.
+ * One time slot is shown as 1 ms.
+ */
+
+enum trace_kind {
+	TRACE_RUN,         /* a process ran on a CPU, @arg is the duration */
+	TRACE_FAULT,       /* page fault, @arg is the page number */
+	TRACE_SWAP_IN,
+	TRACE_SWAP_OUT,
+	TRACE_SYSCALL,     /* @arg is the syscall number */
+	TRACE_FREE_FRAMES, /* counter, @arg is the value */
+	TRACE_READY,       /* counter of priority @pid, @arg is the depth */
+};
+
+#define TRACE_BUF_EVENTS 4096
+#define TRACE_SLOT_US    1000
+
+#ifdef SIM_TRACE
+
+struct memphy_struct;
+
+extern int trace_on;
+
+int trace_start(const char * path, struct memphy_struct * mram);
+void trace_stop(void);
+void trace_bind(int tid, const char * name);
+void trace_event(int kind, uint64_t slot, int pid, long arg);
+void trace_tick(uint64_t slot);
+
+#define TRACE_AT(kind, slot, pid, arg) do { \
+	if (trace_on) \
+		trace_event(kind, slot, pid, arg); \
+} while (0)
+#define TRACE(kind, pid, arg) TRACE_AT(kind, current_time(), pid, arg)
+
+#else
+
+#define TRACE_AT(kind, slot, pid, arg) do { (void)(slot); } while (0)
+#define TRACE(kind, pid, arg) do { } while (0)
+#define trace_bind(tid, name) do { } while (0)
+#define trace_tick(slot) do { } while (0)
+
+#endif
+
+#endif
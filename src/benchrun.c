@@ -0,0 +1,362 @@
+/*
+ * benchrun - end to end benchmark of the simulator
+ *
+ * Runs ./os -v 0 -s on each configure file several times, measures wall
+ * time and peak RSS of the run and reads the counters it wrote to
+ * output/<config>.stats.csv. Every run is a row of the result CSV, a
+ * summary with 95% confidence intervals is printed and, given a baseline
+ * CSV from an earlier run, each config is compared against it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define BENCH_MAX_CONFIGS 64
+#define BENCH_MAX_REPS    100
+#define BENCH_NAME_LEN    64
+
+enum bench_metric {
+	M_WALL,          /* seconds */
+	M_SLOTS,         /* simulated time slots */
+	M_INSNS,         /* instructions executed */
+	M_SLOTS_PER_S,
+	M_INSNS_PER_S,
+	M_MAXRSS,        /* KiB */
+	M_DISPATCHES,
+	M_CTX_SWITCHES,
+	M_PAGE_FAULTS,
+	M_SWAP_INS,
+	M_SWAP_OUTS,
+	NR_METRICS
+};
+
+static const char * metric_name[NR_METRICS] = {
+	"wall_s", "slots", "insns", "slots_per_s", "insns_per_s", "maxrss_kb",
+	"dispatches", "context_switches", "page_faults", "swap_ins", "swap_outs",
+};
+
+struct bench_set {
+	char config[BENCH_NAME_LEN];
+	int n;
+	double v[BENCH_MAX_REPS][NR_METRICS];
+};
+
+/* Two sided 95% Student t quantiles for 1 .. 30 degrees of freedom */
+static const double t95[31] = { 0,
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+static double t_quantile(double df) {
+	int d = (int)df;
+
+	if (d < 1)
+		return INFINITY;
+	return d <= 30 ? t95[d] : 1.960;
+}
+
+static void mean_var(const struct bench_set * s, int m, double * mean, double * var) {
+	double sum = 0, sq = 0;
+	int i;
+
+	for (i = 0; i < s->n; i++)
+		sum += s->v[i][m];
+	*mean = sum / s->n;
+	for (i = 0; i < s->n; i++)
+		sq += (s->v[i][m] - *mean) * (s->v[i][m] - *mean);
+	*var = s->n > 1 ? sq / (s->n - 1) : 0;
+}
+
+/* Half width of the 95% confidence interval of the mean */
+static double ci95(const struct bench_set * s, int m) {
+	double mean, var;
+
+	mean_var(s, m, &mean, &var);
+	return s->n > 1 ? t_quantile(s->n - 1) * sqrt(var / s->n) : 0;
+}
+
+/*
+ * read_stats - counters of the last run from output/<config>.stats.csv,
+ * '/' in the config name is written as '_' like os does
+ */
+static int read_stats(const char * config, double * v) {
+	char path[256], line[256], scope[64], counter[64];
+	double value;
+	FILE * f;
+	char * c;
+
+	snprintf(path, sizeof(path), "output/%s.stats.csv", config);
+	for (c = path + strlen("output/"); *c; c++)
+		if (*c == '/') *c = '_';
+	if ((f = fopen(path, "r")) == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%63[^,],%63[^,],%lf", scope, counter, &value) != 3)
+			continue;
+		if (strcmp(scope, "run") == 0 && strcmp(counter, "slots") == 0)
+			v[M_SLOTS] = value;
+		if (strcmp(scope, "total") != 0)
+			continue;
+		if (strncmp(counter, "insn_", 5) == 0)
+			v[M_INSNS] += value;
+		else if (strcmp(counter, "dispatches") == 0)
+			v[M_DISPATCHES] = value;
+		else if (strcmp(counter, "context_switches") == 0)
+			v[M_CTX_SWITCHES] = value;
+		else if (strcmp(counter, "page_faults") == 0)
+			v[M_PAGE_FAULTS] = value;
+		else if (strcmp(counter, "swap_ins") == 0)
+			v[M_SWAP_INS] = value;
+		else if (strcmp(counter, "swap_outs") == 0)
+			v[M_SWAP_OUTS] = value;
+	}
+	fclose(f);
+	return 0;
+}
+
+/* run_once - one run of the simulator, output goes to /dev/null */
+static int run_once(const char * os, const char * config, double * v) {
+	struct timespec t0, t1;
+	struct rusage ru;
+	int status;
+	pid_t pid;
+
+	memset(v, 0, sizeof(double) * NR_METRICS);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ((pid = fork()) < 0)
+		return -1;
+	if (pid == 0) {
+		int fd = open("/dev/null", O_WRONLY);
+
+		dup2(fd, STDOUT_FILENO);
+		execl(os, os, "-v", "0", "-s", config, (char *)NULL);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &ru) < 0)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "benchrun: %s %s failed with status %d\n", os, config, status);
+		return -1;
+	}
+
+	v[M_WALL] = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	v[M_MAXRSS] = ru.ru_maxrss;
+	if (read_stats(config, v) != 0) {
+		fprintf(stderr, "benchrun: no counters for %s, is SIM_STATS on?\n", config);
+		return -1;
+	}
+	v[M_SLOTS_PER_S] = v[M_SLOTS] / v[M_WALL];
+	v[M_INSNS_PER_S] = v[M_INSNS] / v[M_WALL];
+	return 0;
+}
+
+static struct bench_set * find_set(struct bench_set * sets, int nr, const char * config) {
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (strcmp(sets[i].config, config) == 0)
+			return &sets[i];
+	return NULL;
+}
+
+/* read_csv - load the runs of a result CSV written by write_csv */
+static int read_csv(const char * path, struct bench_set * sets) {
+	char line[1024], config[BENCH_NAME_LEN];
+	int nr = 0, rep, m, off;
+	FILE * f;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		struct bench_set * s;
+		double v[NR_METRICS];
+		char * p;
+
+		if (sscanf(line, "%63[^,],%d%n", config, &rep, &off) != 2)
+			continue; /* header */
+		for (m = 0, p = line + off; m < NR_METRICS && *p == ','; m++)
+			v[m] = strtod(p + 1, &p);
+		if (m != NR_METRICS)
+			continue;
+		if ((s = find_set(sets, nr, config)) == NULL) {
+			if (nr == BENCH_MAX_CONFIGS)
+				continue;
+			s = &sets[nr++];
+			snprintf(s->config, sizeof(s->config), "%s", config);
+			s->n = 0;
+		}
+		if (s->n < BENCH_MAX_REPS)
+			memcpy(s->v[s->n++], v, sizeof(v));
+	}
+	fclose(f);
+	return nr;
+}
+
+static int write_csv(const char * path, struct bench_set * sets, int nr) {
+	FILE * f;
+	int i, r, m;
+
+	if ((f = fopen(path, "w")) == NULL) {
+		fprintf(stderr, "benchrun: cannot write %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	fprintf(f, "config,rep");
+	for (m = 0; m < NR_METRICS; m++)
+		fprintf(f, ",%s", metric_name[m]);
+	fprintf(f, "\n");
+	for (i = 0; i < nr; i++) {
+		for (r = 0; r < sets[i].n; r++) {
+			fprintf(f, "%s,%d", sets[i].config, r);
+			for (m = 0; m < NR_METRICS; m++)
+				fprintf(f, ",%.6g", sets[i].v[r][m]);
+			fprintf(f, "\n");
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+static void print_summary(struct bench_set * sets, int nr) {
+	double mean, var;
+	int i;
+
+	printf("%-28s %4s %18s %22s %22s %10s\n", "config", "runs",
+	       "wall (s)", "slots/s", "insns/s", "rss (KiB)");
+	for (i = 0; i < nr; i++) {
+		struct bench_set * s = &sets[i];
+		char wall[32], sps[32], ips[32];
+
+		mean_var(s, M_WALL, &mean, &var);
+		snprintf(wall, sizeof(wall), "%.4f +- %.4f", mean, ci95(s, M_WALL));
+		mean_var(s, M_SLOTS_PER_S, &mean, &var);
+		snprintf(sps, sizeof(sps), "%.0f +- %.0f", mean, ci95(s, M_SLOTS_PER_S));
+		mean_var(s, M_INSNS_PER_S, &mean, &var);
+		snprintf(ips, sizeof(ips), "%.0f +- %.0f", mean, ci95(s, M_INSNS_PER_S));
+		mean_var(s, M_MAXRSS, &mean, &var);
+		printf("%-28s %4d %18s %22s %22s %10.0f\n", s->config, s->n, wall, sps, ips, mean);
+	}
+}
+
+/*
+ * compare - Welch interval for the change of each metric against the
+ * baseline. A change is only reported when the whole interval is past
+ * @threshold percent. Returns the number of regressions.
+ */
+static int compare(struct bench_set * sets, int nr, struct bench_set * base, int nr_base,
+                   double threshold) {
+	static const struct { int metric; int higher_is_better; } checked[] = {
+		{ M_WALL, 0 }, { M_SLOTS_PER_S, 1 }, { M_MAXRSS, 0 },
+	};
+	int i, k, regressions = 0;
+
+	printf("\n%-28s %-12s %12s %12s %22s\n", "config", "metric", "baseline", "current",
+	       "change (95% CI)");
+	for (i = 0; i < nr; i++) {
+		struct bench_set * b = find_set(base, nr_base, sets[i].config);
+
+		if (b == NULL) {
+			printf("%-28s not in the baseline\n", sets[i].config);
+			continue;
+		}
+		for (k = 0; k < (int)(sizeof(checked) / sizeof(checked[0])); k++) {
+			int m = checked[k].metric;
+			double m0, v0, m1, v1, se, df, lo, hi;
+			const char * verdict = "";
+
+			mean_var(b, m, &m0, &v0);
+			mean_var(&sets[i], m, &m1, &v1);
+			if (m0 == 0)
+				continue;
+			se = sqrt(v0 / b->n + v1 / sets[i].n);
+			/* Welch-Satterthwaite degrees of freedom */
+			df = se > 0 ? pow(se, 4) / (pow(v0 / b->n, 2) / (b->n > 1 ? b->n - 1 : 1) +
+			                            pow(v1 / sets[i].n, 2) / (sets[i].n > 1 ? sets[i].n - 1 : 1))
+			            : 1;
+			lo = 100 * (m1 - m0 - t_quantile(df) * se) / m0;
+			hi = 100 * (m1 - m0 + t_quantile(df) * se) / m0;
+			if (b->n < 2 || sets[i].n < 2)
+				lo = -INFINITY, hi = INFINITY; /* no variance, no verdict */
+
+			if (lo > threshold || hi < -threshold) {
+				int worse = (lo > threshold) != checked[k].higher_is_better;
+
+				verdict = worse ? "  REGRESSION" : "  improved";
+				regressions += worse;
+			}
+			printf("%-28s %-12s %12.4g %12.4g %+8.1f%% [%+.1f, %+.1f]%s\n",
+			       sets[i].config, metric_name[m], m0, m1,
+			       100 * (m1 - m0) / m0, lo, hi, verdict);
+		}
+	}
+	return regressions;
+}
+
+static void usage(void) {
+	fprintf(stderr,
+		"Usage: benchrun [-n reps] [-o result.csv] [-b baseline.csv] [-t percent] [-x os] config...\n"
+		"  -n reps      : runs of each config (5)\n"
+		"  -o file      : every run as a CSV row (output/bench.csv)\n"
+		"  -b file      : compare against the result CSV of an earlier run\n"
+		"  -t percent   : smallest change reported against the baseline (10)\n"
+		"  -x os        : simulator binary (./os)\n"
+		"Exits with 2 when a config regressed against the baseline.\n");
+}
+
+int main(int argc, char * argv[]) {
+	static struct bench_set sets[BENCH_MAX_CONFIGS], base[BENCH_MAX_CONFIGS];
+	const char * out = "output/bench.csv", * baseline = NULL, * os = "./os";
+	double threshold = 10;
+	int reps = 5, opt, nr, nr_base = 0, i, r;
+
+	while ((opt = getopt(argc, argv, "n:o:b:t:x:")) != -1) {
+		switch (opt) {
+		case 'n': reps = atoi(optarg); break;
+		case 'o': out = optarg; break;
+		case 'b': baseline = optarg; break;
+		case 't': threshold = atof(optarg); break;
+		case 'x': os = optarg; break;
+		default: usage(); return 1;
+		}
+	}
+	nr = argc - optind;
+	if (nr < 1 || nr > BENCH_MAX_CONFIGS || reps < 1 || reps > BENCH_MAX_REPS) {
+		usage();
+		return 1;
+	}
+	if (baseline != NULL && (nr_base = read_csv(baseline, base)) < 0) {
+		fprintf(stderr, "benchrun: cannot read baseline %s, run without it to create one\n",
+		        baseline);
+		return 1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		snprintf(sets[i].config, sizeof(sets[i].config), "%s", argv[optind + i]);
+		fprintf(stderr, "benchrun: %s", sets[i].config);
+		for (r = 0; r < reps; r++) {
+			if (run_once(os, sets[i].config, sets[i].v[r]) != 0)
+				return 1;
+			fprintf(stderr, ".");
+		}
+		sets[i].n = reps;
+		fprintf(stderr, "\n");
+	}
+
+	if (write_csv(out, sets, nr) != 0)
+		return 1;
+	print_summary(sets, nr);
+	if (baseline != NULL && compare(sets, nr, base, nr_base, threshold) > 0)
+		return 2;
+	return 0;
+}
@@ -4,6 +4,8 @@
 #include "mm.h"
 #include "syscall.h"
 #include "libmem.h"
+#include <stdlib.h>
+#include <string.h>
 
 int calc(struct pcb_t *proc)
 {
@@ -57,6 +59,46 @@ int write(
 	return write_mem(proc->regs[destination] + offset, proc, data);
 }
 
+int readn(
+	struct pcb_t *proc, // Process executing the instruction
+	uint32_t source,	// Index of source register
+	uint32_t offset,	// Source address = [source] + [offset]
+	uint32_t size)		// Number of bytes
+{
+	BYTE *buf = malloc(size > 0 ? size : 1);
+	int stat = 0;
+#ifdef MM_PAGING
+	stat = libread_range(proc, source, offset, buf, size);
+#else
+	uint32_t i;
+	for (i = 0; i < size && stat == 0; i++)
+		stat = read_mem(proc->regs[source] + offset + i, proc, &buf[i]);
+#endif
+	free(buf);
+	return stat;
+}
+
+int writen(
+	struct pcb_t *proc,	// Process executing the instruction
+	BYTE data,		// Data to be filled into memory
+	uint32_t destination, // Index of destination register
+	uint32_t offset,	// Destination address = [destination] + [offset]
+	uint32_t size)		// Number of bytes
+{
+	BYTE *buf = malloc(size > 0 ? size : 1);
+	int stat = 0;
+	memset(buf, data, size);
+#ifdef MM_PAGING
+	stat = libwrite_range(proc, buf, destination, offset, size);
+#else
+	uint32_t i;
+	for (i = 0; i < size && stat == 0; i++)
+		stat = write_mem(proc->regs[destination] + offset + i, proc, buf[i]);
+#endif
+	free(buf);
+	return stat;
+}
+
 int run(struct pcb_t *proc)
 {
 	/* Check if Program Counter point to the proper instruction */
@@ -67,6 +109,8 @@ int run(struct pcb_t *proc)
 
 	struct inst_t ins = proc->code->text[proc->pc];
 	proc->pc++;
+	if (ins.opcode < STATS_NR_OPCODES)
+		STATS_ADD(insn[ins.opcode], 1);
 	int stat = 1;
 switch (ins.opcode)
 	{
@@ -104,6 +148,40 @@ switch (ins.opcode)
 	case SYSCALL:
 		stat = libsyscall(proc, ins.arg_0, ins.arg_1, ins.arg_2, ins.arg_3);
 		break;
+	case READN:
+		stat = readn(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+		break;
+	case WRITEN:
+		stat = writen(proc, ins.arg_0, ins.arg_1, ins.arg_2, ins.arg_3);
+		break;
+#ifdef MM_PAGING
+	case MMAP:
+		stat = libmmap(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+		break;
+	case ALLOCV:
+		stat = liballoc_vma(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+		break;
+	case READV:
+		stat = libread_vma(proc, ins.arg_0, ins.arg_1, ins.arg_2, &ins.arg_3);
+		break;
+	case WRITEV:
+		stat = libwrite_vma(proc, ins.arg_0, ins.arg_1, ins.arg_2, ins.arg_3);
+		break;
+#else
+	/* Without paging there is a single flat area, the area id is ignored */
+	case MMAP:
+		stat = 1;
+		break;
+	case ALLOCV:
+		stat = alloc(proc, ins.arg_1, ins.arg_2);
+		break;
+	case READV:
+		stat = read(proc, ins.arg_1, ins.arg_2, ins.arg_3);
+		break;
+	case WRITEV:
+		stat = write(proc, ins.arg_1, ins.arg_2, ins.arg_3);
+		break;
+#endif
 	default:
 		stat = 1;
 	}
@@ -22,27 +22,76 @@
  #include <stdio.h>
  #include <pthread.h>
  
- static pthread_mutex_t mmvm_lock = PTHREAD_MUTEX_INITIALIZER;
- 
  /*enlist_vm_freerg_list - add new rg to freerg_list
+  *@vma: memory area owning the region
+  *@rg_elmt: new region, merged with its free neighbours
+  *
+  */
+ int enlist_vm_freerg_list(struct vm_area_struct *vma, struct vm_rg_struct *rg_elmt)
+ {
+   return vm_freerg_insert(&vma->vm_freerg, rg_elmt);
+ }
+ 
+ #define SYMRG_EMPTY (-1)
+ #define SYMRG_TOMB  (-2)
+ 
+ static int symrg_hash(int rgid, int cap)
+ {
+   /* Fibonacci hashing, cap is a power of two */
+   return (int)(((uint32_t)rgid * 2654435761U) >> (32 - __builtin_ctz(cap)));
+ }
+ 
+ /*symrg_slot - find the slot of a region ID
   *@mm: memory region
-  *@rg_elmt: new region
+  *@rgid: region ID
+  *@insert: return the first reusable slot when the ID is absent
   *
   */
- int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct *rg_elmt)
+ static int symrg_slot(struct mm_struct *mm, int rgid, int insert)
  {
-   struct vm_rg_struct *rg_node = mm->mmap->vm_freerg_list;
+   int i = symrg_hash(rgid, mm->symrg_cap);
+   int reuse = -1;
  
-   if (rg_elmt->rg_start >= rg_elmt->rg_end)
-     return -1;
+   while (mm->symrg_keys[i] != SYMRG_EMPTY)
+   {
+     if (mm->symrg_keys[i] == rgid)
+       return i;
+     if (mm->symrg_keys[i] == SYMRG_TOMB && reuse < 0)
+       reuse = i;
+     i = (i + 1) & (mm->symrg_cap - 1);
+   }
  
-   if (rg_node != NULL)
-     rg_elmt->rg_next = rg_node;
+   if (!insert)
+     return -1;
+   return reuse >= 0 ? reuse : i;
+ }
  
-   /* Enlist the new region */
-   mm->mmap->vm_freerg_list = rg_elmt;
+ /*symrg_resize - rehash the symbol table into @cap slots, dropping tombstones */
+ static void symrg_resize(struct mm_struct *mm, int cap)
+ {
+   int *oldkeys = mm->symrg_keys;
+   struct vm_rg_struct *oldtbl = mm->symrgtbl;
+   int oldcap = mm->symrg_cap;
+   int i;
+ 
+   mm->symrg_keys = malloc(cap * sizeof(int));
+   mm->symrgtbl = malloc(cap * sizeof(struct vm_rg_struct));
+   mm->symrg_cap = cap;
+   mm->symrg_used = mm->symrg_count;
+   for (i = 0; i < cap; i++)
+     mm->symrg_keys[i] = SYMRG_EMPTY;
+ 
+   for (i = 0; i < oldcap; i++)
+   {
+     if (oldkeys[i] < 0)
+       continue;
+     int slot = symrg_slot(mm, oldkeys[i], 1);
+     mm->symrg_keys[slot] = oldkeys[i];
+     mm->symrgtbl[slot] = oldtbl[i];
+   }
  
-   return 0;
+   free(oldkeys);
+   free(oldtbl);
  }
  
  /*get_symrg_byid - get mem region by region ID
@@ -52,10 +101,103 @@
   */
  struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid)
  {
-   if (rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ)
+   int slot;
+ 
+   if (rgid < 0 || mm->symrg_cap == 0)
+     return NULL;
+ 
+   slot = symrg_slot(mm, rgid, 0);
+   return slot < 0 ? NULL : &mm->symrgtbl[slot];
+ }
+ 
+ /*symrg_insert - get or create the symbol table entry of a region ID
+  *@mm: memory region
+  *@rgid: region ID
+  *
+  *The returned entry is valid until the next insert.
+  */
+ struct vm_rg_struct *symrg_insert(struct mm_struct *mm, int rgid)
+ {
+   struct vm_rg_struct *rg;
+   int slot;
+ 
+   if (rgid < 0)
+     return NULL;
+ 
+   rg = get_symrg_byid(mm, rgid);
+   if (rg != NULL)
+     return rg;
+ 
+   /* Keep at least a quarter of the slots empty so probes stay short */
+   if (mm->symrg_cap == 0)
+     symrg_resize(mm, PAGING_SYMTBL_INIT_SZ);
+   else if ((mm->symrg_used + 1) * 4 > mm->symrg_cap * 3)
+     symrg_resize(mm, (mm->symrg_count + 1) * 2 > mm->symrg_cap ? mm->symrg_cap * 2 : mm->symrg_cap);
+ 
+   slot = symrg_slot(mm, rgid, 1);
+   if (mm->symrg_keys[slot] == SYMRG_EMPTY)
+     mm->symrg_used++;
+   mm->symrg_keys[slot] = rgid;
+   mm->symrg_count++;
+ 
+   rg = &mm->symrgtbl[slot];
+   rg->rg_start = rg->rg_end = 0;
+   rg->rg_vmaid = 0;
+   rg->rg_next = NULL;
+   return rg;
+ }
+ 
+ /*symrg_remove - drop a region ID from the symbol table
+  *@mm: memory region
+  *@rgid: region ID
+  *
+  */
+ int symrg_remove(struct mm_struct *mm, int rgid)
+ {
+   int slot;
+ 
+   if (rgid < 0 || mm->symrg_cap == 0)
+     return -1;
+ 
+   slot = symrg_slot(mm, rgid, 0);
+   if (slot < 0)
+     return -1;
+ 
+   mm->symrg_keys[slot] = SYMRG_TOMB;
+   mm->symrg_count--;
+   return 0;
+ }
+ 
+ /*symrg_clear - release the symbol table
+  *@mm: memory region
+  *
+  */
+ void symrg_clear(struct mm_struct *mm)
+ {
+   free(mm->symrg_keys);
+   free(mm->symrgtbl);
+   mm->symrg_keys = NULL;
+   mm->symrgtbl = NULL;
+   mm->symrg_cap = mm->symrg_count = mm->symrg_used = 0;
+ }
+ 
+ /*get_vma_of_rg - get the vm area a region is accessed through
+  *@mm: memory region
+  *@vmaid: requested area ID, PAGING_VMA_OF_RG for the region's own area
+  *@rg: region
+  *
+  */
+ static struct vm_area_struct *get_vma_of_rg(struct mm_struct *mm, int vmaid, struct vm_rg_struct *rg)
+ {
+   if (rg == NULL)
      return NULL;
  
-   return &mm->symrgtbl[rgid];
+   if (vmaid == PAGING_VMA_OF_RG)
+     vmaid = rg->rg_vmaid;
+   else if (vmaid != rg->rg_vmaid)
+     return NULL; /* the region lives in another area */
+ 
+   return get_vma_by_num(mm, vmaid);
  }
  
  /*__alloc - allocate a region memory
@@ -68,7 +210,7 @@
   */
  int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr)
 {
-  pthread_mutex_lock(&mmvm_lock);
+  REPLAY_LOCK(REPLAY_MM, &caller->mm->mm_lock);
   /*Allocate at the toproof */
   struct vm_rg_struct rgnode;
 
@@ -76,25 +218,28 @@
   // rgnode.vmaid
 
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
-  if (cur_vma == NULL) /* Invalid memory identify */{
-    printf("Invalid memory identify\n");
+  struct vm_rg_struct *symrg;
+  if (cur_vma == NULL || rgid < 0) /* Invalid memory identify */{
+    log_printf(LOG_ERR, "Invalid memory identify\n");
+    REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
     return -1;
   }
 
   if (get_free_vmrg_area(caller, vmaid, size, &rgnode) == 0)
   {
-    caller->mm->symrgtbl[rgid].rg_start = rgnode.rg_start;
-    caller->mm->symrgtbl[rgid].rg_end = rgnode.rg_end;
+    symrg = symrg_insert(caller->mm, rgid);
+    symrg->rg_start = rgnode.rg_start;
+    symrg->rg_end = rgnode.rg_end;
+    symrg->rg_vmaid = vmaid;
  
     *alloc_addr = rgnode.rg_start;
-    pthread_mutex_unlock(&mmvm_lock);
+    REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
     return 0;
   } 
   else 
   {
   /* TODO get_free_vmrg_area FAILED handle the region management (Fig.6)*/
   int inc_sz = PAGING_PAGE_ALIGNSZ(size);
-  int old_sbrk = cur_vma->sbrk;
   /*Attempt to increate limit to get space */
 
   int inc_limit_ret;
@@ -111,25 +256,28 @@
   /* SYSCALL 17 sys_memmap */
   inc_limit_ret = syscall(caller, 17, &regs); 
 
-  /* TODO: commit the limit increment */
+  /* The limit and sbrk are committed by inc_vma_limit */
   if (inc_limit_ret != 0)
   { 
-    printf("inc_limit_ret < 0\n");
+    log_printf(LOG_ERR, "inc_limit_ret < 0\n");
+    REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
     return -1;
   }
-  cur_vma->sbrk = old_sbrk + inc_sz;
 
   if (get_free_vmrg_area(caller, vmaid, size, &rgnode) != 0)
   { 
-    printf("get_free_vmrg_area failed\n");
+    log_printf(LOG_ERR, "get_free_vmrg_area failed\n");
+    REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
     return -1;
   }
 
-  caller->mm->symrgtbl[rgid].rg_start = rgnode.rg_start;
-  caller->mm->symrgtbl[rgid].rg_end = rgnode.rg_end;
+  symrg = symrg_insert(caller->mm, rgid);
+  symrg->rg_start = rgnode.rg_start;
+  symrg->rg_end = rgnode.rg_end;
+  symrg->rg_vmaid = vmaid;
 
   *alloc_addr = rgnode.rg_start;
-  pthread_mutex_unlock(&mmvm_lock);
+  REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
   
   }
 
@@ -137,6 +285,64 @@
 
 }
  
+ /*vm_release_freed - give back the memory behind a freed region
+  *@caller: caller, holds caller->mm->mm_lock
+  *@vma: area the region belonged to
+  *@start: start of the freed region
+  *@end: end of the freed region
+  *
+  *Whole pages of the free space around the region lose their frames, and
+  *free space at the growing end of a heap or stack lowers its limit.
+  */
+ static void vm_release_freed(struct pcb_t *caller, struct vm_area_struct *vma,
+                              unsigned long start, unsigned long end)
+ {
+   struct vm_rg_struct *frg = vm_freerg_find(&vma->vm_freerg, start);
+   unsigned long fstart, fend, ustart, uend;
+ 
+   if (frg == NULL)
+     return;
+   fstart = frg->rg_start;
+   fend = frg->rg_end;
+ 
+   /* Pages shared with live regions stay mapped */
+   ustart = PAGING_PAGE_ALIGNSZ(fstart);
+   if (ustart < PAGING_PAGE_ALIGNDN(start))
+     ustart = PAGING_PAGE_ALIGNDN(start);
+   uend = PAGING_PAGE_ALIGNDN(fend);
+   if (uend > PAGING_PAGE_ALIGNSZ(end))
+     uend = PAGING_PAGE_ALIGNSZ(end);
+   vunmap_page_range(caller, ustart, uend);
+ 
+   if (vma->vm_flags & VM_FIXEDSZ)
+     return;
+ 
+   if (!(vma->vm_flags & VM_GROWSDOWN) && fend == vma->vm_end)
+   {
+     unsigned long newend = PAGING_PAGE_ALIGNSZ(fstart);
+ 
+     if (newend < vma->vm_end)
+     {
+       vunmap_page_range(caller, newend, vma->vm_end);
+       vm_freerg_take(&vma->vm_freerg, newend, vma->vm_end);
+       vma_set_range(caller->mm, vma, vma->vm_start, newend);
+       vma->sbrk = newend;
+     }
+   }
+   else if ((vma->vm_flags & VM_GROWSDOWN) && fstart == vma->vm_start)
+   {
+     unsigned long newstart = PAGING_PAGE_ALIGNDN(fend);
+ 
+     if (newstart > vma->vm_start)
+     {
+       vunmap_page_range(caller, vma->vm_start, newstart);
+       vm_freerg_take(&vma->vm_freerg, vma->vm_start, newstart);
+       vma_set_range(caller->mm, vma, newstart, vma->vm_end);
+       vma->sbrk = newstart;
+     }
+   }
+ }
+ 
  /*__free - remove a region memory
   *@caller: caller
   *@vmaid: ID vm area to alloc memory region
@@ -152,24 +358,33 @@
    // in incompleted TODO code rgnode will overwrite through implementing
    // the manipulation of rgid later
  
-   if(rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ)
+   if(rgid < 0)
+   {
+     free(rgnode);
      return -1;
+   }
    
-   pthread_mutex_lock(&mmvm_lock);
+   REPLAY_LOCK(REPLAY_MM, &caller->mm->mm_lock);
     /* TODO: Manage the collect freed region to freerg_list */
    struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid); 
+   struct vm_area_struct *cur_vma = get_vma_of_rg(caller->mm, vmaid, currg);
    
-   if(currg == NULL || currg->rg_start == -1)
+   if(currg == NULL || cur_vma == NULL || currg->rg_start >= currg->rg_end)
+   {
+     REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
+     free(rgnode);
      return -1;
+   }
      
    rgnode->rg_start = currg->rg_start;
    rgnode->rg_end = currg->rg_end;
-   caller->mm->symrgtbl[rgid].rg_start = caller->mm->symrgtbl[rgid].rg_end = 0;
-   caller->mm->symrgtbl[rgid].rg_next = NULL;
+   symrg_remove(caller->mm, rgid);
    /*enlist the obsoleted memory region */
-   enlist_vm_freerg_list(caller->mm, rgnode);
+   unsigned long start = rgnode->rg_start, end = rgnode->rg_end;
+   enlist_vm_freerg_list(cur_vma, rgnode);
+   vm_release_freed(caller, cur_vma, start, end);
  
-   pthread_mutex_unlock(&mmvm_lock);
+   REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
    
    return 0;
  }
@@ -181,14 +396,25 @@
   */
  int liballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index)
  {
- //   /* TODO Implement allocation on vm area 0 */
+   return liballoc_vma(proc, PAGING_VMA_HEAP, size, reg_index);
+ }
+ 
+ /*liballoc_vma - PAGING-based allocate a region memory in a chosen vm area
+  *@proc:  Process executing the instruction
+  *@vmaid: ID vm area to alloc memory region
+  *@size: allocated size
+  *@reg_index: memory region ID (used to identify variable in symbole table)
+  */
+ int liballoc_vma(struct pcb_t *proc, uint32_t vmaid, uint32_t size, uint32_t reg_index)
+ {
    int addr;
-   int ret = __alloc(proc, 0, reg_index, size, &addr);
+   int ret = __alloc(proc, vmaid, reg_index, size, &addr);
    if (ret != 0)
      return -1;  
  #ifdef IODUMP
-   printf("===== PHYSICAL MEMORY AFTER ALLOCATION =====\n");
-   printf("PID=%d - Region=%d - Address=%08x - Size=%d byte\n", proc->pid, reg_index, addr, size);
+   log_printf(LOG_MEM, "===== PHYSICAL MEMORY AFTER ALLOCATION =====\n");
+   log_printf(LOG_MEM, "PID=%d - Region=%d - Address=%08x - Size=%d byte\n", proc->pid, reg_index, addr, size);
+   print_vm_freerg(&get_vma_by_num(proc->mm, vmaid)->vm_freerg);
  #ifdef PAGETBL_DUMP
    print_pgtbl(proc, 0, -1); //print max TBL
  #endif
@@ -197,6 +423,57 @@
    return 0;
  }
  
+ /*__mmap - create an anonymous mapping area
+  *@caller: caller
+  *@vmaid: ID of the new vm area
+  *@size: mapping size
+  *@flags: VM_LOCKED to keep its pages out of swap
+  *@map_addr: start address of the area
+  *
+  */
+ int __mmap(struct pcb_t *caller, int vmaid, int size, int flags, int *map_addr)
+ {
+   struct sc_regs regs;
+   int ret;
+ 
+   REPLAY_LOCK(REPLAY_MM, &caller->mm->mm_lock);
+   regs.a1 = SYSMEM_MAP_OP;
+   regs.a2 = vmaid;
+   regs.a3 = size;
+   regs.a4 = flags;
+ 
+   /* SYSCALL 17 sys_memmap */
+   ret = syscall(caller, 17, &regs);
+   REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
+   if (ret != 0)
+     return -1;
+ 
+   *map_addr = regs.a3;
+   return 0;
+ }
+ 
+ /*libmmap - PAGING-based map an anonymous vm area
+  *@proc: Process executing the instruction
+  *@vmaid: ID of the new vm area
+  *@size: mapping size
+  *@flags: VM_* flags
+  */
+ int libmmap(struct pcb_t *proc, uint32_t vmaid, uint32_t size, uint32_t flags)
+ {
+   int addr;
+   if (__mmap(proc, vmaid, size, flags, &addr) != 0)
+     return -1;
+ #ifdef IODUMP
+   log_printf(LOG_MEM, "===== PHYSICAL MEMORY AFTER MAPPING =====\n");
+   log_printf(LOG_MEM, "PID=%d - VMA=%d - Address=%08x - Size=%d byte\n", proc->pid, vmaid, addr, size);
+ #ifdef PAGETBL_DUMP
+   print_pgtbl(proc, 0, -1); //print max TBL
+ #endif
+ #endif
+ 
+   return 0;
+ }
+ 
  /*libfree - PAGING-based free a region memory
   *@proc: Process executing the instruction
   *@size: allocated size
@@ -205,13 +482,19 @@
  
  int libfree(struct pcb_t *proc, uint32_t reg_index)
  {
-   int ret = __free(proc, 0, reg_index);
+#ifdef IODUMP
+   /* Only this process touches its symbol table */
+   struct vm_rg_struct *rg = get_symrg_byid(proc->mm, reg_index);
+   int vmaid = (rg != NULL) ? rg->rg_vmaid : PAGING_VMA_HEAP;
+#endif
+   int ret = __free(proc, PAGING_VMA_OF_RG, reg_index);
    if (ret != 0)
      return -1;
  
  #ifdef IODUMP
-   printf("===== PHYSICAL MEMORY AFTER DEALLOCATION =====\n");
-   printf("PID=%d - Region=%d\n", proc->pid, reg_index);
+   log_printf(LOG_MEM, "===== PHYSICAL MEMORY AFTER DEALLOCATION =====\n");
+   log_printf(LOG_MEM, "PID=%d - Region=%d\n", proc->pid, reg_index);
+   print_vm_freerg(&get_vma_by_num(proc->mm, vmaid)->vm_freerg);
  #ifdef PAGETBL_DUMP
    print_pgtbl(proc, 0, -1); //print max TBL
  #endif
@@ -219,85 +502,179 @@
    return 0;
  }
  
+ /*pg_pick_victim - choose a resident page of the process to swap out
+  *@mm: memory region
+  *@vicpgn: return victim page number
+  *
+  *Merged (KSM) pages are skipped, their frame stays in use by others.
+  */
+ pte_t *pg_pick_victim(struct mm_struct *mm, int *vicpgn)
+ {
+   struct pgn_t *skipped = NULL, *pg;
+   pte_t *ptep = NULL;
+ 
+   while (find_victim_page(mm, vicpgn) == 0)
+   {
+     ptep = pte_get_entry(mm, *vicpgn);
+     if (ptep != NULL && PAGING_PAGE_PRESENT(*ptep) &&
+         !(*ptep & PAGING_PTE_SWAPPED_MASK) && !PAGING_PAGE_SHARED(*ptep))
+       break;
+ 
+     if (ptep != NULL && PAGING_PAGE_SHARED(*ptep))
+       enlist_pgn_node(&skipped, *vicpgn);
+     ptep = NULL; /* stale or shared entry */
+   }
+ 
+   while (skipped != NULL)
+   {
+     pg = skipped;
+     skipped = pg->pg_next;
+     pg->pg_next = mm->fifo_pgn;
+     mm->fifo_pgn = pg;
+   }
+ 
+   return ptep;
+ }
+ 
  /*pg_getpage - get the page in ram
   *@mm: memory region
   *@pagenum: PGN
   *@framenum: return FPN
   *@caller: caller
   *
+  *Page fault path: sbrk only reserves virtual space, the first access to
+  *a page of an area gets it a zeroed frame and a swapped out page is
+  *brought back. When RAM is full the oldest page of the process is
+  *evicted: its swap-out and the swap-in of the page are queued as one
+  *linked chain on the ring and submitted with a single kernel entry. A
+  *process with nothing to evict gets a frame from alloc_pages_range.
   */
  int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
  {
-   uint32_t pte = mm->pgd[pgn];
+   static const BYTE zero_page[PAGING_PAGESZ];
+   pte_t *ptep = pte_get_entry(mm, pgn);
+   struct framephy_struct *frm = NULL;
+   int newfpn, vicpgn, swpfpn, evict = 0;
+   int out_res = -1, in_res = -1;
+   int swapped = ptep != NULL && PAGING_PAGE_PRESENT(*ptep) && (*ptep & PAGING_PTE_SWAPPED_MASK);
+   struct sc_regs regs;
+   struct sc_cqe cqe;
  
-   if (!PAGING_PAGE_PRESENT(pte))
-   { /* Page is not online, make it actively living */
-     int vicpgn, swpfpn; 
-     int vicfpn;
-     uint32_t vicpte;
+   if (ptep != NULL && PAGING_PAGE_PRESENT(*ptep) && !swapped)
+   {
+     *fpn = PAGING_FPN(*ptep);
+     return 0;
+   }
  
-     int tgtfpn = PAGING_SWP(pte);//the target frame storing our variable
+   if (!swapped && get_vma_by_addr(mm, (unsigned long)pgn * PAGING_PAGESZ) == NULL)
+     return -1; /* outside every area */
+
+   STATS_ADD(page_faults, 1);
+   TRACE(TRACE_FAULT, caller->pid, pgn);
+   if (swapped) {
+     STATS_ADD(swap_ins, 1);
+     TRACE(TRACE_SWAP_IN, caller->pid, pgn);
+   }
  
-     /* TODO: Play with your paging theory here */
-     /* Find victim page */
-     
-     //if (find_victim_page(caller->mm, &vicpgn) < 0) return -1;
-     find_victim_page(caller->mm, &vicpgn);
-     vicpte = caller->mm->pgd[vicpgn]; // Get the page number from the page table entry
-     vicfpn = PAGING_FPN(vicpte); // Get the frame number from the page table entry
+   /* Free frame, or the frame of the oldest page of the caller */
+   if (MEMPHY_get_freefp(caller->mram, &newfpn) != 0)
+   {
+     if (reclaim_pick(caller, &vicpgn, &newfpn, &swpfpn) == 0)
+     {
+       /* copy victim frame to swap
+        * SWP(vicfpn --> swpfpn)
+        * SYSCALL 17 sys_memmap with operation SYSMEM_SWP_OP,
+        * its failure cancels the swap-in linked after it
+        */
+       evict = 1;
+       regs.a1 = SYSMEM_SWP_OP;
+       regs.a2 = newfpn;
+       regs.a3 = swpfpn;
+       libsyscall_prep(caller, 17, &regs, 0, SC_SQE_LINK);
+     }
+     else
+     {
+       /* Nothing of the caller to evict: other processes, then backoff */
+       if (alloc_pages_range(caller, 1, &frm) != 0)
+         return -1;
+       newfpn = frm->fpn;
+     }
+   }
  
-     if (tgtfpn == vicfpn || tgtfpn == swpfpn)
+   if (swapped)
+   {
+     /* copy target frame from swap to mem
+      * SWP(tgtswpfpn --> newfpn)
+      * SYSCALL 17 sys_memmap with operation SYSMEM_SWPIN_OP
+      */
+     regs.a1 = SYSMEM_SWPIN_OP;
+     regs.a2 = PAGING_SWP(*ptep);
+     regs.a3 = newfpn;
+     libsyscall_prep(caller, 17, &regs, 1, 0);
+   }
+
+   /* Swap-out and swap-in enter the kernel together */
+   if (evict || swapped)
+   {
+     libsyscall_submit(caller);
+     while (libsyscall_reap(caller, &cqe) == 0)
      {
-       printf("tgtfpn == vicfpn || tgtfpn == swpfpn\n");
+       if (cqe.user_data == 0)
+         out_res = cqe.res;
+       else
+         in_res = cqe.res;
+     }
+   }
+
+   if (evict)
+   {
+     if (out_res < 0)
+     {
+       /* The frame still holds the victim */
+       reclaim_cancel(caller, vicpgn, swpfpn);
        return -1;
      }
-     /* Get free frame in MEMSWP */
-     if (MEMPHY_get_freefp(caller->active_mswp, &swpfpn) != 0) return -1;
- 
-     /* TODO: Implement swap frame from MEMRAM to MEMSWP and vice versa*/
-     /* TODO copy victim frame to swap 
-      * SWP(vicfpn <--> swpfpn)
-      * SYSCALL 17 sys_memmap 
-      * with operation SYSMEM_SWP_OP
-      */
-     struct sc_regs regs;
-     regs.a1 = SYSMEM_SWP_OP;
-     regs.a2 = vicfpn;
-     regs.a3 = swpfpn;
- 
-     /* SYSCALL 17 sys_memmap */
-     int ret = syscall(caller, 17, &regs);
-     if (ret < 0) return -1;
+     reclaim_commit(caller, vicpgn, newfpn, swpfpn);
+   }
  
+   if (swapped)
+   {
+     if (in_res < 0)
+     {
+       MEMPHY_put_freefp(caller->mram, newfpn);
+       free(frm);
+       return -1;
+     }
  
-     /* TODO copy target frame form swap to mem 
-      * SWP(tgtfpn <--> vicfpn)
-      * SYSCALL 17 sys_memmap
-      * with operation SYSMEM_SWP_OP
-      */
-     /* TODO copy target frame form swap to mem 
-     //regs.a1 =...
-     //regs.a2 =...
-     //regs.a3 =..
-     */
-     regs.a1 = SYSMEM_SWP_OP;
-     regs.a2 = tgtfpn;
-     regs.a3 = vicfpn;
- 
-     /* SYSCALL 17 sys_memmap */
-     ret = syscall(caller, 17, &regs);
-     if (ret < 0) return -1;
-     pte_set_swap(&mm->pgd[vicpgn], 0, swpfpn);
-     pte_set_fpn(&mm->pgd[pgn], vicfpn);
-
      /* Update page table */
-     /* Update its online status of the target page */
-     enlist_pgn_node(&caller->mm->fifo_pgn,pgn);
-     MEMPHY_put_freefp(caller->active_mswp, tgtfpn);
+     MEMPHY_put_freefp(caller->active_mswp, PAGING_SWP(*ptep));
+     *ptep = 0;
+     pte_set_fpn(ptep, newfpn);
+     enlist_pgn_node(&mm->fifo_pgn, pgn);
    }
+   else
+   {
+     /* First touch, the frame may hold data of its previous owner */
+     struct vm_rg_struct maprg;
  
-   *fpn = PAGING_FPN(mm->pgd[pgn]);
+     if (frm == NULL)
+     {
+       frm = malloc(sizeof(struct framephy_struct));
+       frm->fpn = newfpn;
+       frm->owner = mm;
+       frm->fp_next = NULL;
+     }
+     MEMPHY_write_range(caller->mram, newfpn * PAGING_PAGESZ, zero_page, PAGING_PAGESZ);
+     if (vmap_page_range(caller, pgn * PAGING_PAGESZ, 1, frm, &maprg) != 0)
+     {
+       MEMPHY_put_freefp(caller->mram, newfpn);
+       free(frm);
+       return -1;
+     }
+   }
  
+   free(frm);
+   *fpn = newfpn;
    return 0;
  }
  
@@ -350,6 +727,12 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
    if (pg_getpage(mm, pgn, &fpn, caller) != 0)
      return -1; /* invalid page access */
  
+ #ifdef MM_KSM
+   /* Merged frames are read-only, take a private copy first */
+   if (ksm_break_cow(mm, pgn, &fpn) != 0)
+     return -1;
+ #endif
+ 
    /* TODO
     *  MEMPHY_write(caller->mram, phyaddr, value);
     *  MEMPHY WRITE
@@ -377,17 +760,20 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
   */
  int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data)
  {
-   pthread_mutex_lock(&mmvm_lock);
+   REPLAY_LOCK(REPLAY_MM, &caller->mm->mm_lock);
    struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
-   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+   struct vm_area_struct *cur_vma = get_vma_of_rg(caller->mm, vmaid, currg);
  
    if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
+   {
+     REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
      return -1;
+   }
  
-   pg_getval(caller->mm, currg->rg_start + offset, data, caller);
-   pthread_mutex_unlock(&mmvm_lock);
+   int ret = pg_getval(caller->mm, currg->rg_start + offset, data, caller);
+   REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
  
-   return 0;
+   return ret;
  }
  
  /*libread - PAGING-based read a region memory */
@@ -396,15 +782,33 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
      uint32_t source,    // Index of source register
      uint32_t offset,    // Source address = [source] + [offset]
      uint32_t* destination)
+ {
+   return libread_vma(proc, PAGING_VMA_OF_RG, source, offset, destination);
+ }
+ 
+ /*libread_vma - PAGING-based read a region memory of a chosen vm area */
+ int libread_vma(
+     struct pcb_t *proc, // Process executing the instruction
+     int vmaid,          // Area holding the region
+     uint32_t source,    // Index of source register
+     uint32_t offset,    // Source address = [source] + [offset]
+     uint32_t* destination)
  { 
-   BYTE data;
-   int val = __read(proc, 0, source, offset, &data);
+   BYTE data = 0;
+   int val = __read(proc, vmaid, source, offset, &data);
  
+   if (val != 0)
+   {
+     /* No page could be brought in, there is no value to return */
+     log_printf(LOG_ERR, "read region=%d offset=%d failed\n", source, offset);
+     return val;
+   }
+
    /* TODO update result of reading action*/
    *destination = (uint32_t)data; 
  #ifdef IODUMP
-   printf("===== PHYSICAL MEMORY AFTER READING =====\n");
-   printf("read region=%d offset=%d value=%d\n", source, offset, data);
+   log_printf(LOG_MEM, "===== PHYSICAL MEMORY AFTER READING =====\n");
+   log_printf(LOG_MEM, "read region=%d offset=%d value=%d\n", source, offset, data);
  #ifdef PAGETBL_DUMP
    print_pgtbl(proc, 0, -1); //print max TBL
  #endif
@@ -424,16 +828,19 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
   */
  int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value)
  {
-   pthread_mutex_lock(&mmvm_lock);
+   REPLAY_LOCK(REPLAY_MM, &caller->mm->mm_lock);
    struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
-   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+   struct vm_area_struct *cur_vma = get_vma_of_rg(caller->mm, vmaid, currg);
  
    if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
+   {
+     REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
      return -1;
+   }
  
-   pg_setval(caller->mm, currg->rg_start + offset, value, caller);
-   pthread_mutex_unlock(&mmvm_lock);
-   return 0;
+   int ret = pg_setval(caller->mm, currg->rg_start + offset, value, caller);
+   REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
+   return ret;
  }
  
  /*libwrite - PAGING-based write a region memory */
@@ -443,11 +850,26 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
      uint32_t destination, // Index of destination register
      uint32_t offset)
  {
-   /* TODO Implement write on vm area 0 */
-   int val = __write(proc, 0, destination, offset, data);
+   return libwrite_vma(proc, PAGING_VMA_OF_RG, data, destination, offset);
+ }
+ 
+ /*libwrite_vma - PAGING-based write a region memory of a chosen vm area */
+ int libwrite_vma(
+     struct pcb_t *proc,   // Process executing the instruction
+     int vmaid,            // Area holding the region
+     BYTE data,            // Data to be wrttien into memory
+     uint32_t destination, // Index of destination register
+     uint32_t offset)
+ {
+   int val = __write(proc, vmaid, destination, offset, data);
+   if (val != 0)
+   {
+     log_printf(LOG_ERR, "write region=%d offset=%d failed\n", destination, offset);
+     return val;
+   }
  #ifdef IODUMP
-   printf("===== PHYSICAL MEMORY AFTER WRITING =====\n");
-   printf("write region=%d offset=%d value=%d\n", destination, offset, data);
+   log_printf(LOG_MEM, "===== PHYSICAL MEMORY AFTER WRITING =====\n");
+   log_printf(LOG_MEM, "write region=%d offset=%d value=%d\n", destination, offset, data);
  #ifdef PAGETBL_DUMP
    print_pgtbl(proc, 0, -1); //print max TBL
  #endif
@@ -457,31 +879,247 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
    return val;
  }
  
- /*free_pcb_memphy - collect all memphy of pcb
+ /*pg_getval_range - read a byte range starting at given address
+  *@mm: memory region
+  *@addr: virtual address of the first byte
+  *@buf: destination buffer
+  *@size: number of bytes
+  *
+  *The page is translated once and its contiguous part copied in one go.
+  */
+ int pg_getval_range(struct mm_struct *mm, int addr, BYTE *buf, int size, struct pcb_t *caller)
+ {
+   while (size > 0)
+   {
+     int pgn = PAGING_PGN(addr);
+     int off = PAGING_OFFST(addr);
+     int chunk = PAGING_PAGESZ - off;
+     int fpn;
+ 
+     if (chunk > size)
+       chunk = size;
+ 
+     if (pg_getpage(mm, pgn, &fpn, caller) != 0)
+       return -1; /* invalid page access */
+ 
+     if (MEMPHY_read_range(caller->mram, (fpn << PAGING_ADDR_FPN_LOBIT) + off, buf, chunk) != 0)
+       return -1;
+ 
+     addr += chunk;
+     buf += chunk;
+     size -= chunk;
+   }
+ 
+   return 0;
+ }
+ 
+ /*pg_setval_range - write a byte range starting at given address
+  *@mm: memory region
+  *@addr: virtual address of the first byte
+  *@buf: source buffer
+  *@size: number of bytes
+  *
+  */
+ int pg_setval_range(struct mm_struct *mm, int addr, const BYTE *buf, int size, struct pcb_t *caller)
+ {
+   while (size > 0)
+   {
+     int pgn = PAGING_PGN(addr);
+     int off = PAGING_OFFST(addr);
+     int chunk = PAGING_PAGESZ - off;
+     int fpn;
+ 
+     if (chunk > size)
+       chunk = size;
+ 
+     if (pg_getpage(mm, pgn, &fpn, caller) != 0)
+       return -1; /* invalid page access */
+ 
+ #ifdef MM_KSM
+     if (ksm_break_cow(mm, pgn, &fpn) != 0)
+       return -1;
+ #endif
+ 
+     if (MEMPHY_write_range(caller->mram, (fpn << PAGING_ADDR_FPN_LOBIT) + off, buf, chunk) != 0)
+       return -1;
+ 
+     addr += chunk;
+     buf += chunk;
+     size -= chunk;
+   }
+ 
+   return 0;
+ }
+ 
+ /*__read_range - read a byte range of a region memory
   *@caller: caller
   *@vmaid: ID vm area to alloc memory region
-  *@incpgnum: number of page
+  *@rgid: memory region ID (used to identify variable in symbole table)
+  *@offset: offset of the first byte in memory region
+  *@buf: destination buffer
+  *@size: number of bytes
+  *
   */
- int free_pcb_memph(struct pcb_t *caller)
- { 
-   printf("free_pcb_memphy\n");
-   int pagenum, fpn;
-   uint32_t pte;
+ int __read_range(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *buf, int size)
+ {
+   REPLAY_LOCK(REPLAY_MM, &caller->mm->mm_lock);
+   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
+   struct vm_area_struct *cur_vma = get_vma_of_rg(caller->mm, vmaid, currg);
+ 
+   if (currg == NULL || cur_vma == NULL || offset < 0 || size < 0 ||
+       currg->rg_start + offset + size > currg->rg_end)
+   {
+     REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
+     return -1;
+   }
+ 
+   int ret = pg_getval_range(caller->mm, currg->rg_start + offset, buf, size, caller);
+   REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
+ 
+   return ret;
+ }
+ 
+ /*__write_range - write a byte range of a region memory
+  *@caller: caller
+  *@vmaid: ID vm area to alloc memory region
+  *@rgid: memory region ID (used to identify variable in symbole table)
+  *@offset: offset of the first byte in memory region
+  *@buf: source buffer
+  *@size: number of bytes
+  *
+  */
+ int __write_range(struct pcb_t *caller, int vmaid, int rgid, int offset, const BYTE *buf, int size)
+ {
+   REPLAY_LOCK(REPLAY_MM, &caller->mm->mm_lock);
+   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
+   struct vm_area_struct *cur_vma = get_vma_of_rg(caller->mm, vmaid, currg);
+ 
+   if (currg == NULL || cur_vma == NULL || offset < 0 || size < 0 ||
+       currg->rg_start + offset + size > currg->rg_end)
+   {
+     REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
+     return -1;
+   }
+ 
+   int ret = pg_setval_range(caller->mm, currg->rg_start + offset, buf, size, caller);
+   REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
+ 
+   return ret;
+ }
  
+ /*libread_range - PAGING-based read of [size] bytes of a region memory */
+ int libread_range(
+     struct pcb_t *proc, // Process executing the instruction
+     uint32_t source,    // Index of source register
+     uint32_t offset,    // Source address = [source] + [offset]
+     BYTE *buf,          // Destination buffer
+     uint32_t size)
+ {
+   int val = __read_range(proc, PAGING_VMA_OF_RG, source, offset, buf, size);
+ #ifdef IODUMP
+   log_printf(LOG_MEM, "===== PHYSICAL MEMORY AFTER READING =====\n");
+   log_printf(LOG_MEM, "read region=%d offset=%d size=%d\n", source, offset, size);
+ #ifdef PAGETBL_DUMP
+   print_pgtbl(proc, 0, -1); //print max TBL
+ #endif
+   MEMPHY_dump(proc->mram);
+ #endif
  
-   for(pagenum = 0; pagenum < PAGING_MAX_PGN; pagenum++)
+   return val;
+ }
+ 
+ /*libwrite_range - PAGING-based write of [size] bytes to a region memory */
+ int libwrite_range(
+     struct pcb_t *proc,   // Process executing the instruction
+     const BYTE *buf,      // Data to be wrttien into memory
+     uint32_t destination, // Index of destination register
+     uint32_t offset,
+     uint32_t size)
+ {
+   int val = __write_range(proc, PAGING_VMA_OF_RG, destination, offset, buf, size);
+ #ifdef IODUMP
+   log_printf(LOG_MEM, "===== PHYSICAL MEMORY AFTER WRITING =====\n");
+   log_printf(LOG_MEM, "write region=%d offset=%d size=%d\n", destination, offset, size);
+ #ifdef PAGETBL_DUMP
+   print_pgtbl(proc, 0, -1); //print max TBL
+ #endif
+   MEMPHY_dump(proc->mram);
+ #endif
+ 
+   return val;
+ }
+ 
+ /*pte_release - give back the frame or swap slot behind a PTE
+  *@caller: page owner
+  *@pte: page table entry, cleared by the caller
+  *
+  */
+ void pte_release(struct pcb_t *caller, pte_t pte)
+ {
+   if (!PAGING_PAGE_PRESENT(pte))
+     return;
+ 
+   if (pte & PAGING_PTE_SWAPPED_MASK)
    {
-     pte= caller->mm->pgd[pagenum];
+     MEMPHY_put_freefp(caller->active_mswp, PAGING_SWP(pte));
+     return;
+   }
  
-     if (!PAGING_PAGE_PRESENT(pte))
-     {
-       fpn = PAGING_PTE_FPN(pte);
-       MEMPHY_put_freefp(caller->mram, fpn);
-     } else {
-       fpn = PAGING_PTE_SWP(pte);
-       MEMPHY_put_freefp(caller->active_mswp, fpn);    
-     }
+ #ifdef MM_KSM
+   if (PAGING_PAGE_SHARED(pte) && ksm_put_page(PAGING_FPN(pte)) != 0)
+     return; /* still mapped by another process */
+ #endif
+   MEMPHY_put_freefp(caller->mram, PAGING_FPN(pte));
+ }
+ 
+ /*free_pcb_memph - release the whole address space of an exiting process
+  *@caller: caller
+  *
+  *Frames and swap slots go back to their devices, then the page table,
+  *the vm areas with their free regions, the symbol table, the FIFO of
+  *resident pages and the mm itself are freed.
+  */
+ int free_pcb_memph(struct pcb_t *caller)
+ {
+   struct mm_struct *mm = caller->mm;
+   struct vm_area_struct *vma;
+   struct pgn_t *pg;
+ 
+   if (mm == NULL)
+     return 0;
+ 
+ #ifdef MM_KSM
+   ksm_unregister_mm(mm);
+ #endif
+ 
+   REPLAY_LOCK(REPLAY_MM, &mm->mm_lock);
+ #ifdef MM64
+   pgtable_free(caller);
+ #else
+   int pagenum;
+   for (pagenum = 0; pagenum < PAGING_MAX_PGN; pagenum++)
+     pte_release(caller, mm->pgd[pagenum]);
+   free(mm->pgd);
+   mm->pgd = NULL;
+ #endif
+ 
+   while ((vma = mm->mmap) != NULL)
+   {
+     mm->mmap = vma->vm_next;
+     vm_freerg_clear(&vma->vm_freerg);
+     free(vma);
    }
+   symrg_clear(mm);
+   while ((pg = mm->fifo_pgn) != NULL)
+   {
+     mm->fifo_pgn = pg->pg_next;
+     free(pg);
+   }
+   REPLAY_UNLOCK(REPLAY_MM, 0, &mm->mm_lock);
+ 
+   pthread_mutex_destroy(&mm->mm_lock);
+   free(mm);
+   caller->mm = NULL;
  
    return 0;
  }
@@ -494,30 +1132,30 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
   */
  int find_victim_page(struct mm_struct *mm, int *retpgn)
  {
-   struct pgn_t *pg = mm->fifo_pgn;
-   if (pg == NULL)
-     return -1;  
+   struct pgn_t *pg, *prevpg = NULL;
+   struct pgn_t *vic = NULL, *prevvic = NULL;
  
    /* TODO: Implement the theorical mechanism to find the victim page */
-   if (pg->pg_next == NULL)
+   /* Oldest page sits at the tail, pages of VM_LOCKED areas are skipped */
+   for (pg = mm->fifo_pgn; pg != NULL; prevpg = pg, pg = pg->pg_next)
    {
-     *retpgn = pg->pgn;
-     mm->fifo_pgn = NULL;
-     free(pg);
-     return 0;
-   }
+     struct vm_area_struct *vma = get_vma_by_addr(mm, (unsigned long)pg->pgn * PAGING_PAGESZ);
  
-   struct pgn_t *prevpg = NULL;
-   while (pg->pg_next != NULL)
-   {
-     prevpg = pg;
-     pg = pg->pg_next;
+     if (vma != NULL && (vma->vm_flags & VM_LOCKED))
+       continue;
+     vic = pg;
+     prevvic = prevpg;
    }
-   *retpgn = pg->pgn;
-   prevpg->pg_next = NULL;
  
+   if (vic == NULL)
+     return -1;
  
-   free(pg);
+   *retpgn = vic->pgn;
+   if (prevvic == NULL)
+     mm->fifo_pgn = vic->pg_next;
+   else
+     prevvic->pg_next = vic->pg_next;
+   free(vic);
  
    return 0;
  }
@@ -530,41 +1168,15 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
   */
  int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_struct *newrg)
  {
-   
    struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
  
-   struct vm_rg_struct *rgit = cur_vma->vm_freerg_list;
-   
-   if (rgit == NULL)
-   {
-     printf("rgit == NULL\n");
-     return -1;
-   }
- 
    /* Probe unintialized newrg */
    newrg->rg_start = newrg->rg_end = -1;
  
-   /* TODO Traverse on list of free vm region to find a fit space */
-   //while (...)
-   // ..
-   while(rgit != NULL){
-     if(rgit->rg_start + size <= rgit->rg_end){
-       newrg->rg_start = rgit->rg_start;
-       newrg->rg_end = rgit->rg_start + size;
-       rgit->rg_start += size;
-       if(rgit->rg_start >= rgit->rg_end){
-         cur_vma->vm_freerg_list = rgit->rg_next;
-         free(rgit);
-       }
-       return 0;
-     }
-     rgit = rgit->rg_next;
-   }
-   // if (newrg->rg_start == -1 && newrg->rg_end == -1){
-   //   printf("Cannot find appropriate free region\n");
-   //   return -1;
-   // }
-   return -1;
+   if (cur_vma == NULL || size <= 0)
+     return -1;
+ 
+   return vm_freerg_alloc(&cur_vma->vm_freerg, size, newrg);
  }
  
  //#endif
@@ -10,6 +10,7 @@
 
 #include "common.h"
 #include "syscall.h"
+#include <stdlib.h>
 
 int libsyscall (struct pcb_t *caller,
              uint32_t syscall_idx,
@@ -25,3 +26,68 @@ int libsyscall (struct pcb_t *caller,
 
    return syscall(caller, syscall_idx, &regs);
 }
+
+/*
+ * libsyscall_prep - queue a syscall on the caller ring without entering
+ * the kernel
+ * @caller    : process
+ * @nr        : syscall number
+ * @regs      : arguments, copied into the ring
+ * @user_data : tag returned with the completion
+ * @flags     : SC_SQE_LINK to cancel the next entry when this one fails
+ */
+int libsyscall_prep(struct pcb_t *caller,
+             uint32_t nr,
+             struct sc_regs *regs,
+             uint32_t user_data,
+             uint32_t flags)
+{
+   struct sc_ring *ring = caller->sc_ring;
+
+   if (ring == NULL)
+      ring = caller->sc_ring = calloc(1, sizeof(struct sc_ring));
+
+   if (ring->sq_tail - ring->sq_head >= SC_RING_SZ)
+      return -1; /* submission queue full */
+
+   struct sc_sqe *sqe = &ring->sq[ring->sq_tail & SC_RING_MASK];
+   sqe->nr = nr;
+   sqe->flags = flags;
+   sqe->user_data = user_data;
+   sqe->regs = *regs;
+   ring->sq_tail++;
+
+   return 0;
+}
+
+/*
+ * libsyscall_submit - hand all queued entries to the kernel at once
+ * Return the number of entries the kernel consumed
+ */
+int libsyscall_submit(struct pcb_t *caller)
+{
+   struct sc_regs regs;
+
+   if (caller->sc_ring == NULL)
+      return 0;
+
+   regs.a1 = caller->sc_ring->sq_tail - caller->sc_ring->sq_head;
+   return syscall(caller, SC_NR_RING_ENTER, &regs);
+}
+
+/*
+ * libsyscall_reap - pop the oldest completion
+ * Return 0 when @cqe was filled, -1 when no completion is pending
+ */
+int libsyscall_reap(struct pcb_t *caller, struct sc_cqe *cqe)
+{
+   struct sc_ring *ring = caller->sc_ring;
+
+   if (ring == NULL || ring->cq_head == ring->cq_tail)
+      return -1;
+
+   *cqe = ring->cq[ring->cq_head & SC_RING_MASK];
+   ring->cq_head++;
+
+   return 0;
+}
@@ -1,10 +1,25 @@
 
 #include "loader.h"
+#include "mm.h"
+#include "sim.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
-static uint32_t avail_pid = 1;
+#define PROG_HASH 256
+
+/* A parsed program, shared by every process loaded from the same file */
+struct program {
+	char path[100];
+	uint32_t priority;
+	struct code_seg_t * code;
+	struct program * next;
+};
+
+static int share_programs;
+static struct program * programs[PROG_HASH];
+static pthread_mutex_t programs_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #define OPT_CALC	"calc"
 #define OPT_ALLOC	"alloc"
@@ -12,6 +27,12 @@ static uint32_t avail_pid = 1;
 #define OPT_READ	"read"
 #define OPT_WRITE	"write"
 #define OPT_SYSCALL	"syscall"
+#define OPT_READN	"readn"
+#define OPT_WRITEN	"writen"
+#define OPT_MMAP	"mmap"
+#define OPT_ALLOCV	"allocv"
+#define OPT_READV	"readv"
+#define OPT_WRITEV	"writev"
 
 static enum ins_opcode_t get_opcode(char * opt) {
 	if (!strcmp(opt, OPT_CALC)) {
@@ -26,80 +47,202 @@ static enum ins_opcode_t get_opcode(char * opt) {
 		return WRITE;
 	}else if (!strcmp(opt, OPT_SYSCALL)) {
 		return SYSCALL;
+	}else if (!strcmp(opt, OPT_READN)) {
+		return READN;
+	}else if (!strcmp(opt, OPT_WRITEN)) {
+		return WRITEN;
+	}else if (!strcmp(opt, OPT_MMAP)) {
+		return MMAP;
+	}else if (!strcmp(opt, OPT_ALLOCV)) {
+		return ALLOCV;
+	}else if (!strcmp(opt, OPT_READV)) {
+		return READV;
+	}else if (!strcmp(opt, OPT_WRITEV)) {
+		return WRITEV;
 	}else{
-		printf("get_opcode return Opcode: %s\n", opt);
+		log_printf(LOG_SCHED, "get_opcode return Opcode: %s\n", opt);
 		exit(1);
 	}
 }
 
-struct pcb_t * load(const char * path) {
-	/* Create new PCB for the new process */
-	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
-	proc->pid = avail_pid;
-	avail_pid++;
-	proc->page_table =
-		(struct page_table_t*)malloc(sizeof(struct page_table_t));
-	proc->bp = PAGE_SIZE;
-	proc->pc = 0;
-
-	/* Read process code from file */
+/* Parse the program at @path, its default priority goes to @priority */
+static struct code_seg_t * read_program(const char * path, uint32_t * priority) {
 	FILE * file;
 	if ((file = fopen(path, "r")) == NULL) {
-		printf("Cannot find process description at '%s'\n", path);
+		log_printf(LOG_ERR, "Cannot find process description at '%s'\n", path);
 		exit(1);		
 	}
-	snprintf(proc->path, 2*sizeof(path)+1, "%s", path);
 	char opcode[10];
-	proc->code = (struct code_seg_t*)malloc(sizeof(struct code_seg_t));
-	fscanf(file, "%u %u", &proc->priority, &proc->code->size);
-	proc->code->text = (struct inst_t*)malloc(
-		sizeof(struct inst_t) * proc->code->size
+	struct code_seg_t * code = (struct code_seg_t*)malloc(sizeof(struct code_seg_t));
+	/* An unreadable header loads as an empty program */
+	*priority = 0;
+	code->size = 0;
+	code->shared = 0;
+	fscanf(file, "%u %u", priority, &code->size);
+	code->text = (struct inst_t*)malloc(
+		sizeof(struct inst_t) * code->size
 	);
 	uint32_t i = 0;
 	char buf[200];
-	for (i = 0; i < proc->code->size; i++) {
+	for (i = 0; i < code->size; i++) {
 		fscanf(file, "%s", opcode);
-		proc->code->text[i].opcode = get_opcode(opcode);
-		switch(proc->code->text[i].opcode) {
+		code->text[i].opcode = get_opcode(opcode);
+		switch(code->text[i].opcode) {
 		case CALC:
 			break;
 		case ALLOC:
 			fscanf(
 				file,
 				"%u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1
+				&code->text[i].arg_0,
+				&code->text[i].arg_1
 			);
 			break;
 		case FREE:
-			fscanf(file, "%u\n", &proc->code->text[i].arg_0);
+			fscanf(file, "%u\n", &code->text[i].arg_0);
 			break;
 		case READ:
 		case WRITE:
+		case READN:
+		case ALLOCV:
 			fscanf(
 				file,
 				"%u %u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1,
-				&proc->code->text[i].arg_2
+				&code->text[i].arg_0,
+				&code->text[i].arg_1,
+				&code->text[i].arg_2
 			);
 			break;	
+		case WRITEN:
+		case READV:
+		case WRITEV:
+			fscanf(
+				file,
+				"%u %u %u %u\n",
+				&code->text[i].arg_0,
+				&code->text[i].arg_1,
+				&code->text[i].arg_2,
+				&code->text[i].arg_3
+			);
+			break;
+		case MMAP:
+			/* mmap vmaid size [flags] */
+			code->text[i].arg_2 = 0;
+			fgets(buf, sizeof(buf), file);
+			sscanf(buf, "%u%u%u",
+			           &code->text[i].arg_0,
+			           &code->text[i].arg_1,
+			           &code->text[i].arg_2
+			);
+			break;
 		case SYSCALL:
 			fgets(buf, sizeof(buf), file);
 			sscanf(buf, "%d%d%d%d",
-			           &proc->code->text[i].arg_0,
-			           &proc->code->text[i].arg_1,
-			           &proc->code->text[i].arg_2,
-			           &proc->code->text[i].arg_3
+			           &code->text[i].arg_0,
+			           &code->text[i].arg_1,
+			           &code->text[i].arg_2,
+			           &code->text[i].arg_3
 			);
 			break;
 		default:
-			printf("Opcode: %s\n", opcode);
+			log_printf(LOG_SCHED, "Opcode: %s\n", opcode);
 			exit(1);
 		}
 	}
+	fclose(file);
+	return code;
+}
+
+static unsigned int prog_hash(const char * path) {
+	unsigned int h = 5381;
+
+	while (*path)
+		h = h * 33 + (unsigned char)*path++;
+	return h % PROG_HASH;
+}
+
+/* The program at @path from the cache, parsed on first use */
+static struct code_seg_t * get_program(const char * path, uint32_t * priority) {
+	unsigned int h = prog_hash(path);
+	struct program * p;
+
+	pthread_mutex_lock(&programs_lock);
+	for (p = programs[h]; p != NULL; p = p->next)
+		if (strcmp(p->path, path) == 0)
+			break;
+	if (p == NULL) {
+		p = malloc(sizeof(struct program));
+		snprintf(p->path, sizeof(p->path), "%s", path);
+		p->code = read_program(path, &p->priority);
+		p->code->shared = 1;
+		p->next = programs[h];
+		programs[h] = p;
+	}
+	pthread_mutex_unlock(&programs_lock);
+	*priority = p->priority;
+	return p->code;
+}
+
+/*
+ * loader_share_programs - parse each program file once, the processes
+ * loaded from it in every simulation share its code, which is read only
+ */
+void loader_share_programs(void) {
+	share_programs = 1;
+}
+
+/*
+ * loader_free_programs - release the shared programs once every
+ * simulation is over
+ */
+void loader_free_programs(void) {
+	struct program * p;
+
+	for (int h = 0; h < PROG_HASH; h++) {
+		while ((p = programs[h]) != NULL) {
+			programs[h] = p->next;
+			free(p->code->text);
+			free(p->code);
+			free(p);
+		}
+	}
+	share_programs = 0;
+}
+
+struct pcb_t * load(const char * path) {
+	/* Create new PCB for the new process */
+	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
+	proc->pid = cur_sim->avail_pid;
+	cur_sim->avail_pid++;
+	proc->page_table =
+		(struct page_table_t*)malloc(sizeof(struct page_table_t));
+	proc->bp = PAGE_SIZE;
+	proc->pc = 0;
+	proc->sc_ring = NULL;
+
+	/* Read process code from file */
+	snprintf(proc->path, 2*sizeof(path)+1, "%s", path);
+	if (share_programs)
+		proc->code = get_program(path, &proc->priority);
+	else
+		proc->code = read_program(path, &proc->priority);
 	return proc;
 }
 
+void unload(struct pcb_t * proc) {
+	/* Release everything load() and the run of the process allocated */
+#ifdef MM_PAGING
+	reclaim_unregister(proc);
+	free_pcb_memph(proc);
+#endif
+	free(proc->sc_ring);
+	if (!proc->code->shared) {
+		free(proc->code->text);
+		free(proc->code);
+	}
+	free(proc->page_table);
+	free(proc);
+}
+
 
 
@@ -0,0 +1,216 @@
+
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+/* One formatted message */
+struct log_rec {
+	uint64_t seq;
+	int len;
+	char text[LOG_REC_SZ];
+};
+
+/* Single producer (the owning thread), single consumer (the flusher) */
+struct log_ring {
+	struct log_rec rec[LOG_RING_SZ];
+	unsigned int head;	/* next record to write out, moved by the flusher */
+	unsigned int tail;	/* next free record, moved by the owner */
+	struct log_ring * next;
+};
+
+unsigned int log_mask = LOG_ALL;
+
+static __thread struct log_ring * my_ring;
+static struct log_ring * ring_list;
+static struct log_ring * last_ring;	/* ring of the last message written */
+static pthread_mutex_t ring_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t log_seq;	/* sequence number of the next message */
+static int log_started;
+static int log_running;
+static int log_stopping;
+static pthread_t flusher;
+
+/* Categories enabled at each verbosity level */
+static const unsigned int level_mask[LOG_VERBOSITY_MAX + 1] = {
+	LOG_ERR | LOG_STATS,
+	LOG_ERR | LOG_STATS | LOG_TIMER | LOG_SCHED | LOG_SYSCALL,
+	LOG_ERR | LOG_STATS | LOG_TIMER | LOG_SCHED | LOG_SYSCALL | LOG_MEM,
+	LOG_ALL,
+};
+
+static const struct {
+	const char * name;
+	unsigned int cat;
+} cat_names[] = {
+	{"err", LOG_ERR}, {"stats", LOG_STATS}, {"timer", LOG_TIMER},
+	{"sched", LOG_SCHED}, {"syscall", LOG_SYSCALL}, {"mem", LOG_MEM},
+	{"pgtbl", LOG_PGTBL}, {"memdump", LOG_MEMDUMP}, {"all", LOG_ALL},
+};
+
+void log_set_verbosity(int level) {
+	if (level < 0) level = 0;
+	if (level > LOG_VERBOSITY_MAX) level = LOG_VERBOSITY_MAX;
+	log_mask = level_mask[level];
+}
+
+/*
+ * log_set_categories - enable exactly the comma separated categories
+ * Returns -1 on an unknown name.
+ */
+int log_set_categories(const char * list) {
+	char buf[128];
+	char * tok, * save;
+	unsigned int mask = 0;
+
+	snprintf(buf, sizeof(buf), "%s", list);
+	for (tok = strtok_r(buf, ",", &save); tok != NULL;
+	     tok = strtok_r(NULL, ",", &save)) {
+		size_t i;
+		for (i = 0; i < sizeof(cat_names) / sizeof(cat_names[0]); i++) {
+			if (strcmp(tok, cat_names[i].name) == 0) break;
+		}
+		if (i == sizeof(cat_names) / sizeof(cat_names[0])) return -1;
+		mask |= cat_names[i].cat;
+	}
+	log_mask = mask;
+	return 0;
+}
+
+static struct log_ring * ring_get(void) {
+	if (my_ring == NULL) {
+		my_ring = calloc(1, sizeof(struct log_ring));
+		pthread_mutex_lock(&ring_list_lock);
+		my_ring->next = ring_list;
+		ring_list = my_ring;
+		pthread_mutex_unlock(&ring_list_lock);
+	}
+	return my_ring;
+}
+
+void log_printf(unsigned int cat, const char * fmt, ...) {
+	struct log_ring * ring;
+	struct log_rec * rec;
+	unsigned int tail;
+	va_list ap;
+
+	if (!log_enabled(cat)) return;
+
+	va_start(ap, fmt);
+	if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+		/* Before the flusher runs, or a build without it */
+		vprintf(fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	ring = ring_get();
+	tail = ring->tail;
+	while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == LOG_RING_SZ) {
+		sched_yield(); /* full, wait for the flusher */
+	}
+
+	rec = &ring->rec[tail & (LOG_RING_SZ - 1)];
+	rec->len = vsnprintf(rec->text, LOG_REC_SZ, fmt, ap);
+	if (rec->len >= LOG_REC_SZ) rec->len = LOG_REC_SZ - 1;
+	va_end(ap);
+
+	/* The sequence number is taken last, so the flusher never waits on
+	 * a thread that is blocked on a full ring */
+	rec->seq = __atomic_fetch_add(&log_seq, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * flush_ready - write out messages in sequence order while the next one
+ * is published. Returns the number written.
+ */
+static int flush_ready(uint64_t * next_seq) {
+	struct log_ring * ring;
+	int n = 0;
+
+	pthread_mutex_lock(&ring_list_lock);
+	for (;;) {
+		struct log_rec * rec = NULL;
+
+		/* Consecutive messages usually come from the same thread */
+		ring = last_ring;
+		if (ring == NULL || ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ||
+		    ring->rec[ring->head & (LOG_RING_SZ - 1)].seq != *next_seq) {
+			for (ring = ring_list; ring != NULL; ring = ring->next) {
+				if (ring->head != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) &&
+				    ring->rec[ring->head & (LOG_RING_SZ - 1)].seq == *next_seq)
+					break;
+			}
+		}
+		if (ring == NULL) break;
+
+		rec = &ring->rec[ring->head & (LOG_RING_SZ - 1)];
+		fwrite(rec->text, 1, rec->len, stdout);
+		__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+		(*next_seq)++;
+		last_ring = ring;
+		n++;
+	}
+	pthread_mutex_unlock(&ring_list_lock);
+
+	return n;
+}
+
+static void * flusher_routine(void * args) {
+	uint64_t next_seq = 0;
+
+	for (;;) {
+		int stopping = __atomic_load_n(&log_stopping, __ATOMIC_ACQUIRE);
+
+		if (flush_ready(&next_seq) > 0) continue;
+		if (stopping && next_seq == __atomic_load_n(&log_seq, __ATOMIC_SEQ_CST))
+			break;
+		fflush(stdout);
+		usleep(LOG_FLUSH_US);
+	}
+	fflush(stdout);
+	pthread_exit(NULL);
+}
+
+/*
+ * log_start - switch to buffered output, written by the flusher thread
+ * Only the first call starts it, output stays unbuffered after log_stop.
+ */
+void log_start(void) {
+	if (log_started) return;
+	log_started = 1;
+	fflush(stdout);
+	pthread_create(&flusher, NULL, flusher_routine, NULL);
+	__atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+	atexit(log_stop);
+}
+
+/*
+ * log_stop - write out everything logged so far and stop the flusher
+ * Also run at exit, so messages before a fatal exit(1) are not lost.
+ */
+void log_stop(void) {
+	struct log_ring * ring;
+
+	if (!__atomic_exchange_n(&log_running, 0, __ATOMIC_ACQ_REL)) return;
+	__atomic_store_n(&log_stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(flusher, NULL);
+
+	/* No thread writes to its ring again, log_running is never set back */
+	pthread_mutex_lock(&ring_list_lock);
+	while (ring_list != NULL) {
+		ring = ring_list;
+		ring_list = ring->next;
+		free(ring);
+	}
+	last_ring = NULL;
+	pthread_mutex_unlock(&ring_list_lock);
+	my_ring = NULL;
+}
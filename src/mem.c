@@ -1,5 +1,6 @@
 
 #include "mem.h"
+#include "log.h"
 #include "stdlib.h"
 #include "string.h"
 #include <pthread.h>
@@ -212,9 +213,8 @@ void dump(void) {
 	int i;
 	for (i = 0; i < NUM_PAGES; i++) {
 		if (_mem_stat[i].proc != 0) {
-			printf("%03d: ", i);
-			printf("%05x-%05x - PID: %02d (idx %03d, nxt: %03d)\n",
-				i << OFFSET_LEN,
+			log_printf(LOG_MEMDUMP, "%03d: %05x-%05x - PID: %02d (idx %03d, nxt: %03d)\n",
+				i, i << OFFSET_LEN,
 				((i + 1) << OFFSET_LEN) - 1,
 				_mem_stat[i].proc,
 				_mem_stat[i].index,
@@ -226,7 +226,7 @@ void dump(void) {
 				j++) {
 				
 				if (_ram[j] != 0) {
-					printf("\t%05x: %02x\n", j, _ram[j]);
+					log_printf(LOG_MEMDUMP, "\t%05x: %02x\n", j, _ram[j]);
 				}
 					
 			}
@@ -0,0 +1,366 @@
+/*
+ * microbench - data structures of the simulator in isolation
+ *
+ * Each benchmark drives one internal directly, without the timer or the
+ * CPU threads, over a range of sizes and prints the time and the number
+ * of heap allocations per operation. Allocations are counted by wrapping
+ * malloc, calloc and realloc at link time (see the microbench target).
+ */
+
+#include "queue.h"
+#include "sched.h"
+#include "mm.h"
+#include "log.h"
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MB_MIN_NS 20e6 /* measure every size for at least 20 ms */
+#define MB_BATCH  1024 /* largest batch between two clock reads */
+
+/* Allocation counter, the wrappers replace the libc symbols */
+static uint64_t nr_allocs;
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t n, size_t size);
+void * __real_realloc(void * ptr, size_t size);
+
+void * __wrap_malloc(size_t size) {
+	nr_allocs++;
+	return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t n, size_t size) {
+	nr_allocs++;
+	return __real_calloc(n, size);
+}
+
+void * __wrap_realloc(void * ptr, size_t size) {
+	nr_allocs++;
+	return __real_realloc(ptr, size);
+}
+
+/* Time and allocations of the measured parts only */
+struct mb_clock {
+	struct timespec t0;
+	uint64_t a0;
+	double ns;
+	uint64_t allocs;
+	long ops;
+	int batch;
+};
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng_next(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+/* mb_more - size of the next batch, 0 once enough time is measured.
+ * Batches start at one operation and double, so slow cases stay short */
+static int mb_more(struct mb_clock * c) {
+	if (c->ns >= MB_MIN_NS)
+		return 0;
+	c->batch = c->batch == 0 ? 1 : c->batch * 2 > MB_BATCH ? MB_BATCH : c->batch * 2;
+	return c->batch;
+}
+
+static void mb_start(struct mb_clock * c) {
+	c->a0 = nr_allocs;
+	clock_gettime(CLOCK_MONOTONIC, &c->t0);
+}
+
+static void mb_stop(struct mb_clock * c, long ops) {
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	c->ns += (t1.tv_sec - c->t0.tv_sec) * 1e9 + (t1.tv_nsec - c->t0.tv_nsec);
+	c->allocs += nr_allocs - c->a0;
+	c->ops += ops;
+}
+
+static void mb_report(const char * name, long size, struct mb_clock * c) {
+	printf("%-30s %8ld %12.1f %10.2f\n", name, size, c->ns / c->ops,
+	       (double)c->allocs / c->ops);
+}
+
+static struct pcb_t * mb_pcbs(int n, int prio_range) {
+	struct pcb_t * pcbs = calloc(n, sizeof(struct pcb_t));
+	int i;
+
+	for (i = 0; i < n; i++) {
+		pcbs[i].pid = i + 1;
+		pcbs[i].priority = prio_range > 1 ? rng_next() % prio_range : 0;
+		pcbs[i].prio = i % MAX_PRIO;
+	}
+	return pcbs;
+}
+
+/* A process with an empty address space, frames it releases go to @mram */
+static struct pcb_t * mb_proc(struct memphy_struct * mram) {
+	struct pcb_t * proc = calloc(1, sizeof(struct pcb_t));
+
+	proc->pid = 1;
+	proc->mram = mram;
+	proc->active_mswp = mram;
+	proc->mm = malloc(sizeof(struct mm_struct));
+	init_mm(proc->mm, proc);
+	return proc;
+}
+
+/* Empty the free list of @mp, or also release the device when @all */
+static void mb_memphy_free(struct memphy_struct * mp, int all) {
+	int fpn;
+
+	while (MEMPHY_get_freefp(mp, &fpn) == 0)
+		;
+	if (all) {
+		free(mp->storage);
+		free(mp->dirty_map);
+		free(mp->dump_map);
+	}
+}
+
+static void mb_proc_free(struct pcb_t * proc) {
+	free_pcb_memph(proc);
+	/* Drop the frames the teardown handed back */
+	mb_memphy_free(proc->mram, 0);
+	free(proc);
+}
+
+static int cmp_priority_desc(const void * a, const void * b) {
+	return (int)((const struct pcb_t *)b)->priority - (int)((const struct pcb_t *)a)->priority;
+}
+
+/* Steady state of a queue of @n processes: one dequeue and one enqueue */
+static void bench_queue(const char * name, int n, int prio_range) {
+	struct queue_t q = { 0 };
+	struct pcb_t * pcbs = mb_pcbs(n, prio_range);
+	struct mb_clock c = { 0 };
+	int i, b;
+
+	/* In queue order, so the setup is not quadratic */
+	qsort(pcbs, n, sizeof(struct pcb_t), cmp_priority_desc);
+	for (i = 0; i < n; i++)
+		enqueue(&q, &pcbs[i]);
+	while ((b = mb_more(&c)) > 0) {
+		mb_start(&c);
+		for (i = 0; i < b; i++)
+			enqueue(&q, dequeue(&q));
+		mb_stop(&c, b);
+	}
+	mb_report(name, n, &c);
+	queue_free(&q);
+	free(pcbs);
+}
+
+/* @n ready processes over the priorities, one pick and one put back */
+static void bench_mlq(int n) {
+	struct pcb_t * pcbs = mb_pcbs(n, 1);
+	struct mb_clock c = { 0 };
+	int i, b;
+
+	init_scheduler();
+	for (i = 0; i < n; i++)
+		add_proc(&pcbs[i]);
+	while ((b = mb_more(&c)) > 0) {
+		mb_start(&c);
+		for (i = 0; i < b; i++)
+			put_mlq_proc(get_mlq_proc());
+		mb_stop(&c, b);
+	}
+	mb_report("get_mlq_proc+put", n, &c);
+	while (get_mlq_proc() != NULL)
+		;
+	free(pcbs);
+}
+
+#ifdef MM64
+/* Map @n pages from address 0, one call per page */
+static void map_pages(struct pcb_t * proc, int n) {
+	struct framephy_struct frame = { .fpn = 0, .fp_next = NULL };
+	struct vm_rg_struct rg;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		frame.fpn = i;
+		vmap_page_range_64(proc, i * PAGING_PAGESZ, 1, &frame, &rg);
+	}
+}
+
+static void bench_vmap(struct memphy_struct * mram, int n) {
+	struct mb_clock c = { 0 };
+
+	while (mb_more(&c) > 0) {
+		struct pcb_t * proc = mb_proc(mram);
+
+		mb_start(&c);
+		map_pages(proc, n);
+		mb_stop(&c, n);
+		mb_proc_free(proc);
+	}
+	mb_report("vmap_page_range_64 (page)", n, &c);
+}
+
+/* Lookups of random mapped pages in a table of @n pages */
+static void bench_walk(struct memphy_struct * mram, int n) {
+	struct pcb_t * proc = mb_proc(mram);
+	uint64_t addr[MB_BATCH];
+	struct mb_clock c = { 0 };
+	uint64_t sum = 0;
+	int i, b;
+
+	map_pages(proc, n);
+	for (i = 0; i < MB_BATCH; i++)
+		addr[i] = (rng_next() % n) * PAGING_PAGESZ;
+	while ((b = mb_more(&c)) > 0) {
+		mb_start(&c);
+		for (i = 0; i < b; i++)
+			sum += *pgtable_walk(proc->mm, addr[i]);
+		mb_stop(&c, b);
+	}
+	mb_report("pgtable_walk", n, &c);
+	if (sum == 1)
+		printf("\n"); /* keep the loads */
+	mb_proc_free(proc);
+}
+#endif
+
+/* A device of @n frames, one frame taken and given back */
+static void bench_freefp(int n) {
+	struct memphy_struct mp;
+	struct mb_clock c = { 0 };
+	int i, b, fpn;
+
+	init_memphy(&mp, n * PAGING_PAGESZ, 1);
+	while ((b = mb_more(&c)) > 0) {
+		mb_start(&c);
+		for (i = 0; i < b; i++) {
+			MEMPHY_get_freefp(&mp, &fpn);
+			MEMPHY_put_freefp(&mp, fpn);
+		}
+		mb_stop(&c, b);
+	}
+	mb_report("MEMPHY_get+put_freefp", n, &c);
+	mb_memphy_free(&mp, 1);
+}
+
+/*
+ * Heap with @n free regions of 16 B to 4 KiB apart from each other, a
+ * region is carved out and given back, which merges it again
+ */
+static void bench_vmrg(struct memphy_struct * mram, int n) {
+	struct pcb_t * proc = mb_proc(mram);
+	struct vm_area_struct * vma = get_vma_by_num(proc->mm, PAGING_VMA_HEAP);
+	int size[MB_BATCH];
+	struct vm_rg_struct rg;
+	struct mb_clock c = { 0 };
+	int i, b;
+
+	for (i = 0; i < n; i++) {
+		int start = i * 8192;
+
+		vm_freerg_insert(&vma->vm_freerg, init_vm_rg(start, start + 16 + rng_next() % 4081));
+	}
+	for (i = 0; i < MB_BATCH; i++)
+		size[i] = 16 + rng_next() % 2033;
+	while ((b = mb_more(&c)) > 0) {
+		mb_start(&c);
+		for (i = 0; i < b; i++) {
+			if (get_free_vmrg_area(proc, PAGING_VMA_HEAP, size[i], &rg) == 0)
+				vm_freerg_insert(&vma->vm_freerg, init_vm_rg(rg.rg_start, rg.rg_end));
+		}
+		mb_stop(&c, b);
+	}
+	mb_report("get_free_vmrg_area+insert", n, &c);
+	mb_proc_free(proc);
+}
+
+/* FIFO of @n resident pages, the victim is picked and queued again */
+static void bench_victim(struct memphy_struct * mram, int n) {
+	struct pcb_t * proc = mb_proc(mram);
+	struct mb_clock c = { 0 };
+	int i, b, pgn;
+
+	for (i = 0; i < n; i++)
+		enlist_pgn_node(&proc->mm->fifo_pgn, i);
+	while ((b = mb_more(&c)) > 0) {
+		mb_start(&c);
+		for (i = 0; i < b; i++) {
+			find_victim_page(proc->mm, &pgn);
+			enlist_pgn_node(&proc->mm->fifo_pgn, pgn);
+		}
+		mb_stop(&c, b);
+	}
+	mb_report("find_victim_page+enlist", n, &c);
+	mb_proc_free(proc);
+}
+
+/* Page copies between two devices of @n frames, frames visited in order */
+static void bench_swap_cp(int n) {
+	struct memphy_struct src, dst;
+	struct mb_clock c = { 0 };
+	int i, b, fpn = 0;
+
+	init_memphy(&src, n * PAGING_PAGESZ, 1);
+	init_memphy(&dst, n * PAGING_PAGESZ, 1);
+	while ((b = mb_more(&c)) > 0) {
+		mb_start(&c);
+		for (i = 0; i < b; i++) {
+			__swap_cp_page(&src, fpn, &dst, n - 1 - fpn);
+			fpn = fpn + 1 == n ? 0 : fpn + 1;
+		}
+		mb_stop(&c, b);
+	}
+	mb_report("__swap_cp_page", n, &c);
+	mb_memphy_free(&src, 1);
+	mb_memphy_free(&dst, 1);
+}
+
+int main(int argc, char * argv[]) {
+	static const int queue_sizes[] = { 10, 100, 1000, 10000, 100000 };
+	static const int page_sizes[] = { 16, 256, 4096, 65536 };
+	static const int frame_sizes[] = { 16, 256, 4096, 16384 };
+	static const int list_sizes[] = { 16, 256, 4096 };
+	struct memphy_struct scratch;
+	struct sim * sim = sim_new("microbench");
+	size_t i;
+
+	/* The scheduler and reclaim state are those of a simulation */
+	sim_bind(sim);
+	/* Only the results are printed */
+	log_set_verbosity(0);
+	log_set_categories("err");
+	init_memphy(&scratch, PAGING_PAGESZ, 1);
+
+	printf("%-30s %8s %12s %10s\n", "benchmark", "size", "ns/op", "allocs/op");
+	for (i = 0; i < sizeof(queue_sizes) / sizeof(queue_sizes[0]); i++)
+		bench_queue("enqueue+dequeue", queue_sizes[i], 1);
+	for (i = 0; i < sizeof(queue_sizes) / sizeof(queue_sizes[0]); i++)
+		bench_queue("enqueue+dequeue (mixed prio)", queue_sizes[i], MAX_PRIO);
+	for (i = 0; i < sizeof(queue_sizes) / sizeof(queue_sizes[0]); i++)
+		bench_mlq(queue_sizes[i]);
+#ifdef MM64
+	for (i = 0; i < sizeof(page_sizes) / sizeof(page_sizes[0]); i++)
+		bench_vmap(&scratch, page_sizes[i]);
+	for (i = 0; i < sizeof(page_sizes) / sizeof(page_sizes[0]); i++)
+		bench_walk(&scratch, page_sizes[i]);
+#endif
+	for (i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++)
+		bench_freefp(frame_sizes[i]);
+	for (i = 0; i < sizeof(page_sizes) / sizeof(page_sizes[0]); i++)
+		bench_vmrg(&scratch, page_sizes[i]);
+	for (i = 0; i < sizeof(list_sizes) / sizeof(list_sizes[0]); i++)
+		bench_victim(&scratch, list_sizes[i]);
+	for (i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++)
+		bench_swap_cp(frame_sizes[i]);
+
+	mb_memphy_free(&scratch, 1);
+	sim_free(sim);
+	return 0;
+}
@@ -0,0 +1,454 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Free region allocator mm/mm-freerg.c
+ *
+ * Free regions of a vm area are kept in two structures at once:
+ *  - segregated size-class bins, two-level as in TLSF: the first level is
+ *    log2 of the size, the second splits that range in VM_FREERG_SLI
+ *    parts. Two bitmaps find a non-empty bin in O(1).
+ *  - a treap ordered by rg_start, so the neighbours of a freed region are
+ *    found in O(log n) and merged with it.
+ */
+
+ #include "mm.h"
+ #include <stdlib.h>
+ #include <stdio.h>
+
+ static int fls_ul(unsigned long x)
+ {
+   return (int)(sizeof(unsigned long) * 8) - 1 - __builtin_clzl(x);
+ }
+
+ /*
+  * freerg_mapping - size class holding regions of @size bytes
+  */
+ static void freerg_mapping(unsigned long size, int *fl, int *sl)
+ {
+   int f = fls_ul(size);
+
+   if (f < VM_FREERG_SLI_BITS)
+   {
+     *fl = 0;
+     *sl = (int)size;
+     return;
+   }
+
+   *fl = f - VM_FREERG_SLI_BITS + 1;
+   *sl = (int)(size >> (f - VM_FREERG_SLI_BITS)) - VM_FREERG_SLI;
+   if (*fl >= VM_FREERG_FLI)
+   {
+     *fl = VM_FREERG_FLI - 1;
+     *sl = VM_FREERG_SLI - 1;
+   }
+ }
+
+ /*
+  * freerg_mapping_search - first size class whose regions all fit @size
+  */
+ static void freerg_mapping_search(unsigned long size, int *fl, int *sl)
+ {
+   int f = fls_ul(size);
+
+   if (f >= VM_FREERG_SLI_BITS)
+     size += (1UL << (f - VM_FREERG_SLI_BITS)) - 1;
+   freerg_mapping(size, fl, sl);
+ }
+
+ static void freerg_bin_insert(struct vm_freerg_set *set, struct vm_rg_struct *rg)
+ {
+   int fl, sl;
+
+   freerg_mapping(rg->rg_end - rg->rg_start, &fl, &sl);
+   rg->rg_prev = NULL;
+   rg->rg_next = set->bins[fl][sl];
+   if (rg->rg_next != NULL)
+     rg->rg_next->rg_prev = rg;
+   set->bins[fl][sl] = rg;
+
+   set->fl_bitmap |= BIT(fl);
+   set->sl_bitmap[fl] |= BIT(sl);
+   set->free_bytes += rg->rg_end - rg->rg_start;
+ }
+
+ static void freerg_bin_remove(struct vm_freerg_set *set, struct vm_rg_struct *rg)
+ {
+   int fl, sl;
+
+   freerg_mapping(rg->rg_end - rg->rg_start, &fl, &sl);
+   if (rg->rg_prev != NULL)
+     rg->rg_prev->rg_next = rg->rg_next;
+   else
+     set->bins[fl][sl] = rg->rg_next;
+   if (rg->rg_next != NULL)
+     rg->rg_next->rg_prev = rg->rg_prev;
+
+   if (set->bins[fl][sl] == NULL)
+   {
+     set->sl_bitmap[fl] &= ~BIT(sl);
+     if (set->sl_bitmap[fl] == 0)
+       set->fl_bitmap &= ~BIT(fl);
+   }
+   set->free_bytes -= rg->rg_end - rg->rg_start;
+   rg->rg_next = rg->rg_prev = NULL;
+ }
+
+ static struct vm_rg_struct *treap_insert(struct vm_rg_struct *root, struct vm_rg_struct *rg)
+ {
+   if (root == NULL)
+     return rg;
+
+   if (rg->rg_start < root->rg_start)
+   {
+     root->rg_left = treap_insert(root->rg_left, rg);
+     if (root->rg_left->rg_prio > root->rg_prio)
+     { /* rotate right */
+       struct vm_rg_struct *l = root->rg_left;
+       root->rg_left = l->rg_right;
+       l->rg_right = root;
+       return l;
+     }
+   }
+   else
+   {
+     root->rg_right = treap_insert(root->rg_right, rg);
+     if (root->rg_right->rg_prio > root->rg_prio)
+     { /* rotate left */
+       struct vm_rg_struct *r = root->rg_right;
+       root->rg_right = r->rg_left;
+       r->rg_left = root;
+       return r;
+     }
+   }
+   return root;
+ }
+
+ static struct vm_rg_struct *treap_remove(struct vm_rg_struct *root, struct vm_rg_struct *rg)
+ {
+   if (root == NULL)
+     return NULL;
+
+   if (root != rg)
+   {
+     if (rg->rg_start < root->rg_start)
+       root->rg_left = treap_remove(root->rg_left, rg);
+     else
+       root->rg_right = treap_remove(root->rg_right, rg);
+     return root;
+   }
+
+   /* Sink the node by rotating its higher priority child above it */
+   if (root->rg_left == NULL)
+     return root->rg_right;
+   if (root->rg_right == NULL)
+     return root->rg_left;
+
+   if (root->rg_left->rg_prio > root->rg_right->rg_prio)
+   {
+     struct vm_rg_struct *l = root->rg_left;
+     root->rg_left = l->rg_right;
+     l->rg_right = treap_remove(root, rg);
+     return l;
+   }
+   else
+   {
+     struct vm_rg_struct *r = root->rg_right;
+     root->rg_right = r->rg_left;
+     r->rg_left = treap_remove(root, rg);
+     return r;
+   }
+ }
+
+ static void freerg_unlink(struct vm_freerg_set *set, struct vm_rg_struct *rg)
+ {
+   freerg_bin_remove(set, rg);
+   set->root = treap_remove(set->root, rg);
+   set->nr_regions--;
+ }
+
+ /*
+  * vm_freerg_init - empty free region set
+  */
+ void vm_freerg_init(struct vm_freerg_set *set)
+ {
+   int fl, sl;
+
+   set->root = NULL;
+   set->fl_bitmap = 0;
+   for (fl = 0; fl < VM_FREERG_FLI; fl++)
+   {
+     set->sl_bitmap[fl] = 0;
+     for (sl = 0; sl < VM_FREERG_SLI; sl++)
+       set->bins[fl][sl] = NULL;
+   }
+   set->nr_regions = 0;
+   set->free_bytes = 0;
+   set->seed = 2463534242U;
+ }
+
+ /*
+  * vm_freerg_insert - give a region back, merging it with its neighbours
+  * @set: free region set
+  * @rg : region node, owned by the set from now on (may be freed)
+  */
+ int vm_freerg_insert(struct vm_freerg_set *set, struct vm_rg_struct *rg)
+ {
+   struct vm_rg_struct *prev = NULL, *next = NULL, *it = set->root;
+
+   if (rg->rg_start >= rg->rg_end)
+   {
+     free(rg);
+     return -1;
+   }
+
+   /* Closest free regions below and above */
+   while (it != NULL)
+   {
+     if (it->rg_start < rg->rg_start)
+     {
+       prev = it;
+       it = it->rg_right;
+     }
+     else
+     {
+       next = it;
+       it = it->rg_left;
+     }
+   }
+
+   if ((prev != NULL && prev->rg_end > rg->rg_start) ||
+       (next != NULL && next->rg_start < rg->rg_end))
+   {
+     free(rg);
+     return -1; /* already free */
+   }
+
+   if (prev != NULL && prev->rg_end == rg->rg_start)
+   {
+     freerg_bin_remove(set, prev);
+     prev->rg_end = rg->rg_end;
+     free(rg);
+     if (next != NULL && next->rg_start == prev->rg_end)
+     {
+       prev->rg_end = next->rg_end;
+       freerg_unlink(set, next);
+       free(next);
+     }
+     freerg_bin_insert(set, prev);
+     return 0;
+   }
+
+   if (next != NULL && next->rg_start == rg->rg_end)
+   {
+     /* Moving the start down keeps the treap order, prev ends before it */
+     freerg_bin_remove(set, next);
+     next->rg_start = rg->rg_start;
+     free(rg);
+     freerg_bin_insert(set, next);
+     return 0;
+   }
+
+   set->seed ^= set->seed << 13;
+   set->seed ^= set->seed >> 17;
+   set->seed ^= set->seed << 5;
+   rg->rg_prio = set->seed;
+   rg->rg_left = rg->rg_right = NULL;
+   set->root = treap_insert(set->root, rg);
+   freerg_bin_insert(set, rg);
+   set->nr_regions++;
+
+   return 0;
+ }
+
+ /*
+  * vm_freerg_alloc - carve @size bytes out of the free regions
+  * @set  : free region set
+  * @size : requested size
+  * @newrg: returned region
+  */
+ int vm_freerg_alloc(struct vm_freerg_set *set, unsigned long size, struct vm_rg_struct *newrg)
+ {
+   struct vm_rg_struct *rg = NULL;
+   uint32_t slmap;
+   int fl, sl;
+
+   if (size == 0 || set->fl_bitmap == 0)
+     return -1;
+
+   /* Good fit: every region of the found class is large enough */
+   freerg_mapping_search(size, &fl, &sl);
+   slmap = set->sl_bitmap[fl] & (~0U << sl);
+   if (slmap == 0)
+   {
+     uint32_t flmap = fl + 1 < VM_FREERG_FLI ? set->fl_bitmap & (~0U << (fl + 1)) : 0;
+     if (flmap != 0)
+     {
+       fl = __builtin_ctz(flmap);
+       slmap = set->sl_bitmap[fl];
+     }
+   }
+   if (slmap != 0)
+   {
+     rg = set->bins[fl][__builtin_ctz(slmap)];
+     if (rg->rg_end - rg->rg_start < size)
+       rg = NULL; /* only the clamped top class can be short */
+   }
+
+   /* Regions of the request's own class may still fit exactly */
+   if (rg == NULL)
+   {
+     freerg_mapping(size, &fl, &sl);
+     for (rg = set->bins[fl][sl]; rg != NULL; rg = rg->rg_next)
+       if (rg->rg_end - rg->rg_start >= size)
+         break;
+   }
+
+   if (rg == NULL)
+     return -1;
+
+   newrg->rg_start = rg->rg_start;
+   newrg->rg_end = rg->rg_start + size;
+
+   freerg_bin_remove(set, rg);
+   if (rg->rg_end - rg->rg_start == size)
+   {
+     set->root = treap_remove(set->root, rg);
+     set->nr_regions--;
+     free(rg);
+   }
+   else
+   {
+     /* Shrinking from the front keeps the treap order */
+     rg->rg_start += size;
+     freerg_bin_insert(set, rg);
+   }
+
+   return 0;
+ }
+
+ /*
+  * vm_freerg_find - free region containing @addr, NULL if it is in use
+  */
+ struct vm_rg_struct *vm_freerg_find(struct vm_freerg_set *set, unsigned long addr)
+ {
+   struct vm_rg_struct *it = set->root, *prev = NULL;
+
+   while (it != NULL)
+   {
+     if (it->rg_start <= addr)
+     {
+       prev = it;
+       it = it->rg_right;
+     }
+     else
+       it = it->rg_left;
+   }
+
+   if (prev == NULL || prev->rg_end <= addr)
+     return NULL;
+   return prev;
+ }
+
+ /*
+  * vm_freerg_take - remove [@start, @end) from the free regions
+  * @set  : free region set
+  * @start: first address
+  * @end  : end address, the range lies inside a single free region
+  */
+ int vm_freerg_take(struct vm_freerg_set *set, unsigned long start, unsigned long end)
+ {
+   struct vm_rg_struct *rg = vm_freerg_find(set, start);
+   unsigned long rg_end;
+
+   if (start >= end || rg == NULL || rg->rg_end < end)
+     return -1;
+
+   rg_end = rg->rg_end;
+   if (rg->rg_start == start && rg_end == end)
+   {
+     freerg_unlink(set, rg);
+     free(rg);
+     return 0;
+   }
+
+   freerg_bin_remove(set, rg);
+   if (rg->rg_start == start)
+     rg->rg_start = end; /* still ordered, nothing free before @end */
+   else
+     rg->rg_end = start;
+   freerg_bin_insert(set, rg);
+
+   /* Taken from the middle: the tail becomes a region of its own */
+   if (rg->rg_end == start && end < rg_end)
+   {
+     struct vm_rg_struct *tail = malloc(sizeof(struct vm_rg_struct));
+     tail->rg_start = end;
+     tail->rg_end = rg_end;
+     vm_freerg_insert(set, tail);
+   }
+
+   return 0;
+ }
+
+ /*
+  * vm_freerg_largest - size of the largest free region
+  */
+ unsigned long vm_freerg_largest(struct vm_freerg_set *set)
+ {
+   struct vm_rg_struct *rg;
+   unsigned long largest = 0;
+   int fl, sl;
+
+   if (set->fl_bitmap == 0)
+     return 0;
+
+   fl = fls_ul(set->fl_bitmap);
+   sl = fls_ul(set->sl_bitmap[fl]);
+   for (rg = set->bins[fl][sl]; rg != NULL; rg = rg->rg_next)
+     if (rg->rg_end - rg->rg_start > largest)
+       largest = rg->rg_end - rg->rg_start;
+
+   return largest;
+ }
+
+ /*
+  * vm_freerg_fragmentation - external fragmentation in percent
+  *
+  * 0 when all free space is one region, close to 100 when the free space
+  * is scattered in many small holes.
+  */
+ int vm_freerg_fragmentation(struct vm_freerg_set *set)
+ {
+   if (set->free_bytes == 0)
+     return 0;
+
+   return (int)(100 - vm_freerg_largest(set) * 100 / set->free_bytes);
+ }
+
+ static void freerg_free_tree(struct vm_rg_struct *rg)
+ {
+   if (rg == NULL)
+     return;
+   freerg_free_tree(rg->rg_left);
+   freerg_free_tree(rg->rg_right);
+   free(rg);
+ }
+
+ /*
+  * vm_freerg_clear - release every free region node
+  */
+ void vm_freerg_clear(struct vm_freerg_set *set)
+ {
+   freerg_free_tree(set->root);
+   vm_freerg_init(set);
+ }
+
+ int print_vm_freerg(struct vm_freerg_set *set)
+ {
+   log_printf(LOG_MEM, "Free regions: %d - %lu bytes - largest %lu - fragmentation %d%%\n",
+          set->nr_regions, set->free_bytes, vm_freerg_largest(set),
+          vm_freerg_fragmentation(set));
+   return 0;
+ }
+
+ // #endif
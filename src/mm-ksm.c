@@ -0,0 +1,442 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Same-page merging module mm/mm-ksm.c
+ *
+ * A background scanner hashes every resident MEMRAM frame of the registered
+ * processes, folds byte-identical frames onto a single read-only copy and
+ * returns the duplicates to the free list. A write to a merged page breaks
+ * the sharing again (copy-on-write) inside pg_setval.
+ */
+
+#include "mm.h"
+#include "sim.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef MM_KSM
+
+#define KSM_HASH_BUCKETS BIT(KSM_HASH_BITS)
+
+struct ksm_mm_slot {
+   struct mm_struct *mm;
+   struct ksm_mm_slot *next;
+};
+
+/* Candidate frame seen during the current scan pass */
+struct ksm_node {
+   uint32_t hash;
+   int fpn;
+   int pgn;   /* looked up again on merge, freed pages prune their tables */
+   struct mm_struct *mm;
+   struct ksm_node *next;
+};
+
+/* Scanner of one simulation, made by ksm_start */
+struct ksm_run {
+   struct memphy_struct *mram;
+   int *refcnt;   /* mapping count per MEMRAM frame, 0 = private */
+   int numfp;
+   pthread_mutex_t refcnt_lock;
+
+   struct ksm_mm_slot *mm_list;
+   pthread_mutex_t list_lock;
+
+   pthread_t thread;
+   int stop_flag;
+
+   int full_scans;
+   int cow_breaks;
+   int saved_peak;
+};
+
+/*
+ * ksm_hash_frame - hash the content of a physical frame
+ * @page: first byte of the frame
+ */
+static uint32_t ksm_hash_frame(const BYTE *page)
+{
+   uint32_t lanes[4];
+   int i;
+
+#ifdef __SSE2__
+   /* 4 independent 32-bit lanes, 16 bytes per step */
+   __m128i acc = _mm_set_epi32(0x9e3779b9, 0x85ebca6b, 0xc2b2ae35, 0x27d4eb2f);
+   for (i = 0; i < PAGING_PAGESZ; i += 16)
+   {
+      __m128i v = _mm_loadu_si128((const __m128i *)(page + i));
+      acc = _mm_xor_si128(acc, v);
+      acc = _mm_add_epi32(acc, _mm_slli_epi32(acc, 5));
+      acc = _mm_xor_si128(acc, _mm_srli_epi32(acc, 7));
+   }
+   _mm_storeu_si128((__m128i *)lanes, acc);
+#else
+   lanes[0] = 0x9e3779b9; lanes[1] = 0x85ebca6b;
+   lanes[2] = 0xc2b2ae35; lanes[3] = 0x27d4eb2f;
+   for (i = 0; i < PAGING_PAGESZ; i += 16)
+   {
+      for (int l = 0; l < 4; l++)
+      {
+         uint32_t w;
+         memcpy(&w, page + i + 4 * l, sizeof(w));
+         lanes[l] ^= w;
+         lanes[l] += lanes[l] << 5;
+         lanes[l] ^= lanes[l] >> 7;
+      }
+   }
+#endif
+
+   return lanes[0] ^ (lanes[1] * 31) ^ (lanes[2] * 961) ^ (lanes[3] * 29791);
+}
+
+static BYTE *ksm_frame(struct ksm_run *ks, int fpn)
+{
+   return ks->mram->storage + fpn * PAGING_PAGESZ;
+}
+
+/*
+ * ksm_merge_page - remap a page onto an identical stable frame
+ * @stable: node owning the frame that is kept
+ * @ptep  : PTE of the duplicate page
+ * @fpn   : frame currently mapped by @ptep
+ *
+ * Both owners' mm_lock are held, so neither frame can change under us.
+ */
+static int ksm_merge_page(struct ksm_run *ks, struct ksm_node *stable, pte_t *ptep, int fpn)
+{
+   pte_t *sptep = pte_get_entry(stable->mm, stable->pgn);
+   pte_t spte = sptep != NULL ? *sptep : 0;
+
+   /* The stable page may have been written, remapped or freed since it was hashed */
+   if (!PAGING_PAGE_PRESENT(spte) || (spte & PAGING_PTE_SWAPPED_MASK) ||
+       PAGING_FPN(spte) != stable->fpn ||
+       memcmp(ksm_frame(ks, stable->fpn), ksm_frame(ks, fpn), PAGING_PAGESZ) != 0)
+      return -1;
+
+   pthread_mutex_lock(&ks->refcnt_lock);
+   if (ks->refcnt[stable->fpn] == 0)
+   {
+      ks->refcnt[stable->fpn] = 1;
+      SETBIT(*sptep, PAGING_PTE_SHARED_MASK);
+   }
+   ks->refcnt[stable->fpn]++;
+
+   pte_set_fpn(ptep, stable->fpn);
+   SETBIT(*ptep, PAGING_PTE_SHARED_MASK);
+
+   /* Release the duplicate once nobody else maps it */
+   if (ks->refcnt[fpn] > 1)
+      ks->refcnt[fpn]--;
+   else
+   {
+      ks->refcnt[fpn] = 0;
+      MEMPHY_put_freefp(ks->mram, fpn);
+   }
+   pthread_mutex_unlock(&ks->refcnt_lock);
+
+   return 0;
+}
+
+/*
+ * ksm_scan_mm - hash the resident pages of one process
+ *
+ * Runs under mm->mm_lock. Merging with a page of another process also
+ * takes that owner's lock, blocking. CPU threads and kswapd may hold two
+ * mm locks as well, in direct reclaim, but shrink_procs only trylocks the
+ * mm of another process and skips it when busy. The scanner is thus the
+ * only thread that waits for a second mm lock, which cannot deadlock.
+ */
+static void ksm_scan_mm(struct ksm_run *ks, struct mm_struct *mm, struct ksm_node **table)
+{
+   struct vm_area_struct *vma;
+   int pgn;
+
+   for (vma = mm->mmap; vma != NULL; vma = vma->vm_next)
+   {
+      int pgn_end = DIV_ROUND_UP(vma->vm_end, PAGING_PAGESZ);
+
+      for (pgn = PAGING_PGN(vma->vm_start); pgn < pgn_end; pgn++)
+      {
+         pte_t *ptep = pte_get_entry(mm, pgn);
+         if (ptep == NULL || !PAGING_PAGE_PRESENT(*ptep) ||
+             (*ptep & PAGING_PTE_SWAPPED_MASK))
+            continue;
+
+         int fpn = PAGING_FPN(*ptep);
+         uint32_t hash = ksm_hash_frame(ksm_frame(ks, fpn));
+         struct ksm_node **bucket = &table[hash & (KSM_HASH_BUCKETS - 1)];
+         struct ksm_node *node;
+
+         for (node = *bucket; node != NULL; node = node->next)
+         {
+            if (node->hash != hash)
+               continue;
+            if (node->fpn == fpn)
+               break; /* already merged */
+
+            if (node->mm != mm)
+               pthread_mutex_lock(&node->mm->mm_lock);
+            int merged = ksm_merge_page(ks, node, ptep, fpn);
+            if (node->mm != mm)
+               pthread_mutex_unlock(&node->mm->mm_lock);
+            if (merged == 0)
+               break;
+         }
+
+         if (node == NULL)
+         {
+            node = malloc(sizeof(struct ksm_node));
+            node->hash = hash;
+            node->fpn = fpn;
+            node->pgn = pgn;
+            node->mm = mm;
+            node->next = *bucket;
+            *bucket = node;
+         }
+      }
+   }
+}
+
+/*
+ * ksm_frames_saved - number of mappings served by another page's frame
+ */
+static int ksm_frames_saved(struct ksm_run *ks, int *shared)
+{
+   int fpn, saved = 0, nshared = 0;
+
+   pthread_mutex_lock(&ks->refcnt_lock);
+   for (fpn = 0; fpn < ks->numfp; fpn++)
+   {
+      if (ks->refcnt[fpn] > 1)
+      {
+         nshared++;
+         saved += ks->refcnt[fpn] - 1;
+      }
+   }
+
+   pthread_mutex_unlock(&ks->refcnt_lock);
+
+   if (shared != NULL)
+      *shared = nshared;
+   return saved;
+}
+
+/*
+ * ksm_scan_pass - one full pass over all registered processes
+ */
+void ksm_scan_pass(void)
+{
+   struct ksm_run *ks = cur_sim->ksm;
+   struct ksm_node **table = calloc(KSM_HASH_BUCKETS, sizeof(struct ksm_node *));
+   struct ksm_mm_slot *slot;
+   int i;
+
+   pthread_mutex_lock(&ks->list_lock);
+   for (slot = ks->mm_list; slot != NULL; slot = slot->next)
+   {
+      pthread_mutex_lock(&slot->mm->mm_lock);
+      ksm_scan_mm(ks, slot->mm, table);
+      pthread_mutex_unlock(&slot->mm->mm_lock);
+   }
+   pthread_mutex_unlock(&ks->list_lock);
+
+   int saved = ksm_frames_saved(ks, NULL);
+   if (saved > ks->saved_peak)
+      ks->saved_peak = saved;
+   ks->full_scans++;
+
+   for (i = 0; i < KSM_HASH_BUCKETS; i++)
+   {
+      while (table[i] != NULL)
+      {
+         struct ksm_node *node = table[i];
+         table[i] = node->next;
+         free(node);
+      }
+   }
+   free(table);
+}
+
+/*
+ * ksm_break_cow - give a merged page its own frame before it is written
+ * @mm : owner of the page
+ * @pgn: page number
+ * @fpn: in/out frame number backing the page
+ *
+ * Caller holds mm->mm_lock.
+ */
+int ksm_break_cow(struct mm_struct *mm, int pgn, int *fpn)
+{
+   struct ksm_run *ks = cur_sim->ksm;
+   pte_t *ptep = pte_get_entry(mm, pgn);
+   int oldfpn, newfpn;
+
+   if (ks == NULL || ptep == NULL || !PAGING_PAGE_SHARED(*ptep))
+      return 0;
+
+   oldfpn = PAGING_FPN(*ptep);
+   pthread_mutex_lock(&ks->refcnt_lock);
+   if (ks->refcnt[oldfpn] > 1)
+   {
+      if (MEMPHY_get_freefp(ks->mram, &newfpn) != 0)
+      {
+         pthread_mutex_unlock(&ks->refcnt_lock);
+         return -1; /* no frame left to hold the private copy */
+      }
+
+      __swap_cp_page(ks->mram, oldfpn, ks->mram, newfpn);
+      ks->refcnt[oldfpn]--;
+      pte_set_fpn(ptep, newfpn);
+      *fpn = newfpn;
+   }
+   else
+   {
+      /* Last mapper keeps the frame */
+      ks->refcnt[oldfpn] = 0;
+   }
+
+   CLRBIT(*ptep, PAGING_PTE_SHARED_MASK);
+   ks->cow_breaks++;
+   pthread_mutex_unlock(&ks->refcnt_lock);
+   return 0;
+}
+
+/*
+ * ksm_register_mm - make a process visible to the scanner
+ */
+int ksm_register_mm(struct mm_struct *mm)
+{
+   struct ksm_run *ks = cur_sim->ksm;
+   struct ksm_mm_slot *slot = malloc(sizeof(struct ksm_mm_slot));
+
+   slot->mm = mm;
+   pthread_mutex_lock(&ks->list_lock);
+   slot->next = ks->mm_list;
+   ks->mm_list = slot;
+   pthread_mutex_unlock(&ks->list_lock);
+
+   return 0;
+}
+
+/*
+ * ksm_unregister_mm - hide a process from the scanner before it is freed
+ *
+ * Waits for a running scan pass, which holds the list lock throughout.
+ */
+void ksm_unregister_mm(struct mm_struct *mm)
+{
+   struct ksm_run *ks = cur_sim->ksm;
+   struct ksm_mm_slot **pp, *slot;
+
+   if (ks == NULL)
+      return;
+
+   pthread_mutex_lock(&ks->list_lock);
+   for (pp = &ks->mm_list; *pp != NULL; pp = &(*pp)->next)
+   {
+      if ((*pp)->mm != mm)
+         continue;
+      slot = *pp;
+      *pp = slot->next;
+      free(slot);
+      break;
+   }
+   pthread_mutex_unlock(&ks->list_lock);
+}
+
+/*
+ * ksm_put_page - drop one mapping of a merged frame
+ * @fpn: frame number
+ *
+ * Returns 0 when the caller held the last mapping and must free the frame.
+ */
+int ksm_put_page(int fpn)
+{
+   struct ksm_run *ks = cur_sim->ksm;
+   int ret = 0;
+
+   if (ks == NULL)
+      return 0;
+
+   pthread_mutex_lock(&ks->refcnt_lock);
+   if (ks->refcnt[fpn] > 1)
+   {
+      ks->refcnt[fpn]--;
+      ret = 1;
+   }
+   else
+      ks->refcnt[fpn] = 0;
+   pthread_mutex_unlock(&ks->refcnt_lock);
+
+   return ret;
+}
+
+static void *ksm_routine(void *args)
+{
+   struct ksm_run *ks;
+
+   sim_bind((struct sim *)args);
+   ks = cur_sim->ksm;
+   while (!__atomic_load_n(&ks->stop_flag, __ATOMIC_ACQUIRE))
+   {
+      ksm_scan_pass();
+      usleep(KSM_SCAN_INTERVAL_US);
+   }
+   pthread_exit(NULL);
+}
+
+/*
+ * ksm_start - launch the merging thread over MEMRAM
+ * @mram: the physical RAM device
+ */
+int ksm_start(struct memphy_struct *mram)
+{
+   struct ksm_run *ks = calloc(1, sizeof(struct ksm_run));
+
+   ks->mram = mram;
+   ks->numfp = mram->maxsz / PAGING_PAGESZ;
+   ks->refcnt = calloc(ks->numfp > 0 ? ks->numfp : 1, sizeof(int));
+   pthread_mutex_init(&ks->refcnt_lock, NULL);
+   pthread_mutex_init(&ks->list_lock, NULL);
+   cur_sim->ksm = ks;
+
+   return pthread_create(&ks->thread, NULL, ksm_routine, cur_sim);
+}
+
+/*
+ * ksm_stop - stop the merging thread and report its savings
+ */
+void ksm_stop(void)
+{
+   struct ksm_run *ks = cur_sim->ksm;
+   int shared, saved;
+
+   __atomic_store_n(&ks->stop_flag, 1, __ATOMIC_RELEASE);
+   pthread_join(ks->thread, NULL);
+
+   saved = ksm_frames_saved(ks, &shared);
+   log_printf(LOG_STATS, "KSM: full_scans=%d pages_shared=%d frames_saved=%d (peak %d) cow_breaks=%d\n",
+          ks->full_scans, shared, saved, ks->saved_peak, ks->cow_breaks);
+
+   while (ks->mm_list != NULL)
+   {
+      struct ksm_mm_slot *slot = ks->mm_list;
+      ks->mm_list = slot->next;
+      free(slot);
+   }
+   pthread_mutex_destroy(&ks->refcnt_lock);
+   pthread_mutex_destroy(&ks->list_lock);
+   free(ks->refcnt);
+   free(ks);
+   cur_sim->ksm = NULL;
+}
+
+#endif
+
+// #endif
@@ -0,0 +1,121 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Background page reclaim mm/mm-kswapd.c
+ *
+ * A device attached to the timer checks the number of free MEMRAM frames
+ * once per time slot. Below the low watermark it evicts pages of the
+ * loaded processes to swap, in batches and round robin, until the high
+ * watermark is reached, so that page faults usually find a free frame
+ * instead of reclaiming one themselves.
+ */
+
+#include "mm.h"
+#include "timer.h"
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef MM_KSWAPD
+
+/* Reclaimer of one simulation, made by kswapd_start */
+struct kswapd_run {
+   struct memphy_struct *mram;
+   struct timer_id_t *timer;
+   int low, high;
+
+   pthread_t thread;
+   int stop_flag;
+
+   int wakeups;
+   int reclaimed;
+   int min_free;
+};
+
+/*
+ * kswapd_balance - reclaim until the high watermark or nothing is left
+ */
+static void kswapd_balance(struct kswapd_run *kw)
+{
+   int want;
+
+   while ((want = kw->high - __atomic_load_n(&kw->mram->free_fp_cnt, __ATOMIC_RELAXED)) > 0)
+   {
+      int got = shrink_procs(want, KSWAPD_BATCH, NULL);
+
+      kw->reclaimed += got;
+      if (got == 0)
+         break; /* every page left is busy, locked or shared */
+   }
+}
+
+static void *kswapd_routine(void *args)
+{
+   struct kswapd_run *kw;
+
+   sim_bind((struct sim *)args);
+   kw = cur_sim->kswapd;
+   wait_slot(kw->timer);
+   while (!__atomic_load_n(&kw->stop_flag, __ATOMIC_ACQUIRE))
+   {
+      int nfree = __atomic_load_n(&kw->mram->free_fp_cnt, __ATOMIC_RELAXED);
+
+      if (nfree < kw->min_free)
+         kw->min_free = nfree;
+      if (nfree < kw->low)
+      {
+         kw->wakeups++;
+         kswapd_balance(kw);
+      }
+      next_slot(kw->timer);
+   }
+   detach_event(kw->timer);
+   pthread_exit(NULL);
+}
+
+/*
+ * kswapd_start - launch the reclaimer over MEMRAM
+ * @mram    : the physical RAM device
+ * @timer_id: timer event the thread runs its slots on
+ */
+int kswapd_start(struct memphy_struct *mram, struct timer_id_t *timer_id)
+{
+   struct kswapd_run *kw = calloc(1, sizeof(struct kswapd_run));
+   int numfp = mram->maxsz / PAGING_PAGESZ;
+
+   kw->mram = mram;
+   kw->timer = timer_id;
+   kw->low = numfp * KSWAPD_WMARK_LOW / 100;
+   if (kw->low < 1 && numfp > 0)
+      kw->low = 1;
+   kw->high = numfp * KSWAPD_WMARK_HIGH / 100;
+   if (kw->high <= kw->low)
+      kw->high = kw->low + 1;
+   if (kw->high > numfp)
+      kw->high = numfp;
+   kw->min_free = numfp;
+   cur_sim->kswapd = kw;
+
+   return pthread_create(&kw->thread, NULL, kswapd_routine, cur_sim);
+}
+
+/*
+ * kswapd_stop - stop the reclaimer and report its activity
+ */
+void kswapd_stop(void)
+{
+   struct kswapd_run *kw = cur_sim->kswapd;
+
+   __atomic_store_n(&kw->stop_flag, 1, __ATOMIC_RELEASE);
+   pthread_join(kw->thread, NULL);
+
+   log_printf(LOG_STATS, "KSWAPD: watermarks=%d/%d wakeups=%d pages_reclaimed=%d min_free=%d\n",
+          kw->low, kw->high, kw->wakeups, kw->reclaimed, kw->min_free);
+   free(kw);
+   cur_sim->kswapd = NULL;
+}
+
+#endif
+
+// #endif
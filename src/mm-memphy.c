@@ -1,5 +1,5 @@
 // #ifdef MM_PAGING
-/*
+ /*
  * PAGING based Memory Management
  * Memory physical module mm/mm-memphy.c
  */
@@ -8,6 +8,35 @@
  #include <stdio.h>
  #include <stdlib.h>
  #include <string.h>
+ #include <stdint.h>
+ #ifdef __SSE2__
+ #include <emmintrin.h>
+ #endif
+
+ /*
+  *  memphy_mark - record that frames in [addr, addr+size) were written
+  *  The caller has stored the data already, MEMPHY_dump clears a bit
+  *  before it scans the frame so no write is lost.
+  */
+ static void memphy_mark(struct memphy_struct *mp, int addr, int size)
+ {
+    int fpn, last;
+
+    if (mp->dirty_map == NULL || size <= 0)
+       return;
+
+    last = (addr + size - 1) / PAGING_PAGESZ;
+    for (fpn = addr / PAGING_PAGESZ; fpn <= last; fpn++)
+    {
+       uint64_t bit = 1ULL << (fpn % 64);
+
+       if (!(__atomic_load_n(&mp->dirty_map[fpn / 64], __ATOMIC_RELAXED) & bit))
+          __atomic_fetch_or(&mp->dirty_map[fpn / 64], bit, __ATOMIC_SEQ_CST);
+       if (mp->dump_delta &&
+           !(__atomic_load_n(&mp->dump_map[fpn / 64], __ATOMIC_RELAXED) & bit))
+          __atomic_fetch_or(&mp->dump_map[fpn / 64], bit, __ATOMIC_SEQ_CST);
+    }
+ }
  
  /*
   *  MEMPHY_mv_csr - move MEMPHY cursor
@@ -37,7 +66,7 @@
   */
  int MEMPHY_seq_read(struct memphy_struct *mp, int addr, BYTE *value)
  {
-   printf("MEMPHY_seq_read: addr=%d\n", addr);
+   log_printf(LOG_MEM, "MEMPHY_seq_read: addr=%d\n", addr);
     if (mp == NULL)
        return -1;
  
@@ -86,6 +115,7 @@
  
     MEMPHY_mv_csr(mp, addr);
     mp->storage[addr] = value;
+    memphy_mark(mp, addr, 1);
  
     return 0;
  }
@@ -102,12 +132,64 @@
        return -1;
  
     if (mp->rdmflg)
+    {
        mp->storage[addr] = data;
+       memphy_mark(mp, addr, 1);
+    }
     else /* Sequential access device */
        return MEMPHY_seq_write(mp, addr, data);
  
     return 0;
  }
+ /*
+  *  MEMPHY_read_range - read a contiguous byte range of MEMPHY device
+  *  @mp: memphy struct
+  *  @addr: address of the first byte
+  *  @buf: destination buffer
+  *  @size: number of bytes
+  */
+ int MEMPHY_read_range(struct memphy_struct *mp, int addr, BYTE *buf, int size)
+ {
+    if (mp == NULL || addr < 0 || size < 0 || addr + size > mp->maxsz)
+       return -1;
+
+    if (!mp->rdmflg) /* Sequential access device */
+    {
+       for (int i = 0; i < size; i++)
+          if (MEMPHY_seq_read(mp, addr + i, &buf[i]) != 0)
+             return -1;
+       return 0;
+    }
+
+    memcpy(buf, mp->storage + addr, size);
+    return 0;
+ }
+
+ /*
+  *  MEMPHY_write_range - write a contiguous byte range of MEMPHY device
+  *  @mp: memphy struct
+  *  @addr: address of the first byte
+  *  @buf: source buffer
+  *  @size: number of bytes
+  */
+ int MEMPHY_write_range(struct memphy_struct *mp, int addr, const BYTE *buf, int size)
+ {
+    if (mp == NULL || addr < 0 || size < 0 || addr + size > mp->maxsz)
+       return -1;
+
+    if (!mp->rdmflg) /* Sequential access device */
+    {
+       for (int i = 0; i < size; i++)
+          if (MEMPHY_seq_write(mp, addr + i, buf[i]) != 0)
+             return -1;
+       return 0;
+    }
+
+    memcpy(mp->storage + addr, buf, size);
+    memphy_mark(mp, addr, size);
+    return 0;
+ }
+
  /*
   *  MEMPHY_format-format MEMPHY device
   *  @mp: memphy struct
@@ -119,6 +201,8 @@
     struct framephy_struct *newfst, *fst;
     int iter = 0;
  
+    mp->free_fp_list = NULL;
+    mp->free_fp_cnt = 0;
     if (numfp <= 0)
        return -1;
  
@@ -136,6 +220,8 @@
        fst->fp_next = newfst;
        fst = newfst;
     }
+    fst->fp_next = NULL;
+    mp->free_fp_cnt = numfp;
  
     return 0;
  }
@@ -147,15 +233,20 @@ int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
         return -1;
     }
 
+    REPLAY_LOCK(REPLAY_FRAME_GET, &mp->fp_lock);
     struct framephy_struct *fp = mp->free_fp_list;
 
     if (fp == NULL) {
       //printf("[MEMPHY_get_freefp] No free frame left\n");
+        REPLAY_UNLOCK(REPLAY_FRAME_GET, -1, &mp->fp_lock);
         return -1; // RAM full
     }
 
     *retfpn = fp->fpn;
     mp->free_fp_list = fp->fp_next;
+    /* Changed under fp_lock, read without it by kswapd, stats and trace */
+    __atomic_fetch_sub(&mp->free_fp_cnt, 1, __ATOMIC_RELAXED);
+    REPLAY_UNLOCK(REPLAY_FRAME_GET, fp->fpn, &mp->fp_lock);
 
     free(fp);
 
@@ -167,6 +258,75 @@ int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
 
 
 
+ /*
+ *  memphy_dump_frame - print the bytes of a frame that differ from @ref
+ *  @mp: memphy struct
+ *  @fpn: frame to scan
+ *  @ref: previous contents, updated in place, or NULL to compare with 0
+ *  @has_output: set once the dump header is printed
+ *
+ *  Returns the number of bytes printed.
+ */
+static int memphy_dump_frame(struct memphy_struct *mp, int fpn, BYTE *ref, int *has_output)
+{
+    int start = fpn * PAGING_PAGESZ;
+    int end = start + PAGING_PAGESZ;
+    int cnt = 0;
+    int i = start;
+
+    if (end > mp->maxsz)
+        end = mp->maxsz;
+
+    while (i < end) {
+        BYTE chunk[16];
+        unsigned int diff = 0;
+        int n = end - i < 16 ? end - i : 16;
+
+#ifdef __SSE2__
+        if (n == 16) {
+            /* 16 bytes per compare, most chunks of a dirty frame are clean */
+            __m128i v = _mm_loadu_si128((const __m128i *)(mp->storage + i));
+            __m128i r = ref ? _mm_loadu_si128((const __m128i *)(ref + i)) : _mm_setzero_si128();
+            diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, r)) & 0xffff;
+            if (diff)
+                _mm_storeu_si128((__m128i *)chunk, v);
+        } else
+#endif
+        {
+            for (int k = 0; k < n; k++) {
+                chunk[k] = mp->storage[i + k];
+                if (chunk[k] != (ref ? ref[i + k] : 0))
+                    diff |= 1U << k;
+            }
+        }
+
+        while (diff) {
+            int k = __builtin_ctz(diff);
+
+            diff &= diff - 1;
+            if (!*has_output) {
+                log_printf(LOG_MEMDUMP, mp->dump_delta ?
+                           "===== PHYSICAL MEMORY DUMP (changed) =====\n" :
+                           "===== PHYSICAL MEMORY DUMP =====\n");
+                *has_output = 1;
+            }
+            log_printf(LOG_MEMDUMP, "BYTE %08x: %d\n", i + k, chunk[k]);
+            if (ref)
+                ref[i + k] = chunk[k];
+            cnt++;
+        }
+        i += n;
+    }
+
+    return cnt;
+}
+
+ /*
+ *  MEMPHY_dump - print the non-zero bytes of the device
+ *  Only frames marked in dirty_map are visited. In changed-only mode
+ *  (MEMPHY_set_dump_delta) only frames written since the previous dump
+ *  are visited and only the bytes that changed are printed.
+ */
 int MEMPHY_dump(struct memphy_struct *mp) {
     if (mp == NULL || mp->storage == NULL) {
         return -1;
@@ -174,37 +334,74 @@ int MEMPHY_dump(struct memphy_struct *mp) {
 
     int has_output = 0;
 
-    for (int i = 0; i < mp->maxsz; i++) {
-        if (mp->storage[i] != 0) {
-            if (!has_output) {
-                printf("===== PHYSICAL MEMORY DUMP =====\n");
-                has_output = 1;
+    if (!log_enabled(LOG_MEMDUMP))
+        return 0;
+
+    pthread_mutex_lock(&mp->dump_lock);
+    for (int w = 0; w < mp->map_words; w++) {
+        uint64_t bits;
+
+        if (mp->dump_delta)
+            bits = __atomic_exchange_n(&mp->dump_map[w], 0, __ATOMIC_SEQ_CST);
+        else
+            bits = __atomic_load_n(&mp->dirty_map[w], __ATOMIC_SEQ_CST);
+
+        while (bits) {
+            int fpn = w * 64 + __builtin_ctzll(bits);
+            uint64_t bit = bits & -bits;
+
+            bits &= bits - 1;
+            if (mp->dump_delta) {
+                memphy_dump_frame(mp, fpn, mp->dump_shadow, &has_output);
+                continue;
             }
-            printf("BYTE %08x: %d\n", i, mp->storage[i]);
+
+            /* Forget frames that went back to all zero, a later write
+             * marks them again */
+            __atomic_fetch_and(&mp->dirty_map[w], ~bit, __ATOMIC_SEQ_CST);
+            if (memphy_dump_frame(mp, fpn, NULL, &has_output) > 0)
+                __atomic_fetch_or(&mp->dirty_map[w], bit, __ATOMIC_SEQ_CST);
         }
     }
+    pthread_mutex_unlock(&mp->dump_lock);
 
     if (has_output) {
-        printf("===== PHYSICAL MEMORY END-DUMP =====\n");
-        printf("================================================================\n");
+        log_printf(LOG_MEMDUMP, "===== PHYSICAL MEMORY END-DUMP =====\n");
+        log_printf(LOG_MEMDUMP, "================================================================\n");
     }
 
     return has_output ? 0 : -1;
 }
 
+ /*
+ *  MEMPHY_set_dump_delta - make MEMPHY_dump print only what changed
+ *  @mp: memphy struct
+ *  @on: 1 for changed-only dumps, 0 for full dumps
+ *
+ *  Set before the device is used.
+ */
+void MEMPHY_set_dump_delta(struct memphy_struct *mp, int on)
+{
+    if (on && mp->dump_shadow == NULL)
+    {
+        mp->dump_shadow = calloc(mp->maxsz, sizeof(BYTE));
+        memcpy(mp->dump_shadow, mp->storage, mp->maxsz);
+        memcpy(mp->dump_map, mp->dirty_map, mp->map_words * sizeof(uint64_t));
+    }
+    mp->dump_delta = on;
+}
 
-
-
- 
  int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
  {
-    struct framephy_struct *fp = mp->free_fp_list;
     struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
  
     /* Create new node with value fpn */
     newnode->fpn = fpn;
-    newnode->fp_next = fp;
+    REPLAY_LOCK(REPLAY_FRAME_PUT, &mp->fp_lock);
+    newnode->fp_next = mp->free_fp_list;
     mp->free_fp_list = newnode;
+    __atomic_fetch_add(&mp->free_fp_cnt, 1, __ATOMIC_RELAXED);
+    REPLAY_UNLOCK(REPLAY_FRAME_PUT, fpn, &mp->fp_lock);
  
     return 0;
  }
@@ -216,7 +413,15 @@ int MEMPHY_dump(struct memphy_struct *mp) {
  {
     mp->storage = (BYTE *)malloc(max_size * sizeof(BYTE));
     mp->maxsz = max_size;
+    pthread_mutex_init(&mp->fp_lock, NULL);
     memset(mp->storage, 0, max_size * sizeof(BYTE));
+
+    mp->map_words = (max_size / PAGING_PAGESZ + 1 + 63) / 64;
+    mp->dirty_map = calloc(mp->map_words, sizeof(uint64_t));
+    mp->dump_map = calloc(mp->map_words, sizeof(uint64_t));
+    mp->dump_shadow = NULL;
+    mp->dump_delta = 0;
+    pthread_mutex_init(&mp->dump_lock, NULL);
  
     MEMPHY_format(mp, PAGING_PAGESZ);
  
@@ -228,5 +433,25 @@ int MEMPHY_dump(struct memphy_struct *mp) {
     return 0;
  }
  
+ /*
+  *  Free a MEMPHY set up by init_memphy, once no process uses it
+  */
+ void free_memphy(struct memphy_struct *mp)
+ {
+    struct framephy_struct *fp;
+
+    while ((fp = mp->free_fp_list) != NULL)
+    {
+       mp->free_fp_list = fp->fp_next;
+       free(fp);
+    }
+    free(mp->storage);
+    free(mp->dirty_map);
+    free(mp->dump_map);
+    free(mp->dump_shadow);
+    pthread_mutex_destroy(&mp->fp_lock);
+    pthread_mutex_destroy(&mp->dump_lock);
+ }
+
  // #endif
  
\ No newline at end of file
@@ -10,6 +10,219 @@
  #include <stdio.h>
  #include <pthread.h>
  
+ /*
+  * VMA index: every area of an mm sits in two treaps sharing one node
+  * priority. VMA_TREE_ADDR is an interval tree ordered by (vm_start,
+  * vm_id) whose nodes carry the largest vm_end of their subtree,
+  * VMA_TREE_ID is ordered by vm_id.
+  */
+ #define VMA_LEFT(v, t)  ((v)->vm_tree[t].left)
+ #define VMA_RIGHT(v, t) ((v)->vm_tree[t].right)
+ 
+ static int vma_less(struct vm_area_struct *a, struct vm_area_struct *b, int t)
+ {
+   if (t == VMA_TREE_ID || a->vm_start == b->vm_start)
+     return a->vm_id < b->vm_id;
+   return a->vm_start < b->vm_start;
+ }
+ 
+ static void vma_fix(struct vm_area_struct *v, int t)
+ {
+   struct vm_area_struct *l = VMA_LEFT(v, t), *r = VMA_RIGHT(v, t);
+ 
+   if (t != VMA_TREE_ADDR)
+     return;
+   v->vm_subtree_end = v->vm_end;
+   if (l != NULL && l->vm_subtree_end > v->vm_subtree_end)
+     v->vm_subtree_end = l->vm_subtree_end;
+   if (r != NULL && r->vm_subtree_end > v->vm_subtree_end)
+     v->vm_subtree_end = r->vm_subtree_end;
+ }
+ 
+ static struct vm_area_struct *vma_rotate_right(struct vm_area_struct *root, int t)
+ {
+   struct vm_area_struct *l = VMA_LEFT(root, t);
+ 
+   VMA_LEFT(root, t) = VMA_RIGHT(l, t);
+   VMA_RIGHT(l, t) = root;
+   vma_fix(root, t);
+   vma_fix(l, t);
+   return l;
+ }
+ 
+ static struct vm_area_struct *vma_rotate_left(struct vm_area_struct *root, int t)
+ {
+   struct vm_area_struct *r = VMA_RIGHT(root, t);
+ 
+   VMA_RIGHT(root, t) = VMA_LEFT(r, t);
+   VMA_LEFT(r, t) = root;
+   vma_fix(root, t);
+   vma_fix(r, t);
+   return r;
+ }
+ 
+ static struct vm_area_struct *vma_tree_insert(struct vm_area_struct *root,
+                                               struct vm_area_struct *vma, int t)
+ {
+   if (root == NULL)
+   {
+     VMA_LEFT(vma, t) = VMA_RIGHT(vma, t) = NULL;
+     vma_fix(vma, t);
+     return vma;
+   }
+ 
+   if (vma_less(vma, root, t))
+   {
+     VMA_LEFT(root, t) = vma_tree_insert(VMA_LEFT(root, t), vma, t);
+     if (VMA_LEFT(root, t)->vm_prio > root->vm_prio)
+       return vma_rotate_right(root, t);
+   }
+   else
+   {
+     VMA_RIGHT(root, t) = vma_tree_insert(VMA_RIGHT(root, t), vma, t);
+     if (VMA_RIGHT(root, t)->vm_prio > root->vm_prio)
+       return vma_rotate_left(root, t);
+   }
+   vma_fix(root, t);
+   return root;
+ }
+ 
+ static struct vm_area_struct *vma_tree_remove(struct vm_area_struct *root,
+                                               struct vm_area_struct *vma, int t)
+ {
+   struct vm_area_struct *l, *r;
+ 
+   if (root == NULL)
+     return NULL;
+ 
+   if (root != vma)
+   {
+     if (vma_less(vma, root, t))
+       VMA_LEFT(root, t) = vma_tree_remove(VMA_LEFT(root, t), vma, t);
+     else
+       VMA_RIGHT(root, t) = vma_tree_remove(VMA_RIGHT(root, t), vma, t);
+     vma_fix(root, t);
+     return root;
+   }
+ 
+   l = VMA_LEFT(root, t);
+   r = VMA_RIGHT(root, t);
+   if (l == NULL)
+     return r;
+   if (r == NULL)
+     return l;
+ 
+   /* Rotate the node down below its higher priority child */
+   if (l->vm_prio > r->vm_prio)
+   {
+     root = vma_rotate_right(root, t);
+     VMA_RIGHT(root, t) = vma_tree_remove(VMA_RIGHT(root, t), vma, t);
+   }
+   else
+   {
+     root = vma_rotate_left(root, t);
+     VMA_LEFT(root, t) = vma_tree_remove(VMA_LEFT(root, t), vma, t);
+   }
+   vma_fix(root, t);
+   return root;
+ }
+ 
+ /*
+  * vma_find_overlap - any non-empty area other than @skip_id meeting [start,end)
+  */
+ static struct vm_area_struct *vma_find_overlap(struct vm_area_struct *node,
+                                                unsigned long start, unsigned long end,
+                                                int skip_id)
+ {
+   struct vm_area_struct *hit;
+ 
+   /* Nothing in this subtree ends after start */
+   if (node == NULL || node->vm_subtree_end <= start)
+     return NULL;
+ 
+   hit = vma_find_overlap(VMA_LEFT(node, VMA_TREE_ADDR), start, end, skip_id);
+   if (hit != NULL)
+     return hit;
+ 
+   if (node->vm_start >= end)
+     return NULL; /* node and its right subtree start after the range */
+ 
+   if (node->vm_id != skip_id && node->vm_start < node->vm_end &&
+       OVERLAP(start, end, node->vm_start, node->vm_end))
+     return node;
+ 
+   return vma_find_overlap(VMA_RIGHT(node, VMA_TREE_ADDR), start, end, skip_id);
+ }
+ 
+ /*insert_vm_area - add a new area to an mm
+  *@mm: memory region
+  *@vma: new area, its id and range already set
+  *
+  */
+ int insert_vm_area(struct mm_struct *mm, struct vm_area_struct *vma)
+ {
+   struct vm_area_struct **pvma = &mm->mmap;
+ 
+   if (get_vma_by_num(mm, vma->vm_id) != NULL)
+     return -1; /* id already used */
+ 
+   if (vma->vm_start < vma->vm_end &&
+       vma_find_overlap(mm->mm_tree[VMA_TREE_ADDR], vma->vm_start, vma->vm_end, -1) != NULL)
+     return -1; /* range already used */
+ 
+   mm->mm_vma_seed ^= mm->mm_vma_seed << 13;
+   mm->mm_vma_seed ^= mm->mm_vma_seed >> 17;
+   mm->mm_vma_seed ^= mm->mm_vma_seed << 5;
+   vma->vm_prio = mm->mm_vma_seed;
+   vma->vm_mm = mm;
+ 
+   mm->mm_tree[VMA_TREE_ADDR] = vma_tree_insert(mm->mm_tree[VMA_TREE_ADDR], vma, VMA_TREE_ADDR);
+   mm->mm_tree[VMA_TREE_ID] = vma_tree_insert(mm->mm_tree[VMA_TREE_ID], vma, VMA_TREE_ID);
+ 
+   /* The mmap list stays sorted by id */
+   while (*pvma != NULL && (*pvma)->vm_id < vma->vm_id)
+     pvma = &(*pvma)->vm_next;
+   vma->vm_next = *pvma;
+   *pvma = vma;
+ 
+   return 0;
+ }
+ 
+ /*remove_vm_area - unlink an area from an mm, the caller frees it
+  *@mm: memory region
+  *@vma: area to remove
+  *
+  */
+ void remove_vm_area(struct mm_struct *mm, struct vm_area_struct *vma)
+ {
+   struct vm_area_struct **pvma = &mm->mmap;
+ 
+   mm->mm_tree[VMA_TREE_ADDR] = vma_tree_remove(mm->mm_tree[VMA_TREE_ADDR], vma, VMA_TREE_ADDR);
+   mm->mm_tree[VMA_TREE_ID] = vma_tree_remove(mm->mm_tree[VMA_TREE_ID], vma, VMA_TREE_ID);
+ 
+   while (*pvma != NULL && *pvma != vma)
+     pvma = &(*pvma)->vm_next;
+   if (*pvma != NULL)
+     *pvma = vma->vm_next;
+   vma->vm_next = NULL;
+ }
+ 
+ /*vma_set_range - move or resize an area, keeping the index in order
+  *@mm: memory region
+  *@vma: area
+  *@start: new vm_start
+  *@end: new vm_end
+  *
+  */
+ void vma_set_range(struct mm_struct *mm, struct vm_area_struct *vma,
+                    unsigned long start, unsigned long end)
+ {
+   mm->mm_tree[VMA_TREE_ADDR] = vma_tree_remove(mm->mm_tree[VMA_TREE_ADDR], vma, VMA_TREE_ADDR);
+   vma->vm_start = start;
+   vma->vm_end = end;
+   mm->mm_tree[VMA_TREE_ADDR] = vma_tree_insert(mm->mm_tree[VMA_TREE_ADDR], vma, VMA_TREE_ADDR);
+ }
+ 
  /*get_vma_by_num - get vm area by numID
   *@mm: memory region
   *@vmaid: ID vm area to alloc memory region
@@ -17,30 +230,41 @@
   */
  struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid)
  {
-   struct vm_area_struct *pvma = mm->mmap;
-   
-   if (mm->mmap == NULL)
-     return NULL;
+   struct vm_area_struct *pvma = mm->mm_tree[VMA_TREE_ID];
  
-   int vmait = pvma->vm_id;
-   while (vmait < vmaid)
+   while (pvma != NULL && pvma->vm_id != vmaid)
    {
-     if (pvma == NULL)
-       return NULL;
- 
-     pvma = pvma->vm_next;
-     vmait = pvma->vm_id;
+     if ((unsigned long)vmaid < pvma->vm_id)
+       pvma = VMA_LEFT(pvma, VMA_TREE_ID);
+     else
+       pvma = VMA_RIGHT(pvma, VMA_TREE_ID);
    }
  
    return pvma;
  }
  
+ /*get_vma_by_addr - get the vm area containing an address
+  *@mm: memory region
+  *@addr: virtual address
+  *
+  */
+ struct vm_area_struct *get_vma_by_addr(struct mm_struct *mm, unsigned long addr)
+ {
+   return vma_find_overlap(mm->mm_tree[VMA_TREE_ADDR], addr, addr + 1, -1);
+ }
+ 
  int __mm_swap_page(struct pcb_t *caller, int vicfpn , int swpfpn)
  {
      __swap_cp_page(caller->mram, vicfpn, caller->active_mswp, swpfpn);
      return 0;
  }
  
+ int __mm_swap_in_page(struct pcb_t *caller, int swpfpn, int fpn)
+ {
+     __swap_cp_page(caller->active_mswp, swpfpn, caller->mram, fpn);
+     return 0;
+ }
+ 
  /*get_vm_area_node - get vm area for a number of pages
   *@caller: caller
   *@vmaid: ID vm area to alloc memory region
@@ -58,8 +282,16 @@
    newrg = malloc(sizeof(struct vm_rg_struct));
  
    /* TODO: update the newrg boundary*/
-   newrg->rg_start = cur_vma->sbrk;
-   newrg->rg_end = newrg->rg_start + size;
+   if (cur_vma->vm_flags & VM_GROWSDOWN)
+   {
+     newrg->rg_end = cur_vma->sbrk;
+     newrg->rg_start = newrg->rg_end - size;
+   }
+   else
+   {
+     newrg->rg_start = cur_vma->sbrk;
+     newrg->rg_end = newrg->rg_start + size;
+   }
  
    return newrg;
  }
@@ -73,17 +305,10 @@
   */
  int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend)
  { 
-  struct vm_area_struct *vma = caller->mm->mmap;
-  // there is a case where vma->vm_start == vma->vm_end
-	while (vma != NULL) {
-    if (vma->vm_start == vma->vm_end) {
-        vma = vma->vm_next;
-        continue;
-    }
-   if (OVERLAP(vma->vm_start, vmastart, vma->vm_end, vmaend) == 1) {
-     return -1; /*Overlap detected */}
-     vma = vma->vm_next;
-   }
+   /* Empty areas never overlap, the grown area may touch its own range */
+   if (vma_find_overlap(caller->mm->mm_tree[VMA_TREE_ADDR], vmastart, vmaend, vmaid) != NULL)
+     return -1; /*Overlap detected */
+ 
    return 0;
  }
  
@@ -95,28 +320,113 @@
   */
  int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz)
  {
-   struct vm_rg_struct * newrg = malloc(sizeof(struct vm_rg_struct));
-   int inc_amt = PAGING_PAGE_ALIGNSZ(inc_sz);
-   int incnumpage =  inc_amt / PAGING_PAGESZ;
-   struct vm_rg_struct *area = get_vm_area_node_at_brk(caller, vmaid, inc_sz, inc_amt);
    struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
- 
-   int old_end = cur_vma->vm_end;
- 
-   
+   struct vm_rg_struct *area;
+   unsigned long old_start, old_end;
+   int inc_amt;
+
+   if (cur_vma == NULL || (cur_vma->vm_flags & VM_FIXEDSZ) || inc_sz <= 0)
+     return -1;
+
+   /* Each area grows by at least its own step */
+   if ((unsigned long)inc_sz < cur_vma->vm_grow_min)
+     inc_sz = cur_vma->vm_grow_min;
+   inc_amt = PAGING_PAGE_ALIGNSZ(inc_sz);
+
+   if (cur_vma->vm_flags & VM_GROWSDOWN)
+   {
+     if (cur_vma->sbrk < PAGING_MMAP_BASE + (unsigned long)inc_amt)
+       return -1; /* stack limit */
+   }
+   else if (cur_vma->sbrk + inc_amt > PAGING_STACK_TOP)
+     return -1; /* out of address space */
+
+   area = get_vm_area_node_at_brk(caller, vmaid, inc_amt, inc_amt);
    if (validate_overlap_vm_area(caller, vmaid, area->rg_start, area->rg_end) < 0)
+   {
+     free(area);
      return -1; /*Overlap and failed allocation */
-     
+   }
+
    /* TODO: Obtain the new vm area based on vmaid */
-     cur_vma->vm_end += inc_amt;
- 
-   if (vm_map_ram(caller, area->rg_start, area->rg_end, old_end, incnumpage , newrg) < 0)
-     return -1; /* Map the memory to MEMRAM */
-   enlist_vm_rg_node(&cur_vma->vm_freerg_list, newrg);
-   return -1;
-   
- 
+   old_start = cur_vma->vm_start;
+   old_end = cur_vma->vm_end;
+   if (cur_vma->vm_flags & VM_GROWSDOWN)
+     vma_set_range(caller->mm, cur_vma, area->rg_start, old_end);
+   else
+     vma_set_range(caller->mm, cur_vma, old_start, area->rg_end);
+
+   cur_vma->sbrk = (cur_vma->vm_flags & VM_GROWSDOWN) ? cur_vma->vm_start : cur_vma->vm_end;
+
+   /* Only virtual space is reserved, frames come on first touch (pg_getpage).
+    * The new space merges with the free space left at the old limit */
+   vm_freerg_insert(&cur_vma->vm_freerg, area);
+   return 0;
  }
- 
+
+ /*init_vm_area - allocate an empty vm area
+  *@vmaid: area ID
+  *@start: first address
+  *@end: end address
+  *@flags: VM_* flags
+  *
+  */
+ struct vm_area_struct *init_vm_area(int vmaid, unsigned long start, unsigned long end,
+                                     unsigned long flags)
+ {
+   struct vm_area_struct *vma = malloc(sizeof(struct vm_area_struct));
+
+   vma->vm_id = vmaid;
+   vma->vm_start = start;
+   vma->vm_end = end;
+   vma->sbrk = (flags & VM_GROWSDOWN) ? start : end;
+   vma->vm_flags = flags;
+   vma->vm_grow_min = PAGING_PAGESZ;
+   vma->vm_mm = NULL;
+   vma->vm_next = NULL;
+   vm_freerg_init(&vma->vm_freerg);
+
+   return vma;
+ }
+
+ /*map_vm_area - create an anonymous mapping area
+  *@caller: caller
+  *@vmaid: ID of the new area
+  *@size: mapping size
+  *@flags: extra VM_* flags (VM_LOCKED)
+  *
+  *The area is placed in the highest free gap below PAGING_MMAP_BASE and
+  *offered whole to __alloc. Returns its start address.
+  */
+ int map_vm_area(struct pcb_t *caller, int vmaid, int size, int flags)
+ {
+   struct mm_struct *mm = caller->mm;
+   struct vm_area_struct *vma, *hit;
+   unsigned long len, end = PAGING_MMAP_BASE;
+
+   if (size <= 0 || vmaid < 0 || get_vma_by_num(mm, vmaid) != NULL)
+     return -1;
+   len = PAGING_PAGE_ALIGNSZ(size);
+
+   /* Slide down past every area in the way */
+   while (end >= len &&
+          (hit = vma_find_overlap(mm->mm_tree[VMA_TREE_ADDR], end - len, end, -1)) != NULL)
+     end = hit->vm_start;
+   if (end < len)
+     return -1;
+
+   vma = init_vm_area(vmaid, end - len, end, VM_FIXEDSZ | (flags & VM_LOCKED));
+   if (insert_vm_area(mm, vma) != 0)
+   {
+     free(vma);
+     return -1;
+   }
+
+   /* Frames are allocated on first touch */
+   vm_freerg_insert(&vma->vm_freerg, init_vm_rg(vma->vm_start, vma->vm_end));
+
+   return vma->vm_start;
+ }
+
  // #endif
  
\ No newline at end of file
@@ -5,13 +5,14 @@
  */
 
  #include "mm.h"
+ #include "libmem.h"
+ #include "sim.h"
  #include <stdlib.h>
  #include <stdio.h>
  //#include <string.h>
  
  #include <pthread.h>
- 
- static pthread_mutex_t mm_lock;
+ #include <unistd.h>
 
  /*
   * init_pte - Initialize PTE entry
@@ -82,8 +83,25 @@
    return 0;
  }
  
+ /*
+  * pte_get_entry - locate the PTE slot of a page
+  * @mm    : memory management struct
+  * @pgn   : page number
+  *
+  * Return NULL when the page has no table backing it yet (MM64).
+  */
+ pte_t *pte_get_entry(struct mm_struct *mm, int pgn)
+ {
+#ifdef MM64
+   return pgtable_walk(mm, (uint64_t)pgn * PAGING_PAGESZ);
+#else
+   return &mm->pgd[pgn];
+#endif
+ }
+ 
  /*
   * vmap_page_range - map a range of page at aligned address
+  * Caller holds caller->mm->mm_lock
   */
  int vmap_page_range(
 	struct pcb_t *caller,			// process call
@@ -92,24 +110,20 @@
 	struct framephy_struct *frames, // list of the mapped frames
 	struct vm_rg_struct *ret_rg)	// return mapped region, the real mapped fp
 {									// no guarantee all given pages are mapped
-	int pgit = 0;
-	int pgn = PAGING_PGN(addr);
-
 	ret_rg->rg_end = ret_rg->rg_start =
 		addr; // at least the very first space is usable
 
-    pthread_mutex_lock(&mm_lock);
-
-
 	/* TODO map range of frame to address space
 	 *      [addr to addr + pgnum*PAGING_PAGESZ
 	 *      in page table caller->mm->pgd[]
 	 */
+    int ret_val = 0;
 #ifdef MM64
-    return vmap_page_range_64(caller, addr, pgnum, frames, ret_rg);
-#endif
+    ret_val = vmap_page_range_64(caller, addr, pgnum, frames, ret_rg);
+#else
+    int pgit = 0;
+    int pgn = PAGING_PGN(addr);
     struct framephy_struct *fpit = frames;
-    int ret_val = 0;
     for (pgit = 0; pgit < pgnum; pgit++) {
         if (fpit == NULL) {
             // out of frames while still have pages to map
@@ -127,43 +141,306 @@
     }
 
     ret_rg->rg_end = addr + pgit * PAGING_PAGESZ;
+#endif
 
-    pthread_mutex_unlock(&mm_lock);
 	return ret_val;
 }
  
+ /*
+  * vunmap_page_range - unmap the pages of [start, end) and free their frames
+  * @caller: caller, holds caller->mm->mm_lock
+  * @start : page aligned start address
+  * @end   : page aligned end address
+  *
+  * Swapped out pages give back their swap slot. Under MM64 the page table
+  * nodes left empty are freed as well.
+  */
+ int vunmap_page_range(struct pcb_t *caller, unsigned long start, unsigned long end)
+ {
+   struct pgn_t **pp, *pg;
+   int pgstart = PAGING_PGN(start), pgend = PAGING_PGN(end);
+
+   if (start >= end)
+     return 0;
+
+ #ifdef MM64
+   pgtable_unmap(caller, start, end);
+ #else
+   int pgn;
+   for (pgn = pgstart; pgn < pgend; pgn++)
+   {
+     pte_release(caller, caller->mm->pgd[pgn]);
+     caller->mm->pgd[pgn] = 0;
+   }
+ #endif
+
+   /* The pages are no longer eviction candidates */
+   pp = &caller->mm->fifo_pgn;
+   while ((pg = *pp) != NULL)
+   {
+     if (pg->pgn >= pgstart && pg->pgn < pgend)
+     {
+       *pp = pg->pg_next;
+       free(pg);
+     }
+     else
+       pp = &pg->pg_next;
+   }
+
+   return 0;
+ }
+
+ /* Processes with a paged address space, any of them may lose pages to
+  * reclaim. The list lock is taken before mm_lock, which is only tried */
+ struct reclaim_slot {
+   struct pcb_t *proc;
+   struct reclaim_slot *next;
+ };
+
+ /*
+  * reclaim_register - make the pages of a process reclaimable
+  */
+ int reclaim_register(struct pcb_t *proc)
+ {
+   struct sim *s = cur_sim;
+   struct reclaim_slot *slot = malloc(sizeof(struct reclaim_slot));
+
+   slot->proc = proc;
+   REPLAY_LOCK(REPLAY_RECLAIM, &s->reclaim_list_lock);
+   slot->next = s->reclaim_list;
+   s->reclaim_list = slot;
+   REPLAY_UNLOCK(REPLAY_RECLAIM, proc->pid, &s->reclaim_list_lock);
+
+   return 0;
+ }
+
+ /*
+  * reclaim_unregister - forget a process before its pcb is released
+  */
+ void reclaim_unregister(struct pcb_t *proc)
+ {
+   struct sim *s = cur_sim;
+   struct reclaim_slot **pp, *slot;
+
+   REPLAY_LOCK(REPLAY_RECLAIM, &s->reclaim_list_lock);
+   for (pp = &s->reclaim_list; *pp != NULL; pp = &(*pp)->next)
+   {
+     if ((*pp)->proc != proc)
+       continue;
+     slot = *pp;
+     *pp = slot->next;
+     if (s->reclaim_cursor == slot)
+       s->reclaim_cursor = slot->next;
+     free(slot);
+     break;
+   }
+   REPLAY_UNLOCK(REPLAY_RECLAIM, proc->pid, &s->reclaim_list_lock);
+ }
+
+ /*
+  * reclaim_pick - choose the page of a process to evict and its swap slot
+  * @caller: page owner, caller holds caller->mm->mm_lock
+  * @vicpgn: returned victim page
+  * @fpn   : returned frame of the victim
+  * @swpfpn: returned slot of the active swap device
+  *
+  * Nothing is copied yet, reclaim_commit or reclaim_cancel ends the
+  * eviction once the copy to swap is done or has failed.
+  */
+ int reclaim_pick(struct pcb_t *caller, int *vicpgn, int *fpn, int *swpfpn)
+ {
+   pte_t *vicpte;
+
+   vicpte = pg_pick_victim(caller->mm, vicpgn);
+   if (vicpte == NULL)
+     return -1;
+
+   if (MEMPHY_get_freefp(caller->active_mswp, swpfpn) != 0)
+   {
+     enlist_pgn_node(&caller->mm->fifo_pgn, *vicpgn);
+     return -1;
+   }
+
+   *fpn = PAGING_FPN(*vicpte);
+   return 0;
+ }
+
+ /*
+  * reclaim_commit - the victim page is in swap slot @swpfpn, its frame
+  * @fpn is now free for the caller
+  */
+ void reclaim_commit(struct pcb_t *caller, int vicpgn, int fpn, int swpfpn)
+ {
+   pte_t *vicpte = pte_get_entry(caller->mm, vicpgn);
+
+   STATS_ADD(swap_outs, 1);
+   TRACE(TRACE_SWAP_OUT, caller->pid, vicpgn);
+   *vicpte = 0;
+   pte_set_swap(vicpte, caller->active_mswp_id, swpfpn);
+ #ifdef MMDBG
+   log_printf(LOG_MEM, "RECLAIM: pid=%d page=%d frame=%d -> swap %d\n",
+          caller->pid, vicpgn, fpn, swpfpn);
+ #endif
+ }
+
+ /*
+  * reclaim_cancel - the victim page could not be copied, it stays resident
+  */
+ void reclaim_cancel(struct pcb_t *caller, int vicpgn, int swpfpn)
+ {
+   MEMPHY_put_freefp(caller->active_mswp, swpfpn);
+   enlist_pgn_node(&caller->mm->fifo_pgn, vicpgn);
+ }
+
+ /*
+  * reclaim_frame - evict one resident page of a process to swap
+  * @caller: page owner, caller holds caller->mm->mm_lock
+  * @fpn   : returned frame, free for the caller to use
+  *
+  * The oldest evictable page of the process is copied to the active swap
+  * device and its PTE marked swapped, its frame is handed to the caller.
+  * The copy is done here rather than through the ring of @caller, which
+  * may be another process than the one running on this CPU.
+  */
+ int reclaim_frame(struct pcb_t *caller, int *fpn)
+ {
+   int vicpgn, swpfpn;
+
+   if (reclaim_pick(caller, &vicpgn, fpn, &swpfpn) != 0)
+     return -1;
+
+   __mm_swap_page(caller, *fpn, swpfpn);
+   reclaim_commit(caller, vicpgn, *fpn, swpfpn);
+   return 0;
+ }
+
+ /*
+  * shrink_procs - evict pages of the registered processes to MEMRAM free list
+  * @nr   : number of frames wanted
+  * @batch: most pages taken from one process per visit
+  * @self : process skipped because its mm_lock is held, or NULL
+  *
+  * Processes are visited round robin from where the previous call stopped.
+  * A process whose mm_lock is busy is skipped rather than waited for.
+  * This must stay a trylock: a CPU thread gets here holding its own
+  * mm_lock, and the KSM scanner blocks on a second mm lock (ksm_scan_mm),
+  * so waiting here could deadlock with it or with another CPU.
+  */
+ int shrink_procs(int nr, int batch, struct pcb_t *self)
+ {
+   struct sim *s = cur_sim;
+   struct reclaim_slot *start;
+   int done = 0, progress = 1;
+
+   REPLAY_LOCK(REPLAY_RECLAIM, &s->reclaim_list_lock);
+   while (done < nr && progress && s->reclaim_list != NULL)
+   {
+     progress = 0;
+     if (s->reclaim_cursor == NULL)
+       s->reclaim_cursor = s->reclaim_list;
+     start = s->reclaim_cursor;
+     do
+     {
+       struct pcb_t *proc = s->reclaim_cursor->proc;
+       int fpn, got = 0;
+
+       s->reclaim_cursor = s->reclaim_cursor->next;
+       if (s->reclaim_cursor == NULL)
+         s->reclaim_cursor = s->reclaim_list;
+
+       if (proc == self || !REPLAY_TRYLOCK(&proc->mm->mm_lock))
+         continue;
+       while (got < batch && done < nr && reclaim_frame(proc, &fpn) == 0)
+       {
+         MEMPHY_put_freefp(proc->mram, fpn);
+         got++;
+         done++;
+       }
+       pthread_mutex_unlock(&proc->mm->mm_lock);
+       progress += got;
+     } while (done < nr && s->reclaim_cursor != start);
+   }
+   REPLAY_UNLOCK(REPLAY_RECLAIM, done, &s->reclaim_list_lock);
+
+   return done;
+ }
+
+ /*
+  * get_frame_reclaim - get a MEMRAM frame, reclaiming one if RAM is full
+  * @caller: caller, holds caller->mm->mm_lock
+  * @fpn   : returned frame
+  *
+  * The oldest page of the caller is evicted first, then a page of another
+  * process. When nothing can be evicted the lock is dropped for an
+  * exponential backoff and the attempt is repeated up to
+  * MM_RECLAIM_RETRIES times.
+  */
+ static int get_frame_reclaim(struct pcb_t *caller, int *fpn)
+ {
+   int retry, backoff = MM_RECLAIM_BACKOFF_US;
+
+   for (retry = 0; ; retry++)
+   {
+     if (MEMPHY_get_freefp(caller->mram, fpn) == 0 ||
+         reclaim_frame(caller, fpn) == 0)
+       return 0;
+
+     /* The freed frame may be taken by another CPU first, retry at once */
+     if (shrink_procs(1, 1, caller) > 0 &&
+         MEMPHY_get_freefp(caller->mram, fpn) == 0)
+       return 0;
+
+     if (retry == MM_RECLAIM_RETRIES)
+       return -1;
+
+     REPLAY_UNLOCK(REPLAY_MM, 0, &caller->mm->mm_lock);
+     usleep(backoff);
+     REPLAY_LOCK(REPLAY_MM, &caller->mm->mm_lock);
+     backoff *= 2;
+   }
+ }
+
  /*
   * alloc_pages_range - allocate req_pgnum of frame in ram
   * @caller    : caller
   * @req_pgnum : request page num
   * @frm_lst   : frame list
+  *
+  * Caller holds caller->mm->mm_lock. Frames are reclaimed from the caller
+  * when MEMRAM is full; on failure no frame is kept.
   */
- 
-  int alloc_pages_range(struct pcb_t *caller, int req_pgnum,
-    struct framephy_struct **frm_lst) {
-int pgit, fpn;
-struct framephy_struct *newfp_head = NULL;
-int ret_val = 0;
-
-for (pgit = 0; pgit < req_pgnum; pgit++) {
-if (MEMPHY_get_freefp(caller->mram, &fpn) == 0) {
-    struct framephy_struct *newfp_node = malloc(sizeof(struct framephy_struct));
-    newfp_node->fpn = fpn;
-    newfp_node->owner = caller->mm;
-    newfp_node->fp_next = newfp_head;
-    newfp_head = newfp_node;
-} else { // ERROR CODE of obtaining somes but not enough frames
-    // return allocated frames, but not enough
-    // out of memory
-    ret_val = -3000;
-    break;
-}
-}
+ int alloc_pages_range(struct pcb_t *caller, int req_pgnum,
+                       struct framephy_struct **frm_lst)
+ {
+   int pgit, fpn;
+   struct framephy_struct *newfp_head = NULL;
+
+   for (pgit = 0; pgit < req_pgnum; pgit++)
+   {
+     if (get_frame_reclaim(caller, &fpn) != 0)
+     {
+       /* out of memory, give back what was obtained */
+       while (newfp_head != NULL)
+       {
+         struct framephy_struct *fp = newfp_head;
+         newfp_head = fp->fp_next;
+         MEMPHY_put_freefp(caller->mram, fp->fpn);
+         free(fp);
+       }
+       *frm_lst = NULL;
+       return -3000;
+     }
 
-*frm_lst = newfp_head;
+     struct framephy_struct *newfp_node = malloc(sizeof(struct framephy_struct));
+     newfp_node->fpn = fpn;
+     newfp_node->owner = caller->mm;
+     newfp_node->fp_next = newfp_head;
+     newfp_head = newfp_node;
+   }
 
-return ret_val;
-}
+   *frm_lst = newfp_head;
+   return 0;
+ }
  
  /*
   * vm_map_ram - do the mapping all vm are to ram storage device
@@ -179,23 +456,14 @@ return ret_val;
    struct framephy_struct *frm_lst = NULL;
    int ret_alloc;
  
-   /*@bksysnet: author provides a feasible solution of getting frames
-    *FATAL logic in here, wrong behaviour if we have not enough page
-    *i.e. we request 1000 frames meanwhile our RAM has size of 3 frames
-    *Don't try to perform that case in this simple work, it will result
-    *in endless procedure of swap-off to get frame and we have not provide
-    *duplicate control mechanism, keep it simple
-    */
+   /* RAM pressure is handled by direct reclaim, -3000 means even swap
+    * could not make room for the request */
    ret_alloc = alloc_pages_range(caller, incpgnum, &frm_lst);
  
-   if (ret_alloc < 0 && ret_alloc != -3000)
-     return -1;
- 
-   /* Out of memory */
-   if (ret_alloc == -3000)
+   if (ret_alloc < 0)
    {
  #ifdef MMDBG
-     printf("OOM: vm_map_ram out of memory \n");
+     log_printf(LOG_ERR, "OOM: vm_map_ram out of memory \n");
  #endif
      return -1;
    }
@@ -216,19 +484,12 @@ return ret_val;
  int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                     struct memphy_struct *mpdst, int dstfpn)
  {
-   int cellidx;
-   int addrsrc, addrdst;
-   for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++)
-   {
-     addrsrc = srcfpn * PAGING_PAGESZ + cellidx;
-     addrdst = dstfpn * PAGING_PAGESZ + cellidx;
- 
-     BYTE data;
-     MEMPHY_read(mpsrc, addrsrc, &data);
-     MEMPHY_write(mpdst, addrdst, data);
-   }
- 
-   return 0;
+   BYTE data[PAGING_PAGESZ];
+
+   /* Whole page at once, the destination frame is marked dirty once */
+   if (MEMPHY_read_range(mpsrc, srcfpn * PAGING_PAGESZ, data, PAGING_PAGESZ) != 0)
+     return -1;
+   return MEMPHY_write_range(mpdst, dstfpn * PAGING_PAGESZ, data, PAGING_PAGESZ);
  }
  
  /*
@@ -238,29 +499,32 @@ return ret_val;
   */
  int init_mm(struct mm_struct *mm, struct pcb_t *caller)
  {
-   struct vm_area_struct *vma0 = malloc(sizeof(struct vm_area_struct));
-   pthread_mutex_init(&mm_lock, NULL);
+   struct vm_area_struct *vma0, *vma1;
+   pthread_mutex_init(&mm->mm_lock, NULL);
  
 #ifdef MM64
-   mm->pgd = malloc(512 * sizeof(uint64_t));
-   // Initialize to 0
-   for(int i=0; i<512; i++) mm->pgd[i] = 0;
+   mm->pgd = pgtable_alloc();
 #else
-   mm->pgd = malloc(PAGING_MAX_PGN * sizeof(uint32_t));
+   /* Untouched entries must read as not present (demand paging) */
+   mm->pgd = calloc(PAGING_MAX_PGN, sizeof(uint32_t));
 #endif
-   //memset(mm->pgd, 0, PAGING_MAX_PGN * sizeof(uint32_t));
- 
-   /* By default the owner comes with at least one vma */
-   vma0->vm_id = 0;
-   vma0->vm_start = 0;
-   vma0->vm_end = 0;
-   vma0->sbrk = 0;
-   
-   struct vm_rg_struct *first_rg = init_vm_rg(vma0->vm_start, vma0->vm_end);
-   enlist_vm_rg_node(&vma0->vm_freerg_list, first_rg);
-   vma0->vm_next = NULL;
-   vma0->vm_mm = mm; 
-   mm->mmap = vma0;
+ 
+   mm->symrg_keys = NULL;
+   mm->symrgtbl = NULL;
+   mm->symrg_cap = mm->symrg_count = mm->symrg_used = 0;
+   mm->fifo_pgn = NULL;
+
+   mm->mmap = NULL;
+   mm->mm_tree[VMA_TREE_ADDR] = mm->mm_tree[VMA_TREE_ID] = NULL;
+   mm->mm_vma_seed = 2463534242U;
+
+   /* By default the owner comes with a heap and a stack, both empty */
+   vma0 = init_vm_area(PAGING_VMA_HEAP, 0, 0, 0);
+   vma0->vm_grow_min = PAGING_SBRK_INIT_SZ;
+   insert_vm_area(mm, vma0);
+
+   vma1 = init_vm_area(PAGING_VMA_STACK, PAGING_STACK_TOP, PAGING_STACK_TOP, VM_GROWSDOWN);
+   insert_vm_area(mm, vma1);
  
    return 0;
  }
@@ -299,15 +563,15 @@ return ret_val;
  {
    struct framephy_struct *fp = ifp;
  
-   printf("print_list_fp: ");
-   if (fp == NULL) { printf("NULL list\n"); return -1;}
-   printf("\n");
+   log_printf(LOG_MEM, "print_list_fp: ");
+   if (fp == NULL) { log_printf(LOG_MEM, "NULL list\n"); return -1;}
+   log_printf(LOG_MEM, "\n");
    while (fp != NULL)
    {
-     printf("fp[%d]\n", fp->fpn);
+     log_printf(LOG_MEM, "fp[%d]\n", fp->fpn);
      fp = fp->fp_next;
    }
-   printf("\n");
+   log_printf(LOG_MEM, "\n");
    return 0;
  }
  
@@ -315,15 +579,15 @@ return ret_val;
  {
    struct vm_rg_struct *rg = irg;
  
-   printf("print_list_rg: ");
-   if (rg == NULL) { printf("NULL list\n"); return -1; }
-   printf("\n");
+   log_printf(LOG_MEM, "print_list_rg: ");
+   if (rg == NULL) { log_printf(LOG_MEM, "NULL list\n"); return -1; }
+   log_printf(LOG_MEM, "\n");
    while (rg != NULL)
    {
-     printf("rg[%ld->%ld]\n", rg->rg_start, rg->rg_end);
+     log_printf(LOG_MEM, "rg[%ld->%ld]\n", rg->rg_start, rg->rg_end);
      rg = rg->rg_next;
    }
-   printf("\n");
+   log_printf(LOG_MEM, "\n");
    return 0;
  }
  
@@ -331,29 +595,29 @@ return ret_val;
  {
    struct vm_area_struct *vma = ivma;
  
-   printf("print_list_vma: ");
-   if (vma == NULL) { printf("NULL list\n"); return -1; }
-   printf("\n");
+   log_printf(LOG_MEM, "print_list_vma: ");
+   if (vma == NULL) { log_printf(LOG_MEM, "NULL list\n"); return -1; }
+   log_printf(LOG_MEM, "\n");
    while (vma != NULL)
    {
-     printf("va[%ld->%ld]\n", vma->vm_start, vma->vm_end);
+     log_printf(LOG_MEM, "va[%ld->%ld]\n", vma->vm_start, vma->vm_end);
      vma = vma->vm_next;
    }
-   printf("\n");
+   log_printf(LOG_MEM, "\n");
    return 0;
  }
  
  int print_list_pgn(struct pgn_t *ip)
  {
-   printf("print_list_pgn: ");
-   if (ip == NULL) { printf("NULL list\n"); return -1; }
-   printf("\n");
+   log_printf(LOG_MEM, "print_list_pgn: ");
+   if (ip == NULL) { log_printf(LOG_MEM, "NULL list\n"); return -1; }
+   log_printf(LOG_MEM, "\n");
    while (ip != NULL)
    {
-     printf("va[%d]-\n", ip->pgn);
+     log_printf(LOG_MEM, "va[%d]-\n", ip->pgn);
      ip = ip->pg_next;
    }
-   printf("n");
+   log_printf(LOG_MEM, "n");
    return 0;
  }
  
@@ -362,18 +626,24 @@ return ret_val;
    int pgn_start, pgn_end;
    int pgit;
  
+   if (!log_enabled(LOG_PGTBL))
+     return 0;
+
    if (end == -1)
    {
-     pgn_start = 0;
+ #ifdef MM64
+     /* The walk only visits mapped pages, show every VMA */
+     end = PAGING_STACK_TOP;
+ #else
      struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, 0);
      end = cur_vma->vm_end;
+ #endif
    }
    pgn_start = PAGING_PGN(start);
    pgn_end = PAGING_PGN(end);
  
-   printf("print_pgtbl: %d - %d", start, end);
-   if (caller == NULL) { printf("NULL caller\n"); return -1;}
-    printf("\n");
+   if (caller == NULL) { log_printf(LOG_PGTBL, "print_pgtbl: %d - %dNULL caller\n", start, end); return -1;}
+   log_printf(LOG_PGTBL, "print_pgtbl: %d - %d\n", start, end);
 #ifdef MM64
     print_pgtbl64(caller->mm, start, end);
     return 0;
@@ -381,14 +651,14 @@ return ret_val;
 
     for (pgit = pgn_start; pgit < pgn_end; pgit++)
    {
-     printf("%08ld: %016lx\n", pgit * sizeof(uint32_t), (unsigned long)caller->mm->pgd[pgit]);
+     log_printf(LOG_PGTBL, "%08ld: %016lx\n", pgit * sizeof(uint32_t), (unsigned long)caller->mm->pgd[pgit]);
    }
  
    for (pgit = pgn_start; pgit < pgn_end; pgit++)
    {
-     printf("Page Number: %d -> Frame Number: %ld\n", pgit, (unsigned long)PAGING_PTE_FPN(caller->mm->pgd[pgit]));
+     log_printf(LOG_PGTBL, "Page Number: %d -> Frame Number: %ld\n", pgit, (unsigned long)PAGING_PTE_FPN(caller->mm->pgd[pgit]));
    }
-   printf("================================================================\n");
+   log_printf(LOG_PGTBL, "================================================================\n");
    return 0;
  }
  
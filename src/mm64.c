@@ -19,6 +19,31 @@
 #define PAGING64_PT_INDEX(x)  (((x) >> 12) & 0x1ff)
 #define PAGING64_OFFSET(x)    ((x) & 0xfff)
 
+/*
+ * Every table has 512 entries followed by the number of valid ones,
+ * so empty tables are found without scanning them
+ */
+#define PGTABLE_ENTRIES 512
+#define PGTABLE_NR(t) ((t)[PGTABLE_ENTRIES])
+
+/*
+ * pgtable_alloc - allocate an empty table of any level
+ */
+uint64_t *pgtable_alloc(void) {
+    return calloc(PGTABLE_ENTRIES + 1, sizeof(uint64_t));
+}
+
+/*
+ * pgtable_child - next level table under @table[@idx], allocated on demand
+ */
+static uint64_t *pgtable_child(uint64_t *table, int idx) {
+    if (table[idx] == 0) {
+        table[idx] = (uint64_t)pgtable_alloc();
+        PGTABLE_NR(table)++;
+    }
+    return (uint64_t *)table[idx];
+}
+
 /*
  * Page table walk function
  * Returns the pointer to the PTE or NULL if not found/allocated
@@ -58,10 +83,10 @@ int vmap_page_range_64(struct pcb_t *caller, int addr, int pgnum,
     uint64_t vaddr = (uint64_t)addr; 
     
     /* Initialize PGD if null */
-    if (caller->mm->pgd == NULL) {
-        caller->mm->pgd = malloc(512 * sizeof(uint64_t));
-        for(int i=0; i<512; i++) caller->mm->pgd[i] = 0;
-    }
+    if (caller->mm->pgd == NULL)
+        caller->mm->pgd = pgtable_alloc();
+
+    ret_rg->rg_start = ret_rg->rg_end = addr;
 
     for (pgit = 0; pgit < pgnum; pgit++) {
         if (fpit == NULL) return -1;
@@ -69,98 +94,154 @@ int vmap_page_range_64(struct pcb_t *caller, int addr, int pgnum,
         uint64_t curr_vaddr = vaddr + pgit * PAGING_PAGESZ; 
         
         // Walk and allocate
-        int pgd_idx = PAGING64_PGD_INDEX(curr_vaddr);
-        
-        if (caller->mm->pgd[pgd_idx] == 0) {
-            caller->mm->pgd[pgd_idx] = (uint64_t)malloc(512 * sizeof(uint64_t));
-             uint64_t *new_p4d = (uint64_t *)caller->mm->pgd[pgd_idx];
-             for(int i=0; i<512; i++) new_p4d[i] = 0;
-        }
-        
-        uint64_t *p4d = (uint64_t *)caller->mm->pgd[pgd_idx];
-        int p4d_idx = PAGING64_P4D_INDEX(curr_vaddr);
-        if (p4d[p4d_idx] == 0) {
-            p4d[p4d_idx] = (uint64_t)malloc(512 * sizeof(uint64_t));
-            uint64_t *new_pud = (uint64_t *)p4d[p4d_idx];
-            for(int i=0; i<512; i++) new_pud[i] = 0;
-        }
-        
-        uint64_t *pud = (uint64_t *)p4d[p4d_idx];
-        int pud_idx = PAGING64_PUD_INDEX(curr_vaddr);
-        if (pud[pud_idx] == 0) {
-            pud[pud_idx] = (uint64_t)malloc(512 * sizeof(uint64_t));
-            uint64_t *new_pmd = (uint64_t *)pud[pud_idx];
-            for(int i=0; i<512; i++) new_pmd[i] = 0;
-        }
-        
-        uint64_t *pmd = (uint64_t *)pud[pud_idx];
-        int pmd_idx = PAGING64_PMD_INDEX(curr_vaddr);
-        if (pmd[pmd_idx] == 0) {
-            pmd[pmd_idx] = (uint64_t)malloc(512 * sizeof(uint64_t));
-            uint64_t *new_pt = (uint64_t *)pmd[pmd_idx];
-            for(int i=0; i<512; i++) new_pt[i] = 0;
-        }
-        
-        uint64_t *pt = (uint64_t *)pmd[pmd_idx];
+        uint64_t *p4d = pgtable_child(caller->mm->pgd, PAGING64_PGD_INDEX(curr_vaddr));
+        uint64_t *pud = pgtable_child(p4d, PAGING64_P4D_INDEX(curr_vaddr));
+        uint64_t *pmd = pgtable_child(pud, PAGING64_PUD_INDEX(curr_vaddr));
+        uint64_t *pt = pgtable_child(pmd, PAGING64_PMD_INDEX(curr_vaddr));
         int pt_idx = PAGING64_PT_INDEX(curr_vaddr);
         
-        // Set PTE
-        // We need to format the PTE similar to 32-bit but 64-bit wide
-        // For simplicity, just store FPN for now, or use pte_set_fpn logic adapted
-        pt[pt_idx] = fpit->fpn; 
-        // Set present bit? 
-        // In this simulation, we might just store the FPN directly if the macros expect that.
-        // However, let's try to respect the PTE format if possible.
-        // The existing macros are 32-bit. We might need 64-bit macros.
-        // For now, let's assume the lower 32-bits are compatible.
-        
+        // Set PTE, same format as the 32-bit one in the low bits
         pte_t pte_val = 0;
         pte_set_fpn(&pte_val, fpit->fpn);
+        if (pt[pt_idx] == 0)
+            PGTABLE_NR(pt)++;
         pt[pt_idx] = pte_val;
 
         fpit = fpit->fp_next;
+        ret_rg->rg_end = curr_vaddr + PAGING_PAGESZ;
+
+        /* Tracking for later page replacement activities */
+        enlist_pgn_node(&caller->mm->fifo_pgn, PAGING_PGN(curr_vaddr));
     }
     
     return 0;
 }
 
-void print_pgtbl64(struct mm_struct *mm, uint64_t start, uint64_t end) {
-    printf("print_pgtbl64: %ld - %ld\n", start, end);
-    if (mm == NULL || mm->pgd == NULL) return;
+/*
+ * pgtable_unmap_level - clear the PTEs of [start, end) below a table
+ * @table: table of the given level, @base is the address it starts at
+ * @level: 1 for a PT, up to 5 for the PGD
+ *
+ * Returns 1 when the table is left without any entry.
+ */
+static int pgtable_unmap_level(struct pcb_t *caller, uint64_t *table, int level,
+                               uint64_t base, uint64_t start, uint64_t end)
+{
+    int shift = 12 + 9 * (level - 1);
+    uint64_t span = 1ULL << shift;
+    int first = start > base ? (int)((start - base) >> shift) : 0;
+    int last = (int)((end - 1 - base) >> shift);
+    int i;
 
-    // Iterate through all possible pages in range
-    // This is inefficient for sparse tables, but good for debugging small ranges
-    // Better: Walk the tree
-    
-    // Simple recursive walk or just print what we have
-    // Let's just print valid entries
-    
-    for(int i=0; i<512; i++) {
-        if(mm->pgd[i] != 0) {
-            uint64_t *p4d = (uint64_t *)mm->pgd[i];
-            for(int j=0; j<512; j++) {
-                if(p4d[j] != 0) {
-                    uint64_t *pud = (uint64_t *)p4d[j];
-                    for(int k=0; k<512; k++) {
-                        if(pud[k] != 0) {
-                            uint64_t *pmd = (uint64_t *)pud[k];
-                            for(int l=0; l<512; l++) {
-                                if(pmd[l] != 0) {
-                                    uint64_t *pt = (uint64_t *)pmd[l];
-                                    for(int m=0; m<512; m++) {
-                                        if(pt[m] != 0) {
-                                            printf("PGD[%d] P4D[%d] PUD[%d] PMD[%d] PT[%d] -> Frame: %ld\n",
-                                                i, j, k, l, m, PAGING_PTE_FPN(pt[m]));
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+    if (last > PGTABLE_ENTRIES - 1)
+        last = PGTABLE_ENTRIES - 1;
+
+    for (i = first; i <= last && PGTABLE_NR(table) > 0; i++) {
+        uint64_t ebase = base + (uint64_t)i * span;
+
+        if (table[i] == 0)
+            continue;
+        if (level == 1) {
+            pte_release(caller, table[i]);
+        } else if (pgtable_unmap_level(caller, (uint64_t *)table[i], level - 1,
+                                       ebase, start, end)) {
+            free((uint64_t *)table[i]);
+        } else {
+            continue;
         }
+        table[i] = 0;
+        PGTABLE_NR(table)--;
     }
+
+    return PGTABLE_NR(table) == 0;
+}
+
+/*
+ * pgtable_unmap - unmap [start, end) and prune the tables left empty
+ * The PGD itself is kept.
+ */
+void pgtable_unmap(struct pcb_t *caller, uint64_t start, uint64_t end)
+{
+    if (caller->mm->pgd == NULL || start >= end)
+        return;
+    pgtable_unmap_level(caller, caller->mm->pgd, 5, 0, start, end);
+}
+
+/*
+ * pgtable_free_level - release a table and everything below it
+ * @table: table of the given level
+ * @level: 1 for a PT, up to 5 for the PGD
+ */
+static void pgtable_free_level(struct pcb_t *caller, uint64_t *table, int level)
+{
+    for (int i = 0, left = PGTABLE_NR(table); left > 0; i++) {
+        if (table[i] == 0)
+            continue;
+        left--;
+        if (level == 1)
+            pte_release(caller, table[i]);
+        else
+            pgtable_free_level(caller, (uint64_t *)table[i], level - 1);
+    }
+    free(table);
+}
+
+/*
+ * pgtable_free - tear down the whole 5-level table of a process
+ * Frames and swap slots of the mapped pages go back to their devices.
+ */
+void pgtable_free(struct pcb_t *caller)
+{
+    if (caller->mm->pgd == NULL)
+        return;
+    pgtable_free_level(caller, caller->mm->pgd, 5);
+    caller->mm->pgd = NULL;
+}
+
+/*
+ * print_pgtbl64_level - print the PTEs of [start, end) below a table
+ * @table: table of the given level, @base is the address it starts at
+ * @level: 1 for a PT, up to 5 for the PGD
+ * @idx  : indexes taken from the PGD down, for the output
+ *
+ * Empty tables are skipped and a table stops being scanned once all its
+ * valid entries have been seen.
+ */
+static void print_pgtbl64_level(uint64_t *table, int level, uint64_t base,
+                                uint64_t start, uint64_t end, int idx[5])
+{
+    int shift = 12 + 9 * (level - 1);
+    int first = start > base ? (int)((start - base) >> shift) : 0;
+    int last = (int)((end - 1 - base) >> shift);
+    int left = PGTABLE_NR(table);
+
+    if (last > PGTABLE_ENTRIES - 1)
+        last = PGTABLE_ENTRIES - 1;
+
+    for (int i = first; i <= last && left > 0; i++) {
+        if (table[i] == 0)
+            continue;
+        left--;
+        idx[5 - level] = i;
+        if (level == 1)
+            log_printf(LOG_PGTBL, "PGD[%d] P4D[%d] PUD[%d] PMD[%d] PT[%d] -> Frame: %ld\n",
+                       idx[0], idx[1], idx[2], idx[3], idx[4], PAGING_PTE_FPN(table[i]));
+        else
+            print_pgtbl64_level((uint64_t *)table[i], level - 1,
+                                base + ((uint64_t)i << shift), start, end, idx);
+    }
+}
+
+/*
+ * print_pgtbl64 - print the mapped pages of [start, end)
+ */
+void print_pgtbl64(struct mm_struct *mm, uint64_t start, uint64_t end) {
+    int idx[5];
+
+    log_printf(LOG_PGTBL, "print_pgtbl64: %ld - %ld\n", start, end);
+    if (mm == NULL || mm->pgd == NULL || start >= end) return;
+
+    print_pgtbl64_level(mm->pgd, 5, 0, start, end, idx);
 }
 
 #endif
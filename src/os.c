@@ -4,22 +4,24 @@
 #include "sched.h"
 #include "loader.h"
 #include "mm.h"
+#include "syscall.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "replay.h"
+#include "sim.h"
 
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/sysinfo.h>
 
 
-static int time_slot;
-static int num_cpus;
-static int done = 0;
-
 #ifdef MM_PAGING
-static int memramsz;
-static int memswpsz[PAGING_MAX_MMSWP];
-
 struct mmpaging_ld_args {
 	/* A dispatched argument struct to compact many-fields passing to loader */
 	int vmemsz;
@@ -28,69 +30,89 @@ struct mmpaging_ld_args {
 	struct memphy_struct *active_mswp;
 	int active_mswp_id;
 	struct timer_id_t  *timer_id;
+	struct sim *sim;
 };
 #endif
 
-static struct ld_args{
-	char ** path;
-	unsigned long * start_time;
-#ifdef MLQ_SCHED
-	unsigned long * prio;
-#endif
-} ld_processes;
-int num_processes;
+/* Set by the loader when every process is loaded, read by idle CPUs */
+static int loader_done(void) {
+	int d;
+	REPLAY_LOCK(REPLAY_DONE, &cur_sim->done_lock);
+	d = cur_sim->done;
+	REPLAY_UNLOCK(REPLAY_DONE, d, &cur_sim->done_lock);
+	return d;
+}
 
 struct cpu_args {
 	struct timer_id_t * timer_id;
 	int id;
+	struct sim * sim;
 };
 
 
 static void * cpu_routine(void * args) {
 	struct timer_id_t * timer_id = ((struct cpu_args*)args)->timer_id;
 	int id = ((struct cpu_args*)args)->id;
+	struct sim * sim = ((struct cpu_args*)args)->sim;
 	/* Check for new process in ready queue */
 	int time_left = 0;
 	struct pcb_t * proc = NULL;
+	uint32_t last_pid = 0;
+	uint64_t run_start = 0;
+	char name[16];
+
+	sim_bind(sim);
+	stats_bind_cpu(id);
+	snprintf(name, sizeof(name), "CPU %d", id);
+	trace_bind(id, name);
+	replay_bind(id);
+	wait_slot(timer_id);
 	while (1) {
 		/* Check the status of current process */
 		if (proc == NULL) {
 			/* No process is running, the we load new process from
 		 	* ready queue */
 			proc = get_proc();
-			if (proc == NULL) {
-                           next_slot(timer_id);
-                           continue; /* First load failed. skip dummy load */
-                        }
 		}else if (proc->pc == proc->code->size) {
 			/* The porcess has finish it job */
-			printf("\tCPU %d: Processed %2d has finished\n",
+			log_printf(LOG_SCHED, "\tCPU %d: Processed %2d has finished\n",
 				id ,proc->pid);
-			free(proc);
+			stats_proc_finish(proc);
+			TRACE_AT(TRACE_RUN, run_start, proc->pid, current_time() - run_start);
+			unload(proc);
 			proc = get_proc();
 			time_left = 0;
 		}else if (time_left == 0) {
 			/* The process has done its job in current time slot */
-			printf("\tCPU %d: Put process %2d to run queue\n",
+			log_printf(LOG_SCHED, "\tCPU %d: Put process %2d to run queue\n",
 				id, proc->pid);
+			stats_proc_preempt(proc);
+			TRACE_AT(TRACE_RUN, run_start, proc->pid, current_time() - run_start);
 			put_proc(proc);
 			proc = get_proc();
 		}
 		
 		/* Recheck process status after loading new process */
-		if (proc == NULL && done) {
+		if (proc == NULL && loader_done()) {
 			/* No process to run, exit */
-			printf("\tCPU %d stopped\n", id);
+			log_printf(LOG_SCHED, "\tCPU %d stopped\n", id);
 			break;
 		}else if (proc == NULL) {
 			/* There may be new processes to run in
 			 * next time slots, just skip current slot */
+			STATS_ADD(idle_slots, 1);
 			next_slot(timer_id);
 			continue;
 		}else if (time_left == 0) {
-			printf("\tCPU %d: Dispatched process %2d\n",
+			log_printf(LOG_SCHED, "\tCPU %d: Dispatched process %2d\n",
 				id, proc->pid);
-			time_left = time_slot;
+			time_left = sim->time_slot;
+			stats_proc_dispatch(proc);
+			run_start = current_time();
+			STATS_ADD(dispatches, 1);
+			if (proc->pid != last_pid)
+				STATS_ADD(context_switches, 1);
+			last_pid = proc->pid;
 		}
 		
 		/* Run current process */
@@ -108,17 +130,23 @@ static void * ld_routine(void * args) {
 	struct memphy_struct** mswp = ((struct mmpaging_ld_args *)args)->mswp;
 	struct memphy_struct* active_mswp = ((struct mmpaging_ld_args *)args)->active_mswp;
 	struct timer_id_t * timer_id = ((struct mmpaging_ld_args *)args)->timer_id;
+	struct sim * sim = ((struct mmpaging_ld_args *)args)->sim;
 #else
-	struct timer_id_t * timer_id = (struct timer_id_t*)args;
+	struct timer_id_t * timer_id = ((struct cpu_args*)args)->timer_id;
+	struct sim * sim = ((struct cpu_args*)args)->sim;
 #endif
 	int i = 0;
-	printf("ld_routine\n");
-	while (i < num_processes) {
-		struct pcb_t * proc = load(ld_processes.path[i]);
+	sim_bind(sim);
+	replay_bind(REPLAY_DEV_LOADER);
+	wait_slot(timer_id);
+	log_printf(LOG_SCHED, "ld_routine\n");
+	trace_bind(sim->num_cpus, "loader");
+	while (i < sim->num_processes) {
+		struct pcb_t * proc = load(sim->path[i]);
 #ifdef MLQ_SCHED
-		proc->prio = ld_processes.prio[i];
+		proc->prio = sim->prio[i];
 #endif
-		while (current_time() < ld_processes.start_time[i]) {
+		while (current_time() < sim->start_time[i]) {
 			next_slot(timer_id);
 		}
 #ifdef MM_PAGING
@@ -127,17 +155,22 @@ static void * ld_routine(void * args) {
 		proc->mram = mram;
 		proc->mswp = mswp;
 		proc->active_mswp = active_mswp;
+		proc->active_mswp_id = ((struct mmpaging_ld_args *)args)->active_mswp_id;
+		reclaim_register(proc);
+#ifdef MM_KSM
+		ksm_register_mm(proc->mm);
+#endif
 #endif
-		printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
-			ld_processes.path[i], proc->pid, ld_processes.prio[i]);
+		log_printf(LOG_SCHED, "\tLoaded a process at %s, PID: %d PRIO: %ld\n",
+			sim->path[i], proc->pid, sim->prio[i]);
+		stats_proc_arrive(proc);
 		add_proc(proc);
-		free(ld_processes.path[i]);
 		i++;
 		next_slot(timer_id);
 	}
-	free(ld_processes.path);
-	free(ld_processes.start_time);
-	done = 1;
+	REPLAY_LOCK(REPLAY_DONE, &sim->done_lock);
+	sim->done = 1;
+	REPLAY_UNLOCK(REPLAY_DONE, 1, &sim->done_lock);
 	detach_event(timer_id);
 	pthread_exit(NULL);
 }
@@ -146,17 +179,16 @@ static void * ld_routine(void * args) {
 
 
 
-
-static void read_config(const char * path) {
+static int read_config(struct sim * sim, const char * path) {
 	FILE * file;
 	if ((file = fopen(path, "r")) == NULL) {
-		printf("Cannot find configure file at %s\n", path);
-		exit(1);
+		log_printf(LOG_ERR, "Cannot find configure file at %s\n", path);
+		return -1;
 	}
-	fscanf(file, "%d %d %d\n", &time_slot, &num_cpus, &num_processes);
-	ld_processes.path = (char**)malloc(sizeof(char*) * num_processes);
-	ld_processes.start_time = (unsigned long*)
-		malloc(sizeof(unsigned long) * num_processes);
+	fscanf(file, "%d %d %d\n", &sim->time_slot, &sim->num_cpus, &sim->num_processes);
+	sim->path = (char**)calloc(sim->num_processes, sizeof(char*));
+	sim->start_time = (unsigned long*)
+		malloc(sizeof(unsigned long) * sim->num_processes);
 //////////////////////////////////////////////// UN-COMMENT FOR MLQ .-.  ////////////////////////////////////////////////////////////////////////////
 #ifdef MM_PAGING
 	int sit;
@@ -166,85 +198,186 @@ static void read_config(const char * path) {
 		* for legacy info 
 			*  [time slice] [N = Number of CPU] [M = Number of Processes to be run]
 			*/
-			memramsz    =  0x100000;
-			memswpsz[0] = 0x1000000;
+			sim->memramsz    =  0x100000;
+			sim->memswpsz[0] = 0x1000000;
 		for(sit = 1; sit < PAGING_MAX_MMSWP; sit++)
-			memswpsz[sit] = 0;
+			sim->memswpsz[sit] = 0;
 	#else
 		/* Read input config of memory size: MEMRAM and upto 4 MEMSWP (mem swap)
 		* Format: (size=0 result non-used memswap, must have RAM and at least 1 SWAP)
 		*        MEM_RAM_SZ MEM_SWP0_SZ MEM_SWP1_SZ MEM_SWP2_SZ MEM_SWP3_SZ
 		*/	
-		fscanf(file, "%d\n", &memramsz);
+		fscanf(file, "%d\n", &sim->memramsz);
 		for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-			fscanf(file, "%d", &(memswpsz[sit])); 
+			fscanf(file, "%d", &(sim->memswpsz[sit])); 
 
 		fscanf(file, "\n"); /* Final character */
 	#endif
 #endif
 //////////////////////////////////////////////// UN-COMMENT FOR MLQ .-.  ////////////////////////////////////////////////////////////////////////////
 #ifdef MLQ_SCHED
-	ld_processes.prio = (unsigned long*)
-		malloc(sizeof(unsigned long) * num_processes);
+	sim->prio = (unsigned long*)
+		malloc(sizeof(unsigned long) * sim->num_processes);
 #endif
 	int i;
-	for (i = 0; i < num_processes; i++) {
-		ld_processes.path[i] = (char*)malloc(sizeof(char) * 100);
-		ld_processes.path[i][0] = '\0';
-		strcat(ld_processes.path[i], "input/proc/");
+	for (i = 0; i < sim->num_processes; i++) {
+		sim->path[i] = (char*)malloc(sizeof(char) * 100);
+		sim->path[i][0] = '\0';
+		strcat(sim->path[i], "input/proc/");
 		char proc[100];
 #ifdef MLQ_SCHED
-		fscanf(file, "%lu %s %lu\n", &ld_processes.start_time[i], proc, &ld_processes.prio[i]);
+		fscanf(file, "%lu %s %lu\n", &sim->start_time[i], proc, &sim->prio[i]);
 #else
-		fscanf(file, "%lu %s\n", &ld_processes.start_time[i], proc);
+		fscanf(file, "%lu %s\n", &sim->start_time[i], proc);
 #endif
-		strcat(ld_processes.path[i], proc);
+		strcat(sim->path[i], proc);
 	}
+	fclose(file);
+	return 0;
+}
+
+/* A parameter of a batch line, set on top of what the config reads */
+static int sim_override(struct sim * sim, const char * param) {
+	int v;
+
+	if (sscanf(param, "slot=%i", &v) == 1 && v > 0)
+		sim->time_slot = v;
+	else if (sscanf(param, "cpus=%i", &v) == 1 && v > 0)
+		sim->num_cpus = v;
+#ifdef MM_PAGING
+	else if (sscanf(param, "ram=%i", &v) == 1 && v > 0)
+		sim->memramsz = v;
+#endif
+	else
+		return -1;
+	return 0;
 }
 
+/*
+ * sim_load - a simulation of the config in input/ named first in @line,
+ * with the parameters that follow it; the options come from @opts
+ */
+static struct sim * sim_load(const char * line, const struct sim * opts) {
+	char buf[256], path[128], name[128];
+	char * tok, * save;
+	struct sim * sim;
+
+	snprintf(buf, sizeof(buf), "%s", line);
+	if ((tok = strtok_r(buf, " \t\r\n", &save)) == NULL)
+		return NULL;
+	snprintf(path, sizeof(path), "input/%s", tok);
+	snprintf(name, sizeof(name), "%s", tok);
+	sim = sim_new(name);
+	if (read_config(sim, path) != 0) {
+		sim_free(sim);
+		return NULL;
+	}
+	while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+		if (sim_override(sim, tok) != 0) {
+			log_printf(LOG_ERR, "%s: unknown parameter '%s'\n", name, tok);
+			sim_free(sim);
+			return NULL;
+		}
+		/* Runs of one config differ by their parameters */
+		snprintf(sim->name + strlen(sim->name), sizeof(sim->name) - strlen(sim->name),
+			".%s", tok);
+		for (char * c = strchr(sim->name, '='); c != NULL; c = strchr(c, '='))
+			*c = '_';
+	}
+#ifdef MM_PAGING
+	/* A page fault needs at least one frame of MEMRAM */
+	if (sim->memramsz < PAGING_PAGESZ) {
+		log_printf(LOG_ERR, "%s: MEMRAM of %d bytes is smaller than one page of %d bytes\n",
+			sim->name, sim->memramsz, PAGING_PAGESZ);
+		sim_free(sim);
+		return NULL;
+	}
+#endif
+	sim->ordered = opts->ordered;
+	sim->dump_delta = opts->dump_delta;
+	sim->stats_on = opts->stats_on;
+	sim->stats_every = opts->stats_every;
+	sim->batch = opts->batch;
+	sim->trace_path = opts->trace_path;
+	sim->record_path = opts->record_path;
+	sim->replay_path = opts->replay_path;
+	return sim;
+}
 
+/*
+ * sim_run - run @sim to the end on threads of its own
+ * Return the exit code of the run: 0, 1 if it could not start, 2 if its
+ * replay diverged.
+ */
+static int sim_run(struct sim * sim) {
+	int ret = 0;
 
+	sim_bind(sim);
 
-int main(int argc, char * argv[]) {
-	/* Read config */
-	if (argc != 2) {
-		printf("Usage: os [path to configure file]\n");
+#ifdef MM_PAGING
+	struct memphy_struct mram;
+	struct memphy_struct mswp[PAGING_MAX_MMSWP];
+#endif
+
+	/* Open the trace and replay files before anything is started */
+#ifdef SIM_TRACE
+#ifdef MM_PAGING
+	if (sim->trace_path != NULL && trace_start(sim->trace_path, &mram) != 0)
+		return 1;
+#else
+	if (sim->trace_path != NULL && trace_start(sim->trace_path, NULL) != 0)
+		return 1;
+#endif
+#endif
+#ifdef SIM_REPLAY
+	if ((sim->record_path != NULL && replay_record(sim->record_path) != 0)
+			|| (sim->replay_path != NULL && replay_play(sim->replay_path) != 0)) {
+#ifdef SIM_TRACE
+		trace_stop();
+#endif
 		return 1;
 	}
-	char path[100];
-	path[0] = '\0';
-	strcat(path, "input/");
-	strcat(path, argv[1]);
-	read_config(path);
+#endif
 
-	pthread_t * cpu = (pthread_t*)malloc(num_cpus * sizeof(pthread_t));
+	pthread_t * cpu = (pthread_t*)malloc(sim->num_cpus * sizeof(pthread_t));
 	struct cpu_args * args =
-		(struct cpu_args*)malloc(sizeof(struct cpu_args) * num_cpus);
+		(struct cpu_args*)malloc(sizeof(struct cpu_args) * sim->num_cpus);
 	pthread_t ld;
 	
 	/* Init timer */
 	int i;
-	for (i = 0; i < num_cpus; i++) {
+	struct timer_id_t * ld_event = attach_event();
+	for (i = 0; i < sim->num_cpus; i++) {
 		args[i].timer_id = attach_event();
 		args[i].id = i;
+		args[i].sim = sim;
 	}
-	struct timer_id_t * ld_event = attach_event();
+#ifdef MM_KSWAPD
+	struct timer_id_t * kswapd_event = attach_event();
+#endif
 	start_timer();
 
 #ifdef MM_PAGING
 	/* Init all MEMPHY include 1 MEMRAM and n of MEMSWP */
 	int rdmflag = 1; /* By default memphy is RANDOM ACCESS MEMORY */
 
-	struct memphy_struct mram;
-	struct memphy_struct mswp[PAGING_MAX_MMSWP];
-
 	/* Create MEM RAM */
-	init_memphy(&mram, memramsz, rdmflag);
+	init_memphy(&mram, sim->memramsz, rdmflag);
+	MEMPHY_set_dump_delta(&mram, sim->dump_delta);
 
         /* Create all MEM SWAP */ 
 	int sit;
 	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-	       init_memphy(&mswp[sit], memswpsz[sit], rdmflag);
+	       init_memphy(&mswp[sit], sim->memswpsz[sit], rdmflag);
+
+#ifdef MM_KSM
+	/* Merge identical MEMRAM frames in the background */
+	ksm_start(&mram);
+#endif
+#ifdef MM_KSWAPD
+	/* Keep a reserve of free frames for page faults */
+	kswapd_start(&mram, kswapd_event);
+#endif
 
 	/* In Paging mode, it needs passing the system mem to each PCB through loader*/
 	struct mmpaging_ld_args *mm_ld_args = malloc(sizeof(struct mmpaging_ld_args));
@@ -254,32 +387,255 @@ int main(int argc, char * argv[]) {
 	mm_ld_args->mswp = (struct memphy_struct**) &mswp;
 	mm_ld_args->active_mswp = (struct memphy_struct *) &mswp[0];
         mm_ld_args->active_mswp_id = 0;
+	mm_ld_args->sim = sim;
+#else
+	struct cpu_args ld_args = { ld_event, sim->num_cpus, sim };
 #endif
 
 	/* Init scheduler */
 	init_scheduler();
 
+#ifdef SIM_STATS
+#ifdef MM_PAGING
+	stats_start(&mram, sim->stats_every);
+#else
+	stats_start(NULL, sim->stats_every);
+#endif
+#endif
 	/* Run CPU and loader */
 #ifdef MM_PAGING
 	pthread_create(&ld, NULL, ld_routine, (void*)mm_ld_args);
 #else
-	pthread_create(&ld, NULL, ld_routine, (void*)ld_event);
+	pthread_create(&ld, NULL, ld_routine, (void*)&ld_args);
 #endif
-	for (i = 0; i < num_cpus; i++) {
+	for (i = 0; i < sim->num_cpus; i++) {
 		pthread_create(&cpu[i], NULL,
 			cpu_routine, (void*)&args[i]);
 	}
 
 	/* Wait for CPU and loader finishing */
-	for (i = 0; i < num_cpus; i++) {
+	for (i = 0; i < sim->num_cpus; i++) {
 		pthread_join(cpu[i], NULL);
 	}
 	pthread_join(ld, NULL);
 
+#ifdef MM_KSWAPD
+	kswapd_stop();
+#endif
+#ifdef MM_KSM
+	ksm_stop();
+#endif
+
 	/* Stop timer */
 	stop_timer();
+#ifdef SIM_TRACE
+	trace_stop();
+#endif
+#ifdef SIM_REPLAY
+	if ((sim->record_path != NULL || sim->replay_path != NULL) && replay_stop() != 0)
+		ret = 2;
+#endif
 
-	return 0;
+#ifdef SIM_STATS
+	if (sim->stats_on) {
+		char prefix[160];
+		snprintf(prefix, sizeof(prefix), "output/%s", sim->name);
+		for (char * c = prefix + strlen("output/"); *c; c++)
+			if (*c == '/') *c = '_';
+		stats_write(prefix);
+		if (!sim->batch)
+			stats_print_latency();
+	}
+	stats_stop();
+#endif
+
+#ifdef MM_PAGING
+	free(mm_ld_args);
+	free_memphy(&mram);
+	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+		free_memphy(&mswp[sit]);
+#endif
+	free(cpu);
+	free(args);
+	return ret;
+}
+
+/* Runs of a batch file, taken in turn by the workers */
+struct batch {
+	char ** lines;
+	int nr_lines;
+	int next;
+	int failed;
+	const struct sim * opts;
+};
+
+static double elapsed_s(const struct timespec * t0) {
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void * batch_worker(void * args) {
+	struct batch * b = (struct batch *)args;
+	struct timespec t0;
+	struct sim * sim;
+	int i, ret;
+
+	while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->nr_lines) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if ((sim = sim_load(b->lines[i], b->opts)) == NULL) {
+			__atomic_store_n(&b->failed, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		ret = sim_run(sim);
+		log_printf(LOG_STATS, "batch: %-40s %8lu slots %8.3f s exit %d\n",
+			sim->name, (unsigned long)sim->time, elapsed_s(&t0), ret);
+		if (ret != 0)
+			__atomic_store_n(&b->failed, 1, __ATOMIC_RELAXED);
+		sim_free(sim);
+	}
+	return NULL;
+}
+
+/*
+ * run_batch - run every line of @path, one config and its parameters each,
+ * on @jobs workers; the runs share the parsed programs
+ */
+static int run_batch(const char * path, int jobs, const struct sim * opts) {
+	struct batch b = { .opts = opts };
+	char line[256], * c;
+	pthread_t * workers;
+	FILE * file;
+	int i;
+
+	if ((file = fopen(path, "r")) == NULL) {
+		log_printf(LOG_ERR, "Cannot find batch file at %s\n", path);
+		return 1;
+	}
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if ((c = strchr(line, '#')) != NULL)
+			*c = '\0';
+		for (c = line; isspace((unsigned char)*c); c++)
+			;
+		if (*c == '\0')
+			continue;
+		b.lines = realloc(b.lines, (b.nr_lines + 1) * sizeof(char *));
+		b.lines[b.nr_lines++] = strdup(c);
+	}
+	fclose(file);
+
+	if (jobs > b.nr_lines)
+		jobs = b.nr_lines;
+	loader_share_programs();
+	workers = malloc(jobs * sizeof(pthread_t));
+	for (i = 0; i < jobs; i++)
+		pthread_create(&workers[i], NULL, batch_worker, &b);
+	for (i = 0; i < jobs; i++)
+		pthread_join(workers[i], NULL);
+	loader_free_programs();
+
+	for (i = 0; i < b.nr_lines; i++)
+		free(b.lines[i]);
+	free(b.lines);
+	free(workers);
+	return b.failed;
+}
+
+
+
+
+int main(int argc, char * argv[]) {
+	/* Logging options */
+	int opt, bad = 0, quiet = 1, jobs = 0, ret;
+	const char * batch_path = NULL;
+	struct sim opts = { .ordered = 0 };
+	struct sim * sim;
+	while ((opt = getopt(argc, argv, "v:l:dsi:t:Dr:p:b:j:")) != -1) {
+		if (opt == 'v')
+			log_set_verbosity(atoi(optarg)), quiet = 0;
+		else if (opt == 'd')
+			opts.dump_delta = 1;
+#ifdef SIM_STATS
+		else if (opt == 's')
+			opts.stats_on = 1;
+		else if (opt == 'i')
+			opts.stats_on = 1, opts.stats_every = atoi(optarg);
+#endif
+#ifdef SIM_TRACE
+		else if (opt == 't')
+			opts.trace_path = optarg;
+#endif
+		else if (opt == 'D')
+			opts.ordered = 1;
+#ifdef SIM_REPLAY
+		else if (opt == 'r')
+			opts.record_path = optarg;
+		else if (opt == 'p')
+			opts.replay_path = optarg;
+#endif
+		else if (opt == 'b')
+			batch_path = optarg;
+		else if (opt == 'j')
+			jobs = atoi(optarg);
+		else if (opt == 'l' && log_set_categories(optarg) == 0)
+			quiet = 0;
+		else
+			bad = 1;
+	}
+
+	/* A replay imposes its own order, a recording is of one of them */
+	if (opts.replay_path != NULL && (opts.ordered || opts.record_path != NULL))
+		bad = 1;
+	/* The trace and the recording have room for one run */
+	if (batch_path != NULL && (opts.trace_path != NULL || opts.record_path != NULL
+			|| opts.replay_path != NULL))
+		bad = 1;
+
+	/* Read config */
+	if (bad || optind != argc - (batch_path == NULL ? 1 : 0)) {
+		printf("Usage: os [-v level] [-l category,...] [-d] [-s] [-i slots] [-t file] [-D] [-r file | -p file] [path to configure file]\n"
+		       "       os -b file [-j jobs] [-v level] [-l category,...] [-d] [-s] [-i slots] [-D]\n"
+		       "  level    : 0 (errors, stats) .. %d (everything, default)\n"
+		       "  category : err stats timer sched syscall mem pgtbl memdump all\n"
+		       "  -d       : memory dumps show only bytes changed since the previous dump\n"
+		       "  -s       : write counters to output/<config>.stats.{json,csv}\n"
+		       "  -i slots : -s, plus a sample every <slots> time slots\n"
+		       "  -t file  : write a Chrome trace-event timeline to <file>\n"
+		       "  -D       : deterministic, the devices run one after the other in a slot\n"
+		       "  -r file  : record the order of scheduling and memory events to <file>\n"
+		       "  -p file  : replay a recording, report where the run diverges\n"
+		       "  -b file  : run every line of <file>, a config and parameters\n"
+		       "             slot=N cpus=N ram=N, in parallel (default level 0)\n"
+		       "  -j jobs  : runs at the same time with -b (default: online CPUs)\n",
+		       LOG_VERBOSITY_MAX);
+		return 1;
+	}
+
+	if (batch_path != NULL) {
+		opts.batch = 1;
+		if (quiet)
+			log_set_verbosity(0);
+		if (jobs <= 0)
+			jobs = get_nprocs();
+		if (jobs <= 0)
+			jobs = 1;
+		log_start();
+		ret = run_batch(batch_path, jobs, &opts);
+	} else {
+		if ((sim = sim_load(argv[optind], &opts)) == NULL)
+			return 1;
+		/* Messages of all threads go through the flusher from here on */
+		log_start();
+		ret = sim_run(sim);
+		sim_free(sim);
+	}
+#ifdef SYSCALL_STATS
+	syscall_dump_stats();
+#endif
+
+	log_stop();
+	return ret;
 
 }
 
@@ -7,40 +7,79 @@ int empty(struct queue_t *q) {
     return (q->size == 0);
 }
 
+/* Make room for one more process */
+static int queue_reserve(struct queue_t *q) {
+    if (q->size < q->cap) {
+        return 0;
+    }
+
+    int cap = q->cap > 0 ? q->cap * 2 : MAX_QUEUE_SIZE;
+    struct queue_ent *ent = realloc(q->ent, cap * sizeof(struct queue_ent));
+    if (ent == NULL) {
+        return -1;
+    }
+    q->ent = ent;
+    q->cap = cap;
+    return 0;
+}
+
+/* Does @a leave the queue before @b */
+static int ent_before(const struct queue_ent *a, const struct queue_ent *b) {
+    if (a->priority != b->priority) {
+        return a->priority > b->priority;
+    }
+    return a->seq < b->seq;
+}
+
 void enqueue(struct queue_t *q, struct pcb_t *proc) {
-    if (q == NULL ||proc == NULL|| q->size >= MAX_QUEUE_SIZE) {
+    if (q == NULL || proc == NULL || queue_reserve(q) != 0) {
         return;
     }
 
-    int i = q->size - 1;
-    while (i >= 0 && q->proc[i]->priority < proc->priority) {
-        q->proc[i + 1] = q->proc[i];
-        i--;
-    }
+    struct queue_ent e = { proc, proc->priority, q->seq++ };
+    int i = q->size++;
 
-    q->proc[i + 1] = proc;
-    q->size++;
+    /* Sift up from the new leaf */
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!ent_before(&e, &q->ent[parent])) {
+            break;
+        }
+        q->ent[i] = q->ent[parent];
+        i = parent;
+    }
+    q->ent[i] = e;
 }
 
 struct pcb_t *dequeue(struct queue_t *q) {
     if (q == NULL || q->size == 0) {
         return NULL;
     }
-    if (q->proc[0] == NULL) {
-        for (int i = 0; i < q->size - 1; i++) {
-            q->proc[i] = q->proc[i + 1];
+
+    struct pcb_t *highest_priority_proc = q->ent[0].proc;
+    struct queue_ent last = q->ent[--q->size];
+    int i = 0;
+
+    /* Sift the last leaf down from the root */
+    while (2 * i + 1 < q->size) {
+        int child = 2 * i + 1;
+        if (child + 1 < q->size && ent_before(&q->ent[child + 1], &q->ent[child])) {
+            child++;
         }
-        q->size--;
-        return NULL;
+        if (!ent_before(&q->ent[child], &last)) {
+            break;
+        }
+        q->ent[i] = q->ent[child];
+        i = child;
     }
-    
-    struct pcb_t *highest_priority_proc = q->proc[0];
-    for (int i = 0; i < q->size - 1; i++) {
-        q->proc[i] = q->proc[i + 1];
+    if (q->size > 0) {
+        q->ent[i] = last;
     }
-    q->proc[q->size - 1] = NULL;
-    
-    q->size--;
     return highest_priority_proc;
 }
 
+void queue_free(struct queue_t *q) {
+    free(q->ent);
+    q->ent = NULL;
+    q->size = q->cap = 0;
+}
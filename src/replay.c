@@ -0,0 +1,271 @@
+
+#include "replay.h"
+#include "timer.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#ifdef SIM_REPLAY
+
+#define REPLAY_NEST 8 /* events taken inside another one */
+
+int replay_mode;
+
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t replay_cond = PTHREAD_COND_INITIALIZER;
+static FILE * replay_file;
+static struct replay_rec * recs;
+static unsigned long nr_recs, cap_recs;
+static unsigned long base;   /* events written before recs[0] */
+static unsigned long cursor; /* next event in play */
+static int open_recs;        /* recorded events not left yet */
+static int diverged;
+
+static __thread int my_dev = REPLAY_DEV_OTHER;
+static __thread unsigned long my_open[REPLAY_NEST];
+static __thread int my_depth;
+
+static const char * replay_name[] = {
+	[REPLAY_ADD] = "add",
+	[REPLAY_GET] = "get",
+	[REPLAY_PUT] = "put",
+	[REPLAY_FRAME_GET] = "frame_get",
+	[REPLAY_FRAME_PUT] = "frame_put",
+	[REPLAY_RECLAIM] = "reclaim",
+	[REPLAY_DONE] = "done",
+	[REPLAY_MM] = "mm",
+	[REPLAY_TRYLOCK] = "trylock",
+	[REPLAY_KILL] = "kill",
+};
+
+/* Stop the replay and let every thread go its own way, caller holds replay_lock */
+static void replay_diverge(const char * why, unsigned long n, int dev, int kind) {
+	log_printf(LOG_ERR, "replay: diverged at event %lu: %s (device %d, %s, slot %lu)\n",
+		n, why, dev, replay_name[kind], current_time());
+	diverged = 1;
+	__atomic_store_n(&replay_mode, 0, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&replay_cond);
+}
+
+static void replay_deadline(struct timespec * ts) {
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += REPLAY_WAIT_S;
+}
+
+/*
+ * replay_bind - events of this thread belong to device @dev
+ */
+void replay_bind(int dev) {
+	my_dev = dev;
+}
+
+/*
+ * replay_enter - in replay, wait until the next event is one of this thread
+ */
+void replay_enter(int kind) {
+	struct timespec ts;
+	unsigned long seen;
+	struct replay_rec * r;
+
+	pthread_mutex_lock(&replay_lock);
+	if (replay_mode != REPLAY_PLAY)
+		goto out;
+	seen = cursor;
+	replay_deadline(&ts);
+	while (replay_mode == REPLAY_PLAY && cursor < nr_recs
+			&& recs[cursor].dev != my_dev) {
+		if (pthread_cond_timedwait(&replay_cond, &replay_lock, &ts) == ETIMEDOUT
+				&& cursor == seen) {
+			char why[48];
+			snprintf(why, sizeof(why), "device %d never came", recs[cursor].dev);
+			replay_diverge(why, cursor, my_dev, kind);
+			goto out;
+		}
+		if (cursor != seen) {
+			seen = cursor;
+			replay_deadline(&ts);
+		}
+	}
+	if (replay_mode != REPLAY_PLAY)
+		goto out;
+	if (cursor == nr_recs) {
+		replay_diverge("past the end of the recording", cursor, my_dev, kind);
+		goto out;
+	}
+	r = &recs[cursor];
+	if (r->kind != kind)
+		replay_diverge(replay_name[r->kind], cursor, my_dev, kind);
+	else if (r->slot != (uint32_t)current_time())
+		replay_diverge("other time slot", cursor, my_dev, kind);
+out:
+	pthread_mutex_unlock(&replay_lock);
+}
+
+/*
+ * replay_locked - the lock of event @kind is taken: append it to the
+ * recording, or pass the turn on in replay
+ */
+void replay_locked(int kind) {
+	unsigned long n;
+
+	pthread_mutex_lock(&replay_lock);
+	if (replay_mode == REPLAY_RECORD) {
+		if (nr_recs == cap_recs) {
+			cap_recs = cap_recs ? cap_recs * 2 : REPLAY_FLUSH;
+			recs = realloc(recs, cap_recs * sizeof(struct replay_rec));
+		}
+		n = nr_recs++;
+		recs[n].slot = current_time();
+		recs[n].arg = 0;
+		recs[n].dev = my_dev;
+		recs[n].kind = kind;
+		recs[n].pad = 0;
+		open_recs++;
+	} else if (replay_mode == REPLAY_PLAY) {
+		n = cursor++;
+		pthread_cond_broadcast(&replay_cond);
+	} else {
+		goto out;
+	}
+	if (my_depth < REPLAY_NEST)
+		my_open[my_depth] = n;
+	my_depth++;
+out:
+	pthread_mutex_unlock(&replay_lock);
+}
+
+/*
+ * replay_leave - event @kind ends with outcome @arg: store it, or check it
+ */
+void replay_leave(int kind, long arg) {
+	unsigned long n;
+
+	pthread_mutex_lock(&replay_lock);
+	if (my_depth == 0 || my_depth > REPLAY_NEST)
+		goto out;
+	n = my_open[--my_depth];
+	if (replay_mode == REPLAY_RECORD) {
+		recs[n].arg = (uint32_t)arg;
+		/* Nothing refers to the buffer once every event is left */
+		if (--open_recs == 0 && nr_recs >= REPLAY_FLUSH) {
+			fwrite(recs, sizeof(struct replay_rec), nr_recs, replay_file);
+			base += nr_recs;
+			nr_recs = 0;
+		}
+	} else if (replay_mode == REPLAY_PLAY && recs[n].arg != (uint32_t)arg) {
+		replay_diverge("other outcome", n, my_dev, kind);
+	}
+out:
+	pthread_mutex_unlock(&replay_lock);
+}
+
+/*
+ * replay_trylock - try @m, in replay take it only if the recording did
+ * Every taker of the lock is ordered, so a holder that released it in the
+ * recording has no event left before it releases it now.
+ */
+int replay_trylock(pthread_mutex_t * m) {
+	int want = -1, got;
+
+	replay_enter(REPLAY_TRYLOCK);
+	pthread_mutex_lock(&replay_lock);
+	if (replay_mode == REPLAY_PLAY && cursor < nr_recs)
+		want = recs[cursor].arg;
+	pthread_mutex_unlock(&replay_lock);
+
+	if (want == 1) {
+		/* Still tried, blocking would invert the order of the caller */
+		while (pthread_mutex_trylock(m) != 0)
+			sched_yield();
+		got = 1;
+	} else {
+		got = pthread_mutex_trylock(m) == 0;
+		if (got && want == 0) {
+			pthread_mutex_unlock(m);
+			got = 0;
+		}
+	}
+	replay_locked(REPLAY_TRYLOCK);
+	replay_leave(REPLAY_TRYLOCK, got);
+	return got;
+}
+
+/*
+ * replay_record - record the events of this run into @path
+ */
+int replay_record(const char * path) {
+	uint32_t version = REPLAY_VERSION;
+
+	if ((replay_file = fopen(path, "wb")) == NULL) {
+		log_printf(LOG_ERR, "Cannot write recording to %s\n", path);
+		return -1;
+	}
+	fwrite(REPLAY_MAGIC, 1, 4, replay_file);
+	fwrite(&version, sizeof(version), 1, replay_file);
+	replay_mode = REPLAY_RECORD;
+	return 0;
+}
+
+/*
+ * replay_play - load the recording @path and replay it in this run
+ */
+int replay_play(const char * path) {
+	FILE * f;
+	char magic[4];
+	uint32_t version;
+	long size;
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		log_printf(LOG_ERR, "Cannot read recording %s\n", path);
+		return -1;
+	}
+	if (fread(magic, 1, 4, f) != 4 || memcmp(magic, REPLAY_MAGIC, 4) != 0
+			|| fread(&version, sizeof(version), 1, f) != 1
+			|| version != REPLAY_VERSION) {
+		log_printf(LOG_ERR, "%s is not a recording of this version\n", path);
+		fclose(f);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f) - 4 - (long)sizeof(version);
+	fseek(f, 4 + sizeof(version), SEEK_SET);
+	cap_recs = size / sizeof(struct replay_rec);
+	recs = malloc((cap_recs ? cap_recs : 1) * sizeof(struct replay_rec));
+	nr_recs = fread(recs, sizeof(struct replay_rec), cap_recs, f);
+	fclose(f);
+	replay_mode = REPLAY_PLAY;
+	return 0;
+}
+
+/*
+ * replay_stop - finish the recording or the replay
+ * Called once the threads have stopped. Return -1 if the replay diverged.
+ */
+int replay_stop(void) {
+	int mode = replay_mode;
+
+	__atomic_store_n(&replay_mode, 0, __ATOMIC_RELEASE);
+	if (replay_file != NULL) {
+		fwrite(recs, sizeof(struct replay_rec), nr_recs, replay_file);
+		fclose(replay_file);
+		replay_file = NULL;
+		log_printf(LOG_STATS, "replay: recorded %lu events\n", base + nr_recs);
+	} else if (mode == REPLAY_PLAY && cursor < nr_recs) {
+		log_printf(LOG_ERR, "replay: diverged, run ended after %lu of %lu events\n",
+			cursor, nr_recs);
+		diverged = 1;
+	} else if (mode == REPLAY_PLAY || diverged) {
+		log_printf(LOG_STATS, "replay: %lu of %lu events replayed\n", cursor, nr_recs);
+	}
+	free(recs);
+	recs = NULL;
+	nr_recs = cap_recs = 0;
+	return diverged ? -1 : 0;
+}
+
+#endif
@@ -1,42 +1,52 @@
 
 #include "queue.h"
 #include "sched.h"
+#include "replay.h"
+#include "sim.h"
 #include <pthread.h>
 
 #include <stdlib.h>
 #include <stdio.h>
-static struct queue_t ready_queue;
-static struct queue_t run_queue;
-static pthread_mutex_t queue_lock;
-
-
-#ifdef MLQ_SCHED
-static struct queue_t mlq_ready_queue[MAX_PRIO];
-static int slot[MAX_PRIO];
-#endif
 
 int queue_empty(void) {
+	struct sim *s = cur_sim;
 #ifdef MLQ_SCHED
 	unsigned long prio;
 	for (prio = 0; prio < MAX_PRIO; prio++)
-		if(!empty(&mlq_ready_queue[prio])) 
+		if(!empty(&s->mlq_ready_queue[prio])) 
 			return -1;
 #endif
-	return (empty(&ready_queue) && empty(&run_queue));
+	return (empty(&s->ready_queue) && empty(&s->run_queue));
 }
 
 void init_scheduler(void) {
+	struct sim *s = cur_sim;
 #ifdef MLQ_SCHED
     int i ;
 
 	for (i = 0; i < MAX_PRIO; i ++) {
-		mlq_ready_queue[i].size = 0;
-		slot[i] = MAX_PRIO - i; 
+		s->mlq_ready_queue[i].size = 0;
+		s->slot[i] = MAX_PRIO - i; 
 	}
 #endif
-	ready_queue.size = 0;
-	run_queue.size = 0;
-	pthread_mutex_init(&queue_lock, NULL);
+	s->ready_queue.size = 0;
+	s->run_queue.size = 0;
+	pthread_mutex_init(&s->queue_lock, NULL);
+}
+
+void sched_queue_depths(int depth[MAX_PRIO]) {
+	struct sim *s = cur_sim;
+	int prio;
+
+	pthread_mutex_lock(&s->queue_lock);
+	for (prio = 0; prio < MAX_PRIO; prio++) {
+#ifdef MLQ_SCHED
+		depth[prio] = s->mlq_ready_queue[prio].size;
+#else
+		depth[prio] = prio == 0 ? s->ready_queue.size : 0;
+#endif
+	}
+	pthread_mutex_unlock(&s->queue_lock);
 }
 
 #ifdef MLQ_SCHED
@@ -47,19 +57,20 @@ void init_scheduler(void) {
  *  State representation   prio = 0 .. MAX_PRIO, curr_slot = 0..(MAX_PRIO - prio)
  */
 struct pcb_t *get_mlq_proc(void) {
+    struct sim *s = cur_sim;
     struct pcb_t *proc = NULL;
     /*
      * TODO: Gatekeeper
      * Iterate through priorities from high to low
      */
-    pthread_mutex_lock(&queue_lock);
+    REPLAY_LOCK(REPLAY_GET, &s->queue_lock);
     
     for (int i = 0; i < MAX_PRIO; i++) {
-        if (mlq_ready_queue[i].size > 0) {
+        if (s->mlq_ready_queue[i].size > 0) {
             /* Check if the current priority has slots left */
-            if (slot[i] > 0) {
-                proc = dequeue(&mlq_ready_queue[i]);
-                slot[i]--;
+            if (s->slot[i] > 0) {
+                proc = dequeue(&s->mlq_ready_queue[i]);
+                s->slot[i]--;
                 break;
             } else {
                 /* Slot expired, reset slot and move to next priority or rotate? 
@@ -71,28 +82,32 @@ struct pcb_t *get_mlq_proc(void) {
                  * Let's assume: Reset slot when queue becomes empty or we switch.
                  * Actually, standard MLQ: High prio always wins. Slot is for Round Robin WITHIN same prio.
                  */
-                 slot[i] = MAX_PRIO - i; // Reset slot
-                 proc = dequeue(&mlq_ready_queue[i]);
-                 slot[i]--;
+                 s->slot[i] = MAX_PRIO - i; // Reset slot
+                 proc = dequeue(&s->mlq_ready_queue[i]);
+                 s->slot[i]--;
                  break;
             }
         }
     }
     
-    pthread_mutex_unlock(&queue_lock);
+    REPLAY_UNLOCK(REPLAY_GET, proc ? proc->pid : 0, &s->queue_lock);
     return proc;
 }
 
 void put_mlq_proc(struct pcb_t * proc) {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
-	pthread_mutex_unlock(&queue_lock);
+	struct sim *s = cur_sim;
+
+	REPLAY_LOCK(REPLAY_PUT, &s->queue_lock);
+	enqueue(&s->mlq_ready_queue[proc->prio], proc);
+	REPLAY_UNLOCK(REPLAY_PUT, proc->pid, &s->queue_lock);
 }
 
 void add_mlq_proc(struct pcb_t * proc) {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
-	pthread_mutex_unlock(&queue_lock);	
+	struct sim *s = cur_sim;
+
+	REPLAY_LOCK(REPLAY_ADD, &s->queue_lock);
+	enqueue(&s->mlq_ready_queue[proc->prio], proc);
+	REPLAY_UNLOCK(REPLAY_ADD, proc->pid, &s->queue_lock);
 }
 
 struct pcb_t * get_proc(void) {
@@ -108,34 +123,39 @@ void add_proc(struct pcb_t *proc) {
 }
 #else
 struct pcb_t * get_proc(void) {
+    struct sim *s = cur_sim;
     struct pcb_t *proc = NULL;
-    pthread_mutex_lock(&queue_lock);
-    if (ready_queue.size > 0) {
-        proc = dequeue(&ready_queue);
+    pthread_mutex_lock(&s->queue_lock);
+    if (s->ready_queue.size > 0) {
+        proc = dequeue(&s->ready_queue);
     }
-    pthread_mutex_unlock(&queue_lock);
+    pthread_mutex_unlock(&s->queue_lock);
     return proc;
 }
 
 
 void put_proc(struct pcb_t * proc) {
-    proc->ready_queue = &ready_queue;
+    struct sim *s = cur_sim;
+
+    proc->ready_queue = &s->ready_queue;
     proc->running_list = &running_list;
 
-    pthread_mutex_lock(&queue_lock);
-    enqueue(&run_queue, proc);
+    pthread_mutex_lock(&s->queue_lock);
+    enqueue(&s->run_queue, proc);
     enqueue(&running_list, proc);
-    pthread_mutex_unlock(&queue_lock);
+    pthread_mutex_unlock(&s->queue_lock);
 }
 
 void add_proc(struct pcb_t * proc) {
-    proc->ready_queue = &ready_queue;
+    struct sim *s = cur_sim;
+
+    proc->ready_queue = &s->ready_queue;
     proc->running_list = &running_list;
 
-    pthread_mutex_lock(&queue_lock);
-    enqueue(&ready_queue, proc);
+    pthread_mutex_lock(&s->queue_lock);
+    enqueue(&s->ready_queue, proc);
     enqueue(&running_list, proc);
-    pthread_mutex_unlock(&queue_lock);    
+    pthread_mutex_unlock(&s->queue_lock);    
 }
 
 
@@ -0,0 +1,49 @@
+
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+__thread struct sim * cur_sim;
+
+/*
+ * sim_new - an empty simulation named @name, the config is read by the caller
+ */
+struct sim * sim_new(const char * name) {
+	struct sim * sim = calloc(1, sizeof(struct sim));
+
+	snprintf(sim->name, sizeof(sim->name), "%s", name);
+	sim->avail_pid = 1;
+	pthread_mutex_init(&sim->done_lock, NULL);
+	pthread_mutex_init(&sim->reclaim_list_lock, NULL);
+	return sim;
+}
+
+void sim_free(struct sim * sim) {
+	int i;
+
+	if (sim == NULL)
+		return;
+	for (i = 0; sim->path != NULL && i < sim->num_processes; i++)
+		free(sim->path[i]);
+	free(sim->path);
+	free(sim->start_time);
+	free(sim->prio);
+	queue_free(&sim->ready_queue);
+	queue_free(&sim->run_queue);
+#ifdef MLQ_SCHED
+	for (i = 0; i < MAX_PRIO; i++)
+		queue_free(&sim->mlq_ready_queue[i]);
+#endif
+	pthread_mutex_destroy(&sim->done_lock);
+	pthread_mutex_destroy(&sim->queue_lock);
+	pthread_mutex_destroy(&sim->reclaim_list_lock);
+	free(sim);
+}
+
+/*
+ * sim_bind - this thread works for @sim from now on
+ */
+void sim_bind(struct sim * sim) {
+	cur_sim = sim;
+}
@@ -0,0 +1,551 @@
+
+#include "stats.h"
+#include "sched.h"
+#include "mm.h"
+#include "log.h"
+#include "timer.h"
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef SIM_STATS
+
+/* Counters sampled every interval slots */
+struct stats_sample {
+	uint64_t slot;
+	int free_frames;
+	int ready;
+	uint64_t instructions;
+	uint64_t context_switches;
+	uint64_t page_faults;
+	uint64_t swap_ins;
+	uint64_t swap_outs;
+};
+
+static const char * opcode_name[STATS_NR_OPCODES] = {
+	"calc", "alloc", "free", "read", "write", "syscall",
+	"readn", "writen", "mmap", "allocv", "readv", "writev",
+};
+
+/* Latency metrics, in time slots except slowdown which is x100 */
+enum { LAT_WAITING, LAT_RESPONSE, LAT_TURNAROUND, LAT_SLOWDOWN, LAT_NR };
+
+static const char * lat_name[LAT_NR] = {
+	"waiting", "response", "turnaround", "slowdown",
+};
+
+struct lat_hist {
+	uint64_t count;
+	uint64_t max;
+	uint64_t bucket[LAT_BUCKETS];
+};
+
+/* One set per priority, allocated at the first finished process */
+struct lat_prio {
+	uint64_t procs;
+	struct lat_hist hist[LAT_NR];
+};
+
+/* Counters of one simulation, cur_sim->stats */
+struct stats_run {
+	struct stats_cpu * list;
+	pthread_mutex_t lock;
+
+	struct memphy_struct * mram;
+	int interval;
+	uint64_t slots;
+	int free_min;
+
+	/* Ready queue depth per priority, summed over the slots for the mean */
+	uint64_t depth_sum[MAX_PRIO];
+	int depth_max[MAX_PRIO];
+
+	struct stats_sample * samples;
+	int nr_samples, cap_samples;
+
+	struct lat_prio * lat[MAX_PRIO];
+	struct lat_prio lat_all;
+	pthread_mutex_t lat_lock;
+};
+
+static __thread struct stats_cpu * stats_self;
+
+/*
+ * The counters of the simulation of the calling thread. They are made by
+ * stats_start, before the simulation starts its threads.
+ */
+static struct stats_run * stats_cur(void) {
+	struct stats_run * st = cur_sim->stats;
+
+	if (st == NULL) {
+		st = calloc(1, sizeof(struct stats_run));
+		st->free_min = -1;
+		pthread_mutex_init(&st->lock, NULL);
+		pthread_mutex_init(&st->lat_lock, NULL);
+		cur_sim->stats = st;
+	}
+	return st;
+}
+
+struct stats_cpu * stats_get(void) {
+	if (stats_self == NULL) {
+		struct stats_run * st = stats_cur();
+		struct stats_cpu * s = aligned_alloc(64, sizeof(struct stats_cpu));
+
+		memset(s, 0, sizeof(*s));
+		s->cpu = -1;
+		pthread_mutex_lock(&st->lock);
+		s->next = st->list;
+		st->list = s;
+		pthread_mutex_unlock(&st->lock);
+		stats_self = s;
+	}
+	return stats_self;
+}
+
+/*
+ * stats_bind_cpu - report the counters of this thread as CPU @id
+ */
+void stats_bind_cpu(int id) {
+	stats_get()->cpu = id;
+}
+
+/*
+ * stats_start - set what the per slot sampling looks at
+ * @mram    : RAM device for the free frame counts, or NULL
+ * @interval: record a time series sample every @interval slots, 0 for none
+ */
+void stats_start(struct memphy_struct * mram, int interval) {
+	struct stats_run * st = stats_cur();
+
+	/* A thread that ran an earlier simulation counts anew */
+	stats_self = NULL;
+	st->mram = mram;
+	st->interval = interval;
+}
+
+/*
+ * stats_stop - release the counters of the simulation once it is written
+ */
+void stats_stop(void) {
+	struct stats_run * st = cur_sim->stats;
+	struct stats_cpu * s;
+
+	if (st == NULL)
+		return;
+	while ((s = st->list) != NULL) {
+		st->list = s->next;
+		free(s);
+	}
+	for (int p = 0; p < MAX_PRIO; p++)
+		free(st->lat[p]);
+	free(st->samples);
+	pthread_mutex_destroy(&st->lock);
+	pthread_mutex_destroy(&st->lat_lock);
+	free(st);
+	cur_sim->stats = NULL;
+	stats_self = NULL;
+}
+
+/* Add the counters of @s into @sum */
+static void stats_merge(struct stats_cpu * sum, struct stats_cpu * s) {
+	int i;
+
+	for (i = 0; i < STATS_NR_OPCODES; i++)
+		sum->insn[i] += __atomic_load_n(&s->insn[i], __ATOMIC_RELAXED);
+	for (i = 0; i < STATS_NR_SYSCALLS; i++)
+		sum->syscalls[i] += __atomic_load_n(&s->syscalls[i], __ATOMIC_RELAXED);
+	sum->dispatches += __atomic_load_n(&s->dispatches, __ATOMIC_RELAXED);
+	sum->context_switches += __atomic_load_n(&s->context_switches, __ATOMIC_RELAXED);
+	sum->idle_slots += __atomic_load_n(&s->idle_slots, __ATOMIC_RELAXED);
+	sum->page_faults += __atomic_load_n(&s->page_faults, __ATOMIC_RELAXED);
+	sum->swap_ins += __atomic_load_n(&s->swap_ins, __ATOMIC_RELAXED);
+	sum->swap_outs += __atomic_load_n(&s->swap_outs, __ATOMIC_RELAXED);
+}
+
+static uint64_t insn_total(struct stats_cpu * s) {
+	uint64_t n = 0;
+
+	for (int i = 0; i < STATS_NR_OPCODES; i++)
+		n += s->insn[i];
+	return n;
+}
+
+/*
+ * stats_tick - sample the queues and RAM at the end of a time slot
+ * Called by the timer while every device waits for the next slot.
+ */
+void stats_tick(uint64_t slot) {
+	struct stats_run * st = stats_cur();
+	int depth[MAX_PRIO];
+	int ready = 0, nfree = 0, i;
+
+	sched_queue_depths(depth);
+	for (i = 0; i < MAX_PRIO; i++) {
+		st->depth_sum[i] += depth[i];
+		if (depth[i] > st->depth_max[i])
+			st->depth_max[i] = depth[i];
+		ready += depth[i];
+	}
+	if (st->mram != NULL) {
+		nfree = __atomic_load_n(&st->mram->free_fp_cnt, __ATOMIC_RELAXED);
+		if (st->free_min < 0 || nfree < st->free_min)
+			st->free_min = nfree;
+	}
+	st->slots = slot + 1;
+
+	if (st->interval <= 0 || slot % st->interval != 0)
+		return;
+
+	struct stats_cpu sum;
+	struct stats_cpu * s;
+
+	memset(&sum, 0, sizeof(sum));
+	pthread_mutex_lock(&st->lock);
+	for (s = st->list; s != NULL; s = s->next)
+		stats_merge(&sum, s);
+	pthread_mutex_unlock(&st->lock);
+
+	if (st->nr_samples == st->cap_samples) {
+		st->cap_samples = st->cap_samples ? st->cap_samples * 2 : 64;
+		st->samples = realloc(st->samples, st->cap_samples * sizeof(struct stats_sample));
+	}
+	st->samples[st->nr_samples++] = (struct stats_sample) {
+		.slot = slot,
+		.free_frames = nfree,
+		.ready = ready,
+		.instructions = insn_total(&sum),
+		.context_switches = sum.context_switches,
+		.page_faults = sum.page_faults,
+		.swap_ins = sum.swap_ins,
+		.swap_outs = sum.swap_outs,
+	};
+}
+
+static int lat_bucket(uint64_t v) {
+	int e;
+
+	if (v < LAT_LINEAR)
+		return (int)v;
+	e = 63 - __builtin_clzll(v);
+	return LAT_LINEAR + ((e - LAT_SUB_BITS - 1) << LAT_SUB_BITS) +
+		(int)((v >> (e - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+}
+
+/* Largest value that falls in bucket @idx */
+static uint64_t lat_bucket_max(int idx) {
+	int e, sub;
+
+	if (idx < LAT_LINEAR)
+		return idx;
+	e = (idx - LAT_LINEAR) / (1 << LAT_SUB_BITS) + LAT_SUB_BITS + 1;
+	sub = (idx - LAT_LINEAR) % (1 << LAT_SUB_BITS);
+	return ((uint64_t)((1 << LAT_SUB_BITS) + sub + 1) << (e - LAT_SUB_BITS)) - 1;
+}
+
+static void lat_record(struct lat_hist * h, uint64_t v) {
+	h->count++;
+	h->bucket[lat_bucket(v)]++;
+	if (v > h->max)
+		h->max = v;
+}
+
+/* Value below which @pct percent of the samples are */
+static uint64_t lat_percentile(struct lat_hist * h, double pct) {
+	uint64_t want, seen = 0;
+	int i;
+
+	if (h->count == 0)
+		return 0;
+	want = (uint64_t)(pct / 100.0 * h->count + 0.5);
+	if (want < 1)
+		want = 1;
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= want)
+			break;
+	}
+	return lat_bucket_max(i) < h->max ? lat_bucket_max(i) : h->max;
+}
+
+void stats_proc_arrive(struct pcb_t * proc) {
+	proc->t_arrival = proc->t_ready = current_time();
+	proc->t_first_run = -1;
+	proc->t_waiting = 0;
+}
+
+void stats_proc_dispatch(struct pcb_t * proc) {
+	uint64_t now = current_time();
+
+	proc->t_waiting += now - proc->t_ready;
+	if (proc->t_first_run < 0)
+		proc->t_first_run = now;
+}
+
+void stats_proc_preempt(struct pcb_t * proc) {
+	proc->t_ready = current_time();
+}
+
+/*
+ * stats_proc_finish - add a finished process to the histograms
+ * One instruction runs per slot, so the service time is the code size.
+ */
+void stats_proc_finish(struct pcb_t * proc) {
+	struct stats_run * st = stats_cur();
+	uint64_t turnaround = current_time() - proc->t_arrival;
+	uint64_t v[LAT_NR];
+#ifdef MLQ_SCHED
+	int prio = proc->prio;
+#else
+	int prio = proc->priority;
+#endif
+
+	if (prio < 0 || prio >= MAX_PRIO)
+		prio = MAX_PRIO - 1;
+	v[LAT_WAITING] = proc->t_waiting;
+	v[LAT_RESPONSE] = proc->t_first_run - proc->t_arrival;
+	v[LAT_TURNAROUND] = turnaround;
+	v[LAT_SLOWDOWN] = turnaround * 100 / (proc->code->size ? proc->code->size : 1);
+
+	pthread_mutex_lock(&st->lat_lock);
+	if (st->lat[prio] == NULL)
+		st->lat[prio] = calloc(1, sizeof(struct lat_prio));
+	st->lat[prio]->procs++;
+	st->lat_all.procs++;
+	for (int m = 0; m < LAT_NR; m++) {
+		lat_record(&st->lat[prio]->hist[m], v[m]);
+		lat_record(&st->lat_all.hist[m], v[m]);
+	}
+	pthread_mutex_unlock(&st->lat_lock);
+}
+
+static void lat_print(const char * label, struct lat_prio * l) {
+	char procs[24];
+
+	snprintf(procs, sizeof(procs), "%lu", (unsigned long)l->procs);
+	for (int m = 0; m < LAT_NR; m++) {
+		struct lat_hist * h = &l->hist[m];
+		double div = m == LAT_SLOWDOWN ? 100.0 : 1.0;
+
+		log_printf(LOG_STATS, "%5s %6s %-11s %8.2f %8.2f %8.2f %8.2f\n",
+			m == 0 ? label : "", m == 0 ? procs : "", lat_name[m],
+			lat_percentile(h, 50) / div, lat_percentile(h, 95) / div,
+			lat_percentile(h, 99) / div, h->max / div);
+	}
+}
+
+/*
+ * stats_print_latency - print p50/p95/p99/max of every priority class
+ */
+void stats_print_latency(void) {
+	struct stats_run * st = stats_cur();
+	char label[8];
+
+	if (st->lat_all.procs == 0)
+		return;
+	log_printf(LOG_STATS, "===== PROCESS LATENCY (time slots) =====\n");
+	log_printf(LOG_STATS, "%5s %6s %-11s %8s %8s %8s %8s\n",
+		"prio", "procs", "metric", "p50", "p95", "p99", "max");
+	for (int p = 0; p < MAX_PRIO; p++) {
+		if (st->lat[p] == NULL)
+			continue;
+		snprintf(label, sizeof(label), "%d", p);
+		lat_print(label, st->lat[p]);
+	}
+	lat_print("all", &st->lat_all);
+	log_printf(LOG_STATS, "================================================================\n");
+}
+
+static void json_latency(FILE * f, struct lat_prio * l) {
+	fprintf(f, "\"procs\": %lu", (unsigned long)l->procs);
+	for (int m = 0; m < LAT_NR; m++) {
+		struct lat_hist * h = &l->hist[m];
+		double div = m == LAT_SLOWDOWN ? 100.0 : 1.0;
+
+		fprintf(f, ", \"%s\": {\"p50\": %.2f, \"p95\": %.2f, \"p99\": %.2f, \"max\": %.2f}",
+			lat_name[m], lat_percentile(h, 50) / div, lat_percentile(h, 95) / div,
+			lat_percentile(h, 99) / div, h->max / div);
+	}
+}
+
+static void csv_latency(FILE * f, const char * scope, struct lat_prio * l) {
+	fprintf(f, "%s,procs,%lu\n", scope, (unsigned long)l->procs);
+	for (int m = 0; m < LAT_NR; m++) {
+		struct lat_hist * h = &l->hist[m];
+		double div = m == LAT_SLOWDOWN ? 100.0 : 1.0;
+
+		fprintf(f, "%s,%s_p50,%.2f\n", scope, lat_name[m], lat_percentile(h, 50) / div);
+		fprintf(f, "%s,%s_p95,%.2f\n", scope, lat_name[m], lat_percentile(h, 95) / div);
+		fprintf(f, "%s,%s_p99,%.2f\n", scope, lat_name[m], lat_percentile(h, 99) / div);
+		fprintf(f, "%s,%s_max,%.2f\n", scope, lat_name[m], h->max / div);
+	}
+}
+
+static void json_counters(FILE * f, struct stats_cpu * s) {
+	int i, first = 1;
+
+	fprintf(f, "\"instructions\": {");
+	for (i = 0; i < STATS_NR_OPCODES; i++)
+		fprintf(f, "%s\"%s\": %lu", i ? ", " : "", opcode_name[i],
+			(unsigned long)s->insn[i]);
+	fprintf(f, "}, \"dispatches\": %lu, \"context_switches\": %lu, "
+		"\"idle_slots\": %lu, \"page_faults\": %lu, "
+		"\"swap_ins\": %lu, \"swap_outs\": %lu, \"syscalls\": {",
+		(unsigned long)s->dispatches, (unsigned long)s->context_switches,
+		(unsigned long)s->idle_slots, (unsigned long)s->page_faults,
+		(unsigned long)s->swap_ins, (unsigned long)s->swap_outs);
+	for (i = 0; i < STATS_NR_SYSCALLS; i++) {
+		if (s->syscalls[i] == 0)
+			continue;
+		fprintf(f, "%s\"%d\": %lu", first ? "" : ", ", i,
+			(unsigned long)s->syscalls[i]);
+		first = 0;
+	}
+	fprintf(f, "}");
+}
+
+static void csv_counters(FILE * f, const char * scope, struct stats_cpu * s) {
+	int i;
+
+	for (i = 0; i < STATS_NR_OPCODES; i++)
+		fprintf(f, "%s,insn_%s,%lu\n", scope, opcode_name[i], (unsigned long)s->insn[i]);
+	fprintf(f, "%s,dispatches,%lu\n", scope, (unsigned long)s->dispatches);
+	fprintf(f, "%s,context_switches,%lu\n", scope, (unsigned long)s->context_switches);
+	fprintf(f, "%s,idle_slots,%lu\n", scope, (unsigned long)s->idle_slots);
+	fprintf(f, "%s,page_faults,%lu\n", scope, (unsigned long)s->page_faults);
+	fprintf(f, "%s,swap_ins,%lu\n", scope, (unsigned long)s->swap_ins);
+	fprintf(f, "%s,swap_outs,%lu\n", scope, (unsigned long)s->swap_outs);
+	for (i = 0; i < STATS_NR_SYSCALLS; i++)
+		if (s->syscalls[i] != 0)
+			fprintf(f, "%s,syscall_%d,%lu\n", scope, i, (unsigned long)s->syscalls[i]);
+}
+
+/*
+ * stats_write - write <prefix>.stats.json, <prefix>.stats.csv and, when
+ * sampling, <prefix>.samples.csv. Called once every thread has stopped.
+ */
+int stats_write(const char * prefix) {
+	struct stats_run * st = stats_cur();
+	struct stats_cpu total, other, * cpus, * s;
+	int ncpu = 0, n, i, frames = 0;
+	char path[256];
+	FILE * json, * csv;
+
+	memset(&total, 0, sizeof(total));
+	memset(&other, 0, sizeof(other));
+	for (s = st->list; s != NULL; s = s->next)
+		if (s->cpu + 1 > ncpu)
+			ncpu = s->cpu + 1;
+	cpus = calloc(ncpu > 0 ? ncpu : 1, sizeof(struct stats_cpu));
+	for (s = st->list; s != NULL; s = s->next) {
+		stats_merge(s->cpu >= 0 ? &cpus[s->cpu] : &other, s);
+		stats_merge(&total, s);
+	}
+	if (st->mram != NULL)
+		frames = st->mram->maxsz / PAGING_PAGESZ;
+
+	snprintf(path, sizeof(path), "%s.stats.json", prefix);
+	if ((json = fopen(path, "w")) == NULL) {
+		log_printf(LOG_ERR, "Cannot write stats to %s\n", path);
+		free(cpus);
+		return -1;
+	}
+	fprintf(json, "{\n  \"slots\": %lu,\n  \"cpus\": %d,\n", (unsigned long)st->slots, ncpu);
+	fprintf(json, "  \"per_cpu\": [\n");
+	for (i = 0; i < ncpu; i++) {
+		fprintf(json, "    {\"cpu\": %d, ", i);
+		json_counters(json, &cpus[i]);
+		fprintf(json, "}%s\n", i + 1 < ncpu ? "," : "");
+	}
+	fprintf(json, "  ],\n  \"other_threads\": {");
+	json_counters(json, &other);
+	fprintf(json, "},\n  \"total\": {");
+	json_counters(json, &total);
+	fprintf(json, "},\n  \"memory\": {\"frames\": %d, \"free_min\": %d, \"free_final\": %d, "
+		"\"used_peak\": %d},\n",
+		frames, st->free_min < 0 ? 0 : st->free_min,
+		st->mram != NULL ? __atomic_load_n(&st->mram->free_fp_cnt, __ATOMIC_RELAXED) : 0,
+		st->free_min < 0 ? 0 : frames - st->free_min);
+	fprintf(json, "  \"queues\": [");
+	for (i = 0, n = 0; i < MAX_PRIO; i++) {
+		if (st->depth_max[i] == 0)
+			continue;
+		fprintf(json, "%s\n    {\"prio\": %d, \"max\": %d, \"mean\": %.3f}", n++ ? "," : "",
+			i, st->depth_max[i], st->slots ? (double)st->depth_sum[i] / st->slots : 0.0);
+	}
+	fprintf(json, "\n  ],\n  \"latency\": [");
+	for (i = 0, n = 0; i < MAX_PRIO; i++) {
+		if (st->lat[i] == NULL)
+			continue;
+		fprintf(json, "%s\n    {\"prio\": %d, ", n++ ? "," : "", i);
+		json_latency(json, st->lat[i]);
+		fprintf(json, "}");
+	}
+	fprintf(json, "%s\n    {\"prio\": \"all\", ", n ? "," : "");
+	json_latency(json, &st->lat_all);
+	fprintf(json, "}\n  ],\n  \"samples\": [");
+	for (i = 0; i < st->nr_samples; i++)
+		fprintf(json, "%s\n    {\"slot\": %lu, \"free_frames\": %d, \"ready\": %d, "
+			"\"instructions\": %lu, \"context_switches\": %lu, \"page_faults\": %lu, "
+			"\"swap_ins\": %lu, \"swap_outs\": %lu}", i ? "," : "",
+			(unsigned long)st->samples[i].slot, st->samples[i].free_frames, st->samples[i].ready,
+			(unsigned long)st->samples[i].instructions, (unsigned long)st->samples[i].context_switches,
+			(unsigned long)st->samples[i].page_faults, (unsigned long)st->samples[i].swap_ins,
+			(unsigned long)st->samples[i].swap_outs);
+	fprintf(json, "\n  ]\n}\n");
+	fclose(json);
+
+	snprintf(path, sizeof(path), "%s.stats.csv", prefix);
+	if ((csv = fopen(path, "w")) != NULL) {
+		char scope[16];
+
+		fprintf(csv, "scope,counter,value\n");
+		fprintf(csv, "run,slots,%lu\n", (unsigned long)st->slots);
+		fprintf(csv, "memory,frames,%d\n", frames);
+		fprintf(csv, "memory,free_min,%d\n", st->free_min < 0 ? 0 : st->free_min);
+		for (i = 0; i < MAX_PRIO; i++) {
+			if (st->depth_max[i] == 0)
+				continue;
+			fprintf(csv, "queue,prio_%d_max,%d\n", i, st->depth_max[i]);
+			fprintf(csv, "queue,prio_%d_mean,%.3f\n", i, (double)st->depth_sum[i] / st->slots);
+		}
+		for (i = 0; i < MAX_PRIO; i++) {
+			if (st->lat[i] == NULL)
+				continue;
+			snprintf(scope, sizeof(scope), "prio%d", i);
+			csv_latency(csv, scope, st->lat[i]);
+		}
+		csv_latency(csv, "prio_all", &st->lat_all);
+		csv_counters(csv, "total", &total);
+		csv_counters(csv, "other", &other);
+		for (i = 0; i < ncpu; i++) {
+			snprintf(scope, sizeof(scope), "cpu%d", i);
+			csv_counters(csv, scope, &cpus[i]);
+		}
+		fclose(csv);
+	}
+
+	if (st->nr_samples > 0) {
+		snprintf(path, sizeof(path), "%s.samples.csv", prefix);
+		if ((csv = fopen(path, "w")) != NULL) {
+			fprintf(csv, "slot,free_frames,ready,instructions,context_switches,"
+				"page_faults,swap_ins,swap_outs\n");
+			for (i = 0; i < st->nr_samples; i++)
+				fprintf(csv, "%lu,%d,%d,%lu,%lu,%lu,%lu,%lu\n",
+					(unsigned long)st->samples[i].slot, st->samples[i].free_frames,
+					st->samples[i].ready, (unsigned long)st->samples[i].instructions,
+					(unsigned long)st->samples[i].context_switches,
+					(unsigned long)st->samples[i].page_faults,
+					(unsigned long)st->samples[i].swap_ins,
+					(unsigned long)st->samples[i].swap_outs);
+			fclose(csv);
+		}
+	}
+
+	free(cpus);
+	return 0;
+}
+
+#endif
@@ -2,73 +2,74 @@
 #include "syscall.h"
 #include "stdio.h"
 #include "libmem.h"
+#include "mm.h"
 #include "string.h"
 #include "queue.h"
 #include "pthread.h"
+#include "loader.h"
+#include "replay.h"
+#include "sim.h"
 #include <stdlib.h>
 
-pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Move the processes of @q loaded from @name to @dead, keep the others in order */
+static int kill_in_queue(struct queue_t *q, const char *name, struct queue_t *dead)
+{
+    struct pcb_t *proc;
+    int size = q->size, count = 0;
+
+    for (int j = 0; j < size; j++) {
+        proc = dequeue(q);
+        if (proc == NULL)
+            continue;
+        if (strcmp(proc->path, name) == 0) {
+            enqueue(dead, proc);
+            count++;
+        } else {
+            enqueue(q, proc);
+        }
+    }
+    return count;
+}
 
 int __sys_killall(struct pcb_t *caller, struct sc_regs* regs)
 {
     char proc_name[100];
-    uint32_t data;
     uint32_t memrg = regs->a1;
-    int i = 0;
-    data = 0;
-    while (data != -1) {
-        libread(caller, memrg, i, &data);
-        proc_name[i] = data;
-        if (data == -1) proc_name[i] = '\0';
-        i++;
+    int i, len;
+
+    /* Fetch the whole name in one go, it ends at the first -1 byte */
+    struct vm_rg_struct *rg = get_symrg_byid(caller->mm, memrg);
+    len = (rg != NULL) ? (int)(rg->rg_end - rg->rg_start) : 0;
+    if (len > (int)sizeof(proc_name) - 1)
+        len = sizeof(proc_name) - 1;
+    if (len <= 0 || libread_range(caller, memrg, 0, (BYTE *)proc_name, len) != 0) {
+        log_printf(LOG_ERR, "Cannot read procname from memregionid %d\n", memrg);
+        return -1;
     }
-    printf("The procname retrieved from memregionid %d is \"%s\"\n", memrg, proc_name);
-    extern pthread_mutex_t queue_lock;
-    pthread_mutex_lock(&queue_lock);
+    proc_name[len] = '\0';
+    for (i = 0; i < len; i++)
+        if (proc_name[i] == (char)-1) proc_name[i] = '\0';
 
+    log_printf(LOG_SYSCALL, "The procname retrieved from memregionid %d is \"%s\"\n", memrg, proc_name);
+    /* The queues of the scheduler, under its lock. The killed processes
+     * are released once it is dropped, their teardown takes mm locks */
+    struct sim *sim = cur_sim;
+    struct queue_t dead = { 0 };
     struct pcb_t *proc;
     int count = 0;
 
-    struct queue_t *running_list = caller->running_list;
-    int running_size = running_list ? running_list->size : 0;
-    for (int j = 0; j < running_size; j++) {
-        proc = dequeue(running_list);
-        if (proc && strcmp(proc->path, proc_name) == 0) {
-            free(proc);
-            count++;
-        } else if (proc) {
-            enqueue(running_list, proc);
-        }
-    }
-
-    struct queue_t *ready_queue = caller->ready_queue;
-    int ready_size = ready_queue ? ready_queue->size : 0;
-    for (int j = 0; j < ready_size; j++) {
-        proc = dequeue(ready_queue);
-        if (proc && strcmp(proc->path, proc_name) == 0) {
-            free(proc);
-            count++;
-        } else if (proc) {
-            enqueue(ready_queue, proc);
-        }
-    }
-
+    REPLAY_LOCK(REPLAY_KILL, &sim->queue_lock);
+    count += kill_in_queue(&sim->run_queue, proc_name, &dead);
+    count += kill_in_queue(&sim->ready_queue, proc_name, &dead);
 #ifdef MLQ_SCHED
-    for (int prio = 0; prio < MAX_PRIO; prio++) {
-        struct queue_t *mlq_queue = &caller->mlq_ready_queue[prio];
-        int mlq_size = mlq_queue ? mlq_queue->size : 0;
-        for (int j = 0; j < mlq_size; j++) {
-            proc = dequeue(mlq_queue);
-            if (proc && strcmp(proc->path, proc_name) == 0) {
-                free(proc);
-                count++;
-            } else if (proc) {
-                enqueue(mlq_queue, proc);
-            }
-        }
-    }
+    for (int prio = 0; prio < MAX_PRIO; prio++)
+        count += kill_in_queue(&sim->mlq_ready_queue[prio], proc_name, &dead);
 #endif
+    REPLAY_UNLOCK(REPLAY_KILL, count, &sim->queue_lock);
+
+    while ((proc = dequeue(&dead)) != NULL)
+        unload(proc);
+    queue_free(&dead);
 
-    pthread_mutex_unlock(&queue_lock);
     return count;
 }
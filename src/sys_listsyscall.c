@@ -17,12 +17,13 @@
 //    return 0;
 // }
 #include "syscall.h"
+#include "log.h"
 
 int __sys_listsyscall(struct pcb_t *caller, struct sc_regs* reg)
 {
     for (int i = 0; i < syscall_table_size; i++) {
         if (sys_call_table[i] != NULL) {
-            printf("%s\n", sys_call_table[i]);
+            log_printf(LOG_SYSCALL, "%s\n", sys_call_table[i]);
         }
     }
     return 0;
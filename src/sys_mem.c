@@ -18,17 +18,27 @@ int __sys_memmap(struct pcb_t *caller, struct sc_regs* regs)
 {
    int memop = regs->a1;
    BYTE value;
+   int ret = 0;
 
    switch (memop) {
    case SYSMEM_MAP_OP:
-            /* Reserved process case*/
+            /* a2: new area id, a3: size in, start address out, a4: flags */
+            ret = map_vm_area(caller, regs->a2, regs->a3, regs->a4);
+            if (ret >= 0)
+            {
+               regs->a3 = ret;
+               ret = 0;
+            }
             break;
    case SYSMEM_INC_OP:
-            inc_vma_limit(caller, regs->a2, regs->a3);
+            ret = inc_vma_limit(caller, regs->a2, regs->a3);
             break;
    case SYSMEM_SWP_OP:
             __mm_swap_page(caller, regs->a2, regs->a3);
             break;
+   case SYSMEM_SWPIN_OP:
+            __mm_swap_in_page(caller, regs->a2, regs->a3);
+            break;
    case SYSMEM_IO_READ:
             MEMPHY_read(caller->mram, regs->a2, &value);
             regs->a3 = value;
@@ -37,11 +47,11 @@ int __sys_memmap(struct pcb_t *caller, struct sc_regs* regs)
             MEMPHY_write(caller->mram, regs->a2, regs->a3);
             break;
    default:
-            printf("Memop code: %d\n", memop);
+            log_printf(LOG_SYSCALL, "Memop code: %d\n", memop);
             break;
    }
    
-   return 0;
+   return ret;
 }
 
 
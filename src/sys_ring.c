@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2025 pdnguyen of HCMC University of Technology VNU-HCM
+ */
+
+/* Sierra release
+ * Source Code License Grant: The authors hereby grant to Licensee
+ * personal permission to use and modify the Licensed Source Code
+ * for the sole purpose of studying while attending the course CO2018.
+ */
+
+#include "syscall.h"
+
+/*
+ * __sys_ring_enter - run the queued entries of the caller ring in order
+ * @regs->a1: number of entries to consume
+ *
+ * Each entry posts one completion. An entry whose SC_SQE_LINK predecessor
+ * failed is completed with SC_CQE_CANCELED instead of being run.
+ * Return the number of consumed entries.
+ */
+int __sys_ring_enter(struct pcb_t *caller, struct sc_regs *regs)
+{
+   struct sc_ring *ring = caller->sc_ring;
+   uint32_t to_submit = regs->a1;
+   uint32_t done = 0;
+   int broken_link = 0;
+
+   if (ring == NULL)
+      return 0;
+
+   while (done < to_submit && ring->sq_head != ring->sq_tail &&
+          ring->cq_tail - ring->cq_head < SC_RING_SZ)
+   {
+      struct sc_sqe *sqe = &ring->sq[ring->sq_head & SC_RING_MASK];
+      struct sc_cqe *cqe = &ring->cq[ring->cq_tail & SC_RING_MASK];
+
+      cqe->user_data = sqe->user_data;
+      cqe->regs = sqe->regs;
+      if (broken_link)
+         cqe->res = SC_CQE_CANCELED;
+      else if (sqe->nr == SC_NR_RING_ENTER)
+         cqe->res = -1; /* no nested ring entry */
+      else
+         cqe->res = syscall(caller, sqe->nr, &cqe->regs);
+
+      broken_link = (sqe->flags & SC_SQE_LINK) && cqe->res < 0;
+
+      ring->sq_head++;
+      ring->cq_tail++;
+      done++;
+   }
+#ifdef SYSCALL_STATS
+   __atomic_fetch_add(&sys_ring_ops, done, __ATOMIC_RELAXED);
+#endif
+
+   return done;
+}
@@ -10,6 +10,15 @@
 
 #include "syscall.h"
 #include "common.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#ifdef SYSCALL_STATS
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
 #define __SYSCALL(nr, sym) extern int __##sym(struct pcb_t*,struct sc_regs*);
 #include "syscalltbl.lst"
@@ -30,12 +39,89 @@ int __sys_ni_syscall(struct pcb_t *caller, struct sc_regs *regs){
    return 0;
 }
 
-#define __SYSCALL(nr, sym) case nr: return __##sym(caller,regs);
-int syscall(struct pcb_t *caller, uint32_t nr, struct sc_regs* regs)
+/*
+ * The sys_call_vec[] is indexed directly by the syscall number, holes in
+ * the numbering point to __sys_ni_syscall.
+ */
+#define __SYSCALL(nr, sym) __##sym,
+#define __SYSCALL_NI(nr) __sys_ni_syscall,
+static const sys_call_ptr_t sys_call_vec[] = {
+#include "syscallvec.lst"
+};
+#undef  __SYSCALL
+#undef  __SYSCALL_NI
+#define SYS_CALL_VEC_SIZE (sizeof(sys_call_vec)/sizeof(sys_call_ptr_t))
+
+#ifdef SYSCALL_STATS
+#define __SYSCALL(nr, sym) #sym,
+#define __SYSCALL_NI(nr) NULL,
+static const char *sys_call_name[] = {
+#include "syscallvec.lst"
+};
+#undef  __SYSCALL
+#undef  __SYSCALL_NI
+
+/* Last slot collects the out of range numbers */
+static uint64_t sys_call_count[SYS_CALL_VEC_SIZE + 1];
+static uint64_t sys_call_cycles[SYS_CALL_VEC_SIZE + 1];
+/* Entries run by sys_ring_enter, counted in sys_ring.c */
+uint64_t sys_ring_ops;
+
+static inline uint64_t syscall_cycles(void)
 {
-	switch (nr) {
-	#include "syscalltbl.lst"
-	default: return __sys_ni_syscall(caller, regs);
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * syscall_dump_stats - print call count and time spent per syscall
+ */
+void syscall_dump_stats(void)
+{
+	uint32_t nr;
+
+	log_printf(LOG_STATS, "===== SYSCALL STATS =====\n");
+	log_printf(LOG_STATS, "%4s %-20s %12s %16s %12s\n", "nr", "name", "calls", "cycles", "cycles/call");
+	for (nr = 0; nr <= SYS_CALL_VEC_SIZE; nr++) {
+		if (sys_call_count[nr] == 0)
+			continue;
+		const char *name = (nr < SYS_CALL_VEC_SIZE && sys_call_name[nr] != NULL) ?
+			sys_call_name[nr] : "sys_ni_syscall";
+		log_printf(LOG_STATS, "%4u %-20s %12lu %16lu %12lu\n", nr, name,
+			(unsigned long)sys_call_count[nr],
+			(unsigned long)sys_call_cycles[nr],
+			(unsigned long)(sys_call_cycles[nr] / sys_call_count[nr]));
 	}
-};
+	/* How much the ring batches: entries run per kernel entry */
+	if (sys_call_count[SC_NR_RING_ENTER] != 0)
+		log_printf(LOG_STATS, "ring: %lu entries in %lu submissions, %.2f per submission\n",
+			(unsigned long)sys_ring_ops,
+			(unsigned long)sys_call_count[SC_NR_RING_ENTER],
+			(double)sys_ring_ops / sys_call_count[SC_NR_RING_ENTER]);
+	log_printf(LOG_STATS, "================================================================\n");
+}
+#endif
 
+int syscall(struct pcb_t *caller, uint32_t nr, struct sc_regs* regs)
+{
+	sys_call_ptr_t fn = (nr < SYS_CALL_VEC_SIZE) ? sys_call_vec[nr] : __sys_ni_syscall;
+
+	STATS_ADD(syscalls[nr < STATS_NR_SYSCALLS ? nr : STATS_NR_SYSCALLS - 1], 1);
+	TRACE(TRACE_SYSCALL, caller != NULL ? caller->pid : 0, nr);
+#ifdef SYSCALL_STATS
+	uint32_t slot = (nr < SYS_CALL_VEC_SIZE) ? nr : SYS_CALL_VEC_SIZE;
+	uint64_t start = syscall_cycles();
+	int ret = fn(caller, regs);
+
+	__atomic_fetch_add(&sys_call_count[slot], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&sys_call_cycles[slot], syscall_cycles() - start, __ATOMIC_RELAXED);
+	return ret;
+#else
+	return fn(caller, regs);
+#endif
+}
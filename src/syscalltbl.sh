@@ -9,21 +9,23 @@
 set -e
 
 usage() {
-	echo >&2 "usage: $0 INFILE OUTFILE" >&2
+	echo >&2 "usage: $0 INFILE OUTFILE [VECFILE]" >&2
 	echo >&2
 	echo >&2 "  INFILE    input syscall table"
 	echo >&2 "  OUTFILE   output lst file"
+	echo >&2 "  VECFILE   output dense lst file, one entry per number"
 	echo >&2
 	exit 1
 }
 
 
-if [ $# -ne 2 ]; then
+if [ $# -ne 2 ] && [ $# -ne 3 ]; then
 	usage
 fi
 
 infile="$1"
 outfile="$2"
+vecfile="$3"
 
 nxt=0
 
@@ -37,3 +39,24 @@ grep -E "^[0-9]+[[:space:]]+" "$infile" | sort -n | {
 		nxt=$((nr + 1))
 	done
 } > "$outfile"
+
+[ -n "$vecfile" ] || exit 0
+
+# Dense table: holes between numbers are filled with __SYSCALL_NI so that
+# the n-th entry is syscall number n
+grep -E "^[0-9]+[[:space:]]+" "$infile" | sort -n | {
+
+	while read nr name native ; do
+
+		while [ "$nxt" -lt "$nr" ]; do
+			echo "__SYSCALL_NI($nxt)"
+			nxt=$((nxt + 1))
+		done
+		if [ -n "$native" ]; then
+			echo "__SYSCALL($nr, $native)"
+		else
+			echo "__SYSCALL_NI($nr)"
+		fi
+		nxt=$((nr + 1))
+	done
+} > "$vecfile"
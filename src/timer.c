@@ -1,32 +1,42 @@
 
 #include "timer.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "sim.h"
 #include <stdio.h>
 #include <stdlib.h>
 
-static pthread_t _timer;
-
 struct timer_id_container_t {
 	struct timer_id_t id;
 	struct timer_id_container_t * next;
 };
 
-static struct timer_id_container_t * dev_list = NULL;
-
-static uint64_t _time;
-
-static int timer_started = 0;
-static int timer_stop = 0;
+/* Ordered mode: let @id run its part of the slot */
+static void grant_turn(struct timer_id_t * id) {
+	pthread_mutex_lock(&id->timer_lock);
+	id->turn = 1;
+	pthread_cond_signal(&id->timer_cond);
+	pthread_mutex_unlock(&id->timer_lock);
+}
 
 
 static void * timer_routine(void * args) {
-	while (!timer_stop) {
-		printf("Time slot %3lu\n", current_time());
+	struct sim * sim = (struct sim *)args;
+
+	sim_bind(sim);
+	/* Runs until every device has detached, so the last slot that a
+	 * device worked in is always counted */
+	while (1) {
+		log_printf(LOG_TIMER, "Time slot %3lu\n", current_time());
 		int fsh = 0;
 		int event = 0;
 		/* Wait for all devices have done the job in current
 		 * time slot */
 		struct timer_id_container_t * temp;
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
+		for (temp = sim->dev_list; temp != NULL; temp = temp->next) {
+			if (sim->ordered)
+				grant_turn(&temp->id);
 			pthread_mutex_lock(&temp->id.event_lock);
 			while (!temp->id.done && !temp->id.fsh) {
 				pthread_cond_wait(
@@ -41,11 +51,15 @@ static void * timer_routine(void * args) {
 			pthread_mutex_unlock(&temp->id.event_lock);
 		}
 
+		/* Every device waits, the counters are stable */
+		stats_tick(sim->time);
+		trace_tick(sim->time);
+
 		/* Increase the time slot */
-		_time++;
+		sim->time++;
 		
 		/* Let devices continue their job */
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
+		for (temp = sim->dev_list; temp != NULL; temp = temp->next) {
 			pthread_mutex_lock(&temp->id.timer_lock);
 			temp->id.done = 0;
 			pthread_cond_signal(&temp->id.timer_cond);
@@ -59,6 +73,11 @@ static void * timer_routine(void * args) {
 }
 
 void next_slot(struct timer_id_t * timer_id) {
+	/* The turn is over, the timer grants the next one */
+	pthread_mutex_lock(&timer_id->timer_lock);
+	timer_id->turn = 0;
+	pthread_mutex_unlock(&timer_id->timer_lock);
+
 	/* Tell to timer that we have done our job in current slot */
 	pthread_mutex_lock(&timer_id->event_lock);
 	timer_id->done = 1;
@@ -67,7 +86,18 @@ void next_slot(struct timer_id_t * timer_id) {
 
 	/* Wait for going to next slot */
 	pthread_mutex_lock(&timer_id->timer_lock);
-	while (timer_id->done) {
+	while (timer_id->done || (cur_sim->ordered && !timer_id->turn)) {
+		pthread_cond_wait(
+			&timer_id->timer_cond,
+			&timer_id->timer_lock
+		);
+	}
+	pthread_mutex_unlock(&timer_id->timer_lock);
+}
+
+void wait_slot(struct timer_id_t * timer_id) {
+	pthread_mutex_lock(&timer_id->timer_lock);
+	while (cur_sim->ordered && !timer_id->turn) {
 		pthread_cond_wait(
 			&timer_id->timer_cond,
 			&timer_id->timer_lock
@@ -77,12 +107,12 @@ void next_slot(struct timer_id_t * timer_id) {
 }
 
 uint64_t current_time() {
-	return _time;
+	return cur_sim->time;
 }
 
 void start_timer() {
-	timer_started = 1;
-	pthread_create(&_timer, NULL, timer_routine, NULL);
+	cur_sim->timer_started = 1;
+	pthread_create(&cur_sim->timer, NULL, timer_routine, cur_sim);
 }
 
 void detach_event(struct timer_id_t * event) {
@@ -93,7 +123,7 @@ void detach_event(struct timer_id_t * event) {
 }
 
 struct timer_id_t * attach_event() {
-	if (timer_started) {
+	if (cur_sim->timer_started) {
 		return NULL;
 	}else{
 		struct timer_id_container_t * container =
@@ -102,27 +132,27 @@ struct timer_id_t * attach_event() {
 			);
 		container->id.done = 0;
 		container->id.fsh = 0;
+		container->id.turn = 0;
 		pthread_cond_init(&container->id.event_cond, NULL);
 		pthread_mutex_init(&container->id.event_lock, NULL);
 		pthread_cond_init(&container->id.timer_cond, NULL);
 		pthread_mutex_init(&container->id.timer_lock, NULL);
-		if (dev_list == NULL) {
-			dev_list = container;
-			dev_list->next = NULL;
-		}else{
-			container->next = dev_list;
-			dev_list = container;
+		/* Appended, ordered mode runs the devices in this order */
+		struct timer_id_container_t ** tail = &cur_sim->dev_list;
+		while (*tail != NULL) {
+			tail = &(*tail)->next;
 		}
+		container->next = NULL;
+		*tail = container;
 		return &(container->id);
 	}
 }
 
 void stop_timer() {
-	timer_stop = 1;
-	pthread_join(_timer, NULL);
-	while (dev_list != NULL) {
-		struct timer_id_container_t * temp = dev_list;
-		dev_list = dev_list->next;
+	pthread_join(cur_sim->timer, NULL);
+	while (cur_sim->dev_list != NULL) {
+		struct timer_id_container_t * temp = cur_sim->dev_list;
+		cur_sim->dev_list = temp->next;
 		pthread_cond_destroy(&temp->id.event_cond);
 		pthread_mutex_destroy(&temp->id.event_lock);
 		pthread_cond_destroy(&temp->id.timer_cond);
@@ -0,0 +1,196 @@
+
+#include "trace.h"
+#include "sched.h"
+#include "mm.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef SIM_TRACE
+
+#define TRACE_TID_OTHER 999 /* threads that never called trace_bind */
+
+struct trace_rec {
+	uint64_t slot;
+	long arg;
+	int pid;
+	short kind;
+	short tid;
+};
+
+struct trace_buf {
+	struct trace_rec rec[TRACE_BUF_EVENTS];
+	int len;
+	int tid;
+	struct trace_buf * next;
+};
+
+int trace_on;
+
+static FILE * trace_file;
+static int trace_first = 1;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_buf * trace_bufs;
+static __thread struct trace_buf * my_buf;
+
+static struct memphy_struct * trace_mram;
+static int last_free = -1;
+static int last_depth[MAX_PRIO];
+
+static const char * trace_name[] = {
+	[TRACE_FAULT] = "page_fault",
+	[TRACE_SWAP_IN] = "swap_in",
+	[TRACE_SWAP_OUT] = "swap_out",
+	[TRACE_SYSCALL] = "syscall",
+};
+
+/* Caller holds trace_lock */
+static void trace_sep(void) {
+	fputs(trace_first ? "\n" : ",\n", trace_file);
+	trace_first = 0;
+}
+
+/* Format the records of @buf into the file, caller holds trace_lock */
+static void trace_flush(struct trace_buf * buf) {
+	for (int i = 0; i < buf->len; i++) {
+		struct trace_rec * r = &buf->rec[i];
+		unsigned long ts = (unsigned long)r->slot * TRACE_SLOT_US;
+
+		trace_sep();
+		switch (r->kind) {
+		case TRACE_RUN:
+			fprintf(trace_file, "{\"name\":\"PID %d\",\"cat\":\"sched\",\"ph\":\"X\","
+				"\"pid\":0,\"tid\":%d,\"ts\":%lu,\"dur\":%lu,\"args\":{\"pid\":%d}}",
+				r->pid, r->tid, ts, (unsigned long)r->arg * TRACE_SLOT_US, r->pid);
+			break;
+		case TRACE_FREE_FRAMES:
+			fprintf(trace_file, "{\"name\":\"free frames\",\"ph\":\"C\",\"pid\":0,"
+				"\"ts\":%lu,\"args\":{\"frames\":%ld}}", ts, r->arg);
+			break;
+		case TRACE_READY:
+			fprintf(trace_file, "{\"name\":\"ready prio %d\",\"ph\":\"C\",\"pid\":0,"
+				"\"ts\":%lu,\"args\":{\"procs\":%ld}}", r->pid, ts, r->arg);
+			break;
+		default:
+			fprintf(trace_file, "{\"name\":\"%s\",\"cat\":\"mm\",\"ph\":\"i\",\"s\":\"t\","
+				"\"pid\":0,\"tid\":%d,\"ts\":%lu,\"args\":{\"pid\":%d,\"%s\":%ld}}",
+				trace_name[r->kind], r->tid, ts, r->pid,
+				r->kind == TRACE_SYSCALL ? "nr" : "page", r->arg);
+		}
+	}
+	buf->len = 0;
+}
+
+static struct trace_buf * trace_get(void) {
+	if (my_buf == NULL) {
+		my_buf = calloc(1, sizeof(struct trace_buf));
+		my_buf->tid = TRACE_TID_OTHER;
+		pthread_mutex_lock(&trace_lock);
+		my_buf->next = trace_bufs;
+		trace_bufs = my_buf;
+		pthread_mutex_unlock(&trace_lock);
+	}
+	return my_buf;
+}
+
+/*
+ * trace_bind - show the events of this thread on track @tid named @name
+ */
+void trace_bind(int tid, const char * name) {
+	if (!trace_on)
+		return;
+	trace_get()->tid = tid;
+	pthread_mutex_lock(&trace_lock);
+	trace_sep();
+	fprintf(trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+		"\"args\":{\"name\":\"%s\"}}", tid, name);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_event(int kind, uint64_t slot, int pid, long arg) {
+	struct trace_buf * buf = trace_get();
+	struct trace_rec * r;
+
+	if (buf->len == TRACE_BUF_EVENTS) {
+		pthread_mutex_lock(&trace_lock);
+		trace_flush(buf);
+		pthread_mutex_unlock(&trace_lock);
+	}
+	r = &buf->rec[buf->len++];
+	r->slot = slot;
+	r->arg = arg;
+	r->pid = pid;
+	r->kind = kind;
+	r->tid = buf->tid;
+}
+
+/*
+ * trace_tick - counter samples at the end of a slot, only on change
+ * Called by the timer while every device waits for the next slot.
+ */
+void trace_tick(uint64_t slot) {
+	int depth[MAX_PRIO];
+
+	if (!trace_on)
+		return;
+	if (trace_mram != NULL) {
+		int nfree = __atomic_load_n(&trace_mram->free_fp_cnt, __ATOMIC_RELAXED);
+
+		if (nfree != last_free) {
+			last_free = nfree;
+			trace_event(TRACE_FREE_FRAMES, slot, 0, last_free);
+		}
+	}
+	sched_queue_depths(depth);
+	for (int p = 0; p < MAX_PRIO; p++) {
+		if (depth[p] == last_depth[p])
+			continue;
+		last_depth[p] = depth[p];
+		trace_event(TRACE_READY, slot, p, depth[p]);
+	}
+}
+
+/*
+ * trace_start - open the trace file and start recording
+ * @mram: RAM device for the free frames counter, or NULL
+ */
+int trace_start(const char * path, struct memphy_struct * mram) {
+	if ((trace_file = fopen(path, "w")) == NULL) {
+		log_printf(LOG_ERR, "Cannot write trace to %s\n", path);
+		return -1;
+	}
+	trace_mram = mram;
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", trace_file);
+	fprintf(trace_file, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+		"\"args\":{\"name\":\"ossim\"}}");
+	trace_first = 0;
+	trace_on = 1;
+	return 0;
+}
+
+/*
+ * trace_stop - write out every buffer and close the file
+ * Called once the threads that trace have stopped.
+ */
+void trace_stop(void) {
+	struct trace_buf * buf;
+
+	if (!trace_on)
+		return;
+	trace_on = 0;
+	pthread_mutex_lock(&trace_lock);
+	while ((buf = trace_bufs) != NULL) {
+		trace_bufs = buf->next;
+		trace_flush(buf);
+		free(buf);
+	}
+	fputs("\n]}\n", trace_file);
+	fclose(trace_file);
+	trace_file = NULL;
+	pthread_mutex_unlock(&trace_lock);
+	my_buf = NULL;
+}
+
+#endif
@@ -0,0 +1,355 @@
+/*
+ * wlgen - synthetic workload generator
+ *
+ * Writes a configure file input/<name> in the read_config format and a
+ * pool of programs input/proc/<name>/p<i> in the loader format. The same
+ * seed and options always give the same files.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#define WL_MAX_PROCS   100000
+#define WL_MAX_PRIO    140    /* MAX_PRIO of the MLQ scheduler */
+#define WL_MAX_REGIONS 64
+
+enum wl_op { OP_CALC, OP_READ, OP_WRITE, OP_READN, OP_WRITEN, OP_ALLOC, OP_SYSCALL, NR_OPS };
+
+static const char * op_name[NR_OPS] = {
+	"calc", "read", "write", "readn", "writen", "alloc", "syscall",
+};
+
+struct wl_opts {
+	uint64_t seed;
+	int procs, programs;
+	int cpus, time_slot;
+	long ram, swap;
+	int len;                 /* mean program length */
+	int mix[NR_OPS];         /* relative weights */
+	int rg_min, rg_max;      /* region size in bytes */
+	int regions;             /* live regions per program */
+	double locality;         /* probability an access stays near the last one */
+	int prio_lo, prio_hi;
+	int prio_zipf;           /* skew priorities toward prio_lo */
+	int bursty;
+	double rate;             /* arrivals per time slot */
+	int burst;               /* processes per burst */
+	const char * name;
+};
+
+/* xorshift64*, the same stream on every platform */
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Uniform in [0, 1) */
+static double rng_unit(void) {
+	return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Uniform in [lo, hi] */
+static long rng_range(long lo, long hi) {
+	return lo + (long)(rng_next() % (uint64_t)(hi - lo + 1));
+}
+
+static double rng_exp(double mean) {
+	return -mean * log(1.0 - rng_unit());
+}
+
+/* Zipf with s = 1 over n values by inversion of the harmonic sum */
+static int rng_zipf(int n) {
+	double h = 0, u;
+	int k;
+
+	for (k = 1; k <= n; k++)
+		h += 1.0 / k;
+	u = rng_unit() * h;
+	for (k = 1; k < n; k++) {
+		u -= 1.0 / k;
+		if (u <= 0)
+			break;
+	}
+	return k - 1;
+}
+
+static int pick_prio(const struct wl_opts * o) {
+	if (o->prio_zipf)
+		return o->prio_lo + rng_zipf(o->prio_hi - o->prio_lo + 1);
+	return rng_range(o->prio_lo, o->prio_hi);
+}
+
+static int pick_op(const struct wl_opts * o) {
+	int total = 0, i, r;
+
+	for (i = 0; i < NR_OPS; i++)
+		total += o->mix[i];
+	r = rng_range(0, total - 1);
+	for (i = 0; r >= o->mix[i]; i++)
+		r -= o->mix[i];
+	return i;
+}
+
+/*
+ * gen_program - write one program, every access falls inside a live region
+ * Regions are identified by their register, free slots are reused.
+ */
+static int gen_program(const struct wl_opts * o, const char * path) {
+	int size[WL_MAX_REGIONS] = {0}; /* 0 for a free register */
+	int live = 0, last_rg = -1, last_off = 0;
+	int len = rng_range(o->len / 2 > 1 ? o->len / 2 : 1, o->len + o->len / 2);
+	int n, rg, off;
+	FILE * f;
+
+	if ((f = fopen(path, "w")) == NULL) {
+		fprintf(stderr, "wlgen: cannot write %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	fprintf(f, "%d %d\n", pick_prio(o), len);
+
+	/* The tail frees what is still live, keep room for it */
+	for (n = 0; n < len - live; n++) {
+		int op = pick_op(o);
+
+		if (op == OP_ALLOC || (live == 0 && op != OP_CALC && op != OP_SYSCALL)) {
+			if (live == o->regions) {
+				/* Full, release one instead */
+				do rg = rng_range(0, o->regions - 1); while (size[rg] == 0);
+				fprintf(f, "free %d\n", rg);
+				size[rg] = 0;
+				live--;
+				if (rg == last_rg)
+					last_rg = -1;
+				continue;
+			}
+			if (n + 2 > len - live) {
+				/* No room for its free, fill with work */
+				fprintf(f, "calc\n");
+				continue;
+			}
+			for (rg = 0; size[rg] != 0; rg++)
+				;
+			size[rg] = rng_range(o->rg_min, o->rg_max);
+			fprintf(f, "alloc %d %d\n", size[rg], rg);
+			live++;
+			continue;
+		}
+		if (op == OP_CALC) {
+			fprintf(f, "calc\n");
+			continue;
+		}
+		if (op == OP_SYSCALL) {
+			fprintf(f, "syscall 0\n"); /* listsyscall */
+			continue;
+		}
+
+		/* Memory access, near the previous one or anywhere */
+		if (last_rg >= 0 && rng_unit() < o->locality) {
+			rg = last_rg;
+			off = last_off + rng_range(-16, 16);
+			if (off < 0)
+				off = 0;
+			if (off >= size[rg])
+				off = size[rg] - 1;
+		} else {
+			do rg = rng_range(0, o->regions - 1); while (size[rg] == 0);
+			off = rng_range(0, size[rg] - 1);
+		}
+		last_rg = rg;
+		last_off = off;
+
+		switch (op) {
+		case OP_READ:
+			fprintf(f, "read %d %d %d\n", rg, off, rg);
+			break;
+		case OP_WRITE:
+			fprintf(f, "write %ld %d %d\n", rng_range(0, 255), rg, off);
+			break;
+		case OP_READN:
+			fprintf(f, "readn %d %d %ld\n", rg, off,
+				rng_range(1, size[rg] - off < 64 ? size[rg] - off : 64));
+			break;
+		case OP_WRITEN:
+			fprintf(f, "writen %ld %d %d %ld\n", rng_range(0, 255), rg, off,
+				rng_range(1, size[rg] - off < 64 ? size[rg] - off : 64));
+			break;
+		}
+	}
+	for (rg = 0; rg < o->regions; rg++) {
+		if (size[rg] != 0)
+			fprintf(f, "free %d\n", rg);
+	}
+
+	fclose(f);
+	return 0;
+}
+
+/*
+ * gen_config - arrivals are a Poisson process of rate @rate per slot, in
+ * bursty mode bursts of @burst processes arrive at rate / burst
+ */
+static int gen_config(const struct wl_opts * o, const char * path) {
+	double t = 0;
+	int i, in_burst = 0;
+	FILE * f;
+
+	if ((f = fopen(path, "w")) == NULL) {
+		fprintf(stderr, "wlgen: cannot write %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	fprintf(f, "%d %d %d\n", o->time_slot, o->cpus, o->procs);
+	fprintf(f, "%ld %ld 0 0 0\n", o->ram, o->swap);
+	for (i = 0; i < o->procs; i++) {
+		if (!o->bursty)
+			t += rng_exp(1.0 / o->rate);
+		else if (in_burst-- == 0) {
+			t += rng_exp(o->burst / o->rate);
+			in_burst = o->burst - 1;
+		}
+		fprintf(f, "%lu %s/p%ld %d\n", (unsigned long)t, o->name,
+			rng_range(0, o->programs - 1), pick_prio(o));
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static int parse_mix(struct wl_opts * o, const char * list) {
+	char buf[256];
+	char * tok, * save;
+
+	snprintf(buf, sizeof(buf), "%s", list);
+	memset(o->mix, 0, sizeof(o->mix));
+	for (tok = strtok_r(buf, ",", &save); tok != NULL;
+	     tok = strtok_r(NULL, ",", &save)) {
+		char * eq = strchr(tok, '=');
+		int i;
+
+		if (eq == NULL)
+			return -1;
+		*eq = '\0';
+		for (i = 0; i < NR_OPS && strcmp(tok, op_name[i]) != 0; i++)
+			;
+		if (i == NR_OPS)
+			return -1;
+		o->mix[i] = atoi(eq + 1);
+	}
+	return 0;
+}
+
+static int parse_arrival(struct wl_opts * o, const char * s) {
+	if (sscanf(s, "poisson:%lf", &o->rate) == 1) {
+		o->bursty = 0;
+		return o->rate > 0 ? 0 : -1;
+	}
+	if (sscanf(s, "bursty:%lf:%d", &o->rate, &o->burst) == 2) {
+		o->bursty = 1;
+		return o->rate > 0 && o->burst > 0 ? 0 : -1;
+	}
+	return -1;
+}
+
+static void usage(void) {
+	fprintf(stderr,
+		"Usage: wlgen [options] name\n"
+		"  -S seed          : random seed (1)\n"
+		"  -n procs         : processes in the config, up to %d (100)\n"
+		"  -p programs      : distinct programs the processes run (min(procs, 64))\n"
+		"  -c cpus          : CPUs (4)\n"
+		"  -q slots         : time slot (2)\n"
+		"  -M ram:swap      : MEMRAM and MEMSWP0 sizes (1048576:16777216)\n"
+		"  -L length        : mean program length, lengths are +-50%% (50)\n"
+		"  -m op=w,...      : instruction mix over calc read write readn writen alloc syscall\n"
+		"                     (calc=40,read=20,write=20,readn=5,writen=5,alloc=10)\n"
+		"  -r min:max       : region size in bytes (64:1024)\n"
+		"  -R regions       : live regions per program, up to %d (4)\n"
+		"  -x locality      : probability an access stays near the previous one (0.8)\n"
+		"  -P lo:hi[:zipf]  : priority range, uniform or skewed toward lo (0:%d)\n"
+		"  -a poisson:rate  : arrivals per time slot (0.5)\n"
+		"  -a bursty:rate:n : bursts of n processes, same average rate\n"
+		"Writes input/<name> and input/proc/<name>/p*, run with ./os <name>\n",
+		WL_MAX_PROCS, WL_MAX_REGIONS, WL_MAX_PRIO - 1);
+}
+
+int main(int argc, char * argv[]) {
+	struct wl_opts o = {
+		.seed = 1, .procs = 100, .programs = 0, .cpus = 4, .time_slot = 2,
+		.ram = 1048576, .swap = 16777216, .len = 50,
+		.mix = { [OP_CALC] = 40, [OP_READ] = 20, [OP_WRITE] = 20,
+			 [OP_READN] = 5, [OP_WRITEN] = 5, [OP_ALLOC] = 10 },
+		.rg_min = 64, .rg_max = 1024, .regions = 4, .locality = 0.8,
+		.prio_lo = 0, .prio_hi = WL_MAX_PRIO - 1, .rate = 0.5, .burst = 1,
+	};
+	char path[256], zipf[8] = "";
+	int opt, bad = 0, i, total = 0;
+
+	while ((opt = getopt(argc, argv, "S:n:p:c:q:M:L:m:r:R:x:P:a:")) != -1) {
+		switch (opt) {
+		case 'S': o.seed = strtoull(optarg, NULL, 0); break;
+		case 'n': o.procs = atoi(optarg); break;
+		case 'p': o.programs = atoi(optarg); break;
+		case 'c': o.cpus = atoi(optarg); break;
+		case 'q': o.time_slot = atoi(optarg); break;
+		case 'M': bad |= sscanf(optarg, "%ld:%ld", &o.ram, &o.swap) != 2; break;
+		case 'L': o.len = atoi(optarg); break;
+		case 'm': bad |= parse_mix(&o, optarg) != 0; break;
+		case 'r': bad |= sscanf(optarg, "%d:%d", &o.rg_min, &o.rg_max) != 2; break;
+		case 'R': o.regions = atoi(optarg); break;
+		case 'x': o.locality = atof(optarg); break;
+		case 'P':
+			bad |= sscanf(optarg, "%d:%d:%7s", &o.prio_lo, &o.prio_hi, zipf) < 2;
+			o.prio_zipf = strcmp(zipf, "zipf") == 0;
+			bad |= zipf[0] != '\0' && !o.prio_zipf;
+			break;
+		case 'a': bad |= parse_arrival(&o, optarg) != 0; break;
+		default: bad = 1;
+		}
+	}
+	for (i = 0; i < NR_OPS; i++)
+		total += o.mix[i] < 0 ? -1000000 : o.mix[i];
+	if (o.programs <= 0)
+		o.programs = o.procs < 64 ? o.procs : 64;
+	if (bad || optind != argc - 1 || total <= 0 ||
+	    o.procs < 1 || o.procs > WL_MAX_PROCS || o.programs > o.procs ||
+	    o.cpus < 1 || o.time_slot < 1 || o.len < 1 ||
+	    o.rg_min < 1 || o.rg_max < o.rg_min ||
+	    o.regions < 1 || o.regions > WL_MAX_REGIONS ||
+	    o.prio_lo < 0 || o.prio_hi < o.prio_lo || o.prio_hi >= WL_MAX_PRIO) {
+		usage();
+		return 1;
+	}
+	o.name = argv[optind];
+	if (strlen(o.name) > 64 || strchr(o.name, '/') != NULL) {
+		fprintf(stderr, "wlgen: name must be a plain file name of at most 64 characters\n");
+		return 1;
+	}
+	/* A zero seed would stick xorshift at zero */
+	rng_state = o.seed * 0x9E3779B97F4A7C15ULL + 1;
+
+	snprintf(path, sizeof(path), "input/proc/%s", o.name);
+	if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "wlgen: cannot create %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	for (i = 0; i < o.programs; i++) {
+		snprintf(path, sizeof(path), "input/proc/%s/p%d", o.name, i);
+		if (gen_program(&o, path) != 0)
+			return 1;
+	}
+	snprintf(path, sizeof(path), "input/%s", o.name);
+	if (gen_config(&o, path) != 0)
+		return 1;
+
+	printf("wlgen: %s, %d processes over %d programs\n", path, o.procs, o.programs);
+	return 0;
+}